@@ -0,0 +1,13 @@
+#ifndef RECT_H
+#define RECT_H
+
+// A screen space rectangle in pixels. The max bounds are exclusive so a rect
+// covering the whole canvas is { 0, 0, width, height }.
+typedef struct
+{
+	int x0, y0;
+	int x1, y1;
+
+} Rect;
+
+#endif
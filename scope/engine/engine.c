@@ -94,6 +94,8 @@ void engine_run(Engine* engine)
     char ui_draw_str[64] = "";
     char display_str[64] = "";
     char update_str[64] = "";
+    char shadow_stages_str[64] = "";
+    char camera_stages_str[64] = "";
 
     int y = 10;
     int h = 30;
@@ -109,6 +111,8 @@ void engine_run(Engine* engine)
     engine->ui.text[engine->ui.text_count++] = text_create(ui_draw_str, 10, engine->ui.text_count * h + 10, COLOUR_WHITE, 3);
     engine->ui.text[engine->ui.text_count++] = text_create(display_str, 10, engine->ui.text_count * h + 10, COLOUR_WHITE, 3);
     engine->ui.text[engine->ui.text_count++] = text_create(update_str, 10, engine->ui.text_count * h + 10, COLOUR_WHITE, 3);
+    engine->ui.text[engine->ui.text_count++] = text_create(shadow_stages_str, 10, engine->ui.text_count * h + 10, COLOUR_WHITE, 3);
+    engine->ui.text[engine->ui.text_count++] = text_create(camera_stages_str, 10, engine->ui.text_count * h + 10, COLOUR_WHITE, 3);
 
     engine->running = 1;
     while (engine->running)
@@ -145,6 +149,12 @@ void engine_run(Engine* engine)
         }
         snprintf(render_str, sizeof(render_str), "Render: %d", timer_get_elapsed(&t));
 
+        // The render stages' times, the shadow maps are drawn at the same time as
+        // the camera culling.
+        const FrameGraph* fg = &engine->renderer.frame_graph;
+        snprintf(shadow_stages_str, sizeof(shadow_stages_str), "ShadowMaps: %.2f", frame_graph_elapsed_ms(fg, "ShadowMap"));
+        snprintf(camera_stages_str, sizeof(camera_stages_str), "CamCull/Draw: %.2f %.2f", frame_graph_elapsed_ms(fg, "CameraCulling"), frame_graph_elapsed_ms(fg, "CameraDraw"));
+
         // Fire the engine update event.
         timer_restart(&t);
         engine_on_update(engine, dt);
@@ -193,8 +203,14 @@ void engine_destroy(Engine* engine)
     free(engine->font.pixels);
     */
 
+    for (int i = 0; i < engine->scenes_count; ++i)
+    {
+        scene_destroy(&engine->scenes[i]);
+    }
+
     ui_destroy(&engine->ui);
     window_destroy(&engine->window);
+    renderer_destroy(&engine->renderer);
 }
 
 void engine_handle_input(Engine* engine, float dt)
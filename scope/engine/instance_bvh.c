@@ -0,0 +1,366 @@
+#include "instance_bvh.h"
+
+#include "strides.h"
+
+#include "maths/vector3.h"
+
+#include "utils/logger.h"
+#include "utils/memory_utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+void bvh_node_calculate_bounds(InstanceBVH* bvh, int node)
+{
+	// Calculates the AABB around all of the node's instances.
+	float* bounds = bvh->nodes_bounds + node * 6;
+	bounds[0] = bounds[1] = bounds[2] = INFINITY;
+	bounds[3] = bounds[4] = bounds[5] = -INFINITY;
+
+	const int first = bvh->nodes_first[node];
+	const int end = first + bvh->nodes_counts[node];
+
+	for (int i = first; i < end; ++i)
+	{
+		const float* sphere = bvh->spheres + bvh->instances[i] * STRIDE_SPHERE;
+		const float radius = sphere[3];
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			bounds[axis] = min(bounds[axis], sphere[axis] - radius);
+			bounds[axis + 3] = max(bounds[axis + 3], sphere[axis] + radius);
+		}
+	}
+}
+
+int bvh_node_update_bounds(InstanceBVH* bvh, int node)
+{
+	// Recalculates the node's bounds, returns whether they changed.
+	float old_bounds[6];
+	memcpy(old_bounds, bvh->nodes_bounds + node * 6, sizeof(old_bounds));
+
+	float* bounds = bvh->nodes_bounds + node * 6;
+
+	const int left = bvh->nodes_left_children[node];
+	if (-1 == left)
+	{
+		bvh_node_calculate_bounds(bvh, node);
+	}
+	else
+	{
+		const float* l = bvh->nodes_bounds + left * 6;
+		const float* r = bvh->nodes_bounds + (left + 1) * 6;
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			bounds[axis] = min(l[axis], r[axis]);
+			bounds[axis + 3] = max(l[axis + 3], r[axis + 3]);
+		}
+	}
+
+	return 0 != memcmp(old_bounds, bounds, sizeof(old_bounds));
+}
+
+Status instance_bvh_build(InstanceBVH* bvh, const float* spheres, int instances_count)
+{
+	bvh->instances_count = instances_count;
+	bvh->nodes_count = 0;
+
+	if (0 == instances_count)
+	{
+		bvh->dirty = 0;
+		return STATUS_OK;
+	}
+
+	// A binary tree with n leaves has 2n - 1 nodes, and there's at most one
+	// leaf per instance.
+	const int max_nodes = instances_count * 2 - 1;
+
+	if (STATUS_OK != resize_float_buffer(&bvh->nodes_bounds, max_nodes * 6) ||
+		STATUS_OK != resize_int_buffer(&bvh->nodes_left_children, max_nodes) ||
+		STATUS_OK != resize_int_buffer(&bvh->nodes_parents, max_nodes) ||
+		STATUS_OK != resize_int_buffer(&bvh->nodes_first, max_nodes) ||
+		STATUS_OK != resize_int_buffer(&bvh->nodes_counts, max_nodes) ||
+		STATUS_OK != resize_int_buffer(&bvh->instances, instances_count) ||
+		STATUS_OK != resize_int_buffer(&bvh->instances_leaves, instances_count) ||
+		STATUS_OK != resize_float_buffer(&bvh->spheres, instances_count * STRIDE_SPHERE))
+	{
+		log_error("Failed to allocate memory for the instance bvh.");
+		bvh->instances_count = 0;
+		return STATUS_ALLOC_FAILURE;
+	}
+
+	memcpy(bvh->spheres, spheres, (size_t)instances_count * STRIDE_SPHERE * sizeof(float));
+
+	for (int i = 0; i < instances_count; ++i)
+	{
+		bvh->instances[i] = i;
+	}
+
+	// Create the root.
+	bvh->nodes_first[0] = 0;
+	bvh->nodes_counts[0] = instances_count;
+	bvh->nodes_parents[0] = -1;
+	bvh->nodes_count = 1;
+
+	// Split the nodes top down. The nodes are processed in the order they're
+	// created, so the nodes buffer is used as the queue.
+	for (int node = 0; node < bvh->nodes_count; ++node)
+	{
+		bvh_node_calculate_bounds(bvh, node);
+
+		const int first = bvh->nodes_first[node];
+		const int count = bvh->nodes_counts[node];
+
+		if (count <= BVH_MAX_LEAF_INSTANCES)
+		{
+			bvh->nodes_left_children[node] = -1;
+
+			for (int i = first; i < first + count; ++i)
+			{
+				bvh->instances_leaves[bvh->instances[i]] = node;
+			}
+
+			continue;
+		}
+
+		// Split at the middle of the longest axis of the sphere centres.
+		float centre_min[3] = { INFINITY, INFINITY, INFINITY };
+		float centre_max[3] = { -INFINITY, -INFINITY, -INFINITY };
+
+		for (int i = first; i < first + count; ++i)
+		{
+			const float* sphere = bvh->spheres + bvh->instances[i] * STRIDE_SPHERE;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				centre_min[axis] = min(centre_min[axis], sphere[axis]);
+				centre_max[axis] = max(centre_max[axis], sphere[axis]);
+			}
+		}
+
+		int split_axis = 0;
+		for (int axis = 1; axis < 3; ++axis)
+		{
+			if (centre_max[axis] - centre_min[axis] > centre_max[split_axis] - centre_min[split_axis])
+			{
+				split_axis = axis;
+			}
+		}
+
+		const float split = (centre_min[split_axis] + centre_max[split_axis]) * 0.5f;
+
+		// Partition the instances either side of the split.
+		int mid = first;
+		for (int i = first; i < first + count; ++i)
+		{
+			const int instance = bvh->instances[i];
+			if (bvh->spheres[instance * STRIDE_SPHERE + split_axis] < split)
+			{
+				bvh->instances[i] = bvh->instances[mid];
+				bvh->instances[mid] = instance;
+				++mid;
+			}
+		}
+
+		// If all the centres are on one side, e.g. they're all in the same place,
+		// just split the instances in half.
+		if (mid == first || mid == first + count)
+		{
+			mid = first + count / 2;
+		}
+
+		const int left = bvh->nodes_count;
+		bvh->nodes_count += 2;
+
+		bvh->nodes_left_children[node] = left;
+
+		bvh->nodes_first[left] = first;
+		bvh->nodes_counts[left] = mid - first;
+		bvh->nodes_parents[left] = node;
+
+		bvh->nodes_first[left + 1] = mid;
+		bvh->nodes_counts[left + 1] = first + count - mid;
+		bvh->nodes_parents[left + 1] = node;
+	}
+
+	bvh->dirty = 0;
+
+	return STATUS_OK;
+}
+
+void instance_bvh_refit(InstanceBVH* bvh, int instance_index, const float* sphere)
+{
+	// The tree will be rebuilt anyways.
+	if (bvh->dirty || instance_index >= bvh->instances_count)
+	{
+		return;
+	}
+
+	memcpy(bvh->spheres + instance_index * STRIDE_SPHERE, sphere, STRIDE_SPHERE * sizeof(float));
+
+	// Refit the leaf and then its ancestors, stopping once a node's bounds
+	// don't change as the nodes above it won't either.
+	int node = bvh->instances_leaves[instance_index];
+	while (-1 != node && bvh_node_update_bounds(bvh, node))
+	{
+		node = bvh->nodes_parents[node];
+	}
+}
+
+void bvh_write_subtree(const InstanceBVH* bvh, int node, int visible, int plane_mask, int* visible_flags, int* plane_masks)
+{
+	const int first = bvh->nodes_first[node];
+	const int end = first + bvh->nodes_counts[node];
+
+	for (int i = first; i < end; ++i)
+	{
+		const int instance = bvh->instances[i];
+		visible_flags[instance] = visible;
+		plane_masks[instance] = plane_mask;
+	}
+}
+
+void instance_bvh_cull(const InstanceBVH* bvh, const ViewFrustum* frustum, int* visible_flags, int* plane_masks)
+{
+	if (0 == bvh->nodes_count)
+	{
+		return;
+	}
+
+	const Plane* planes = frustum->planes;
+	const int planes_count = frustum->planes_count;
+
+	// The stack holds the node and the mask of planes it may intersect. The
+	// children's bounds are always inside their parent's, so a plane the
+	// parent is completely inside never needs testing again.
+	// The depth is at most the number of nodes, but that's only for a
+	// really unbalanced tree.
+	int stack_nodes[64];
+	int stack_masks[64];
+	int stack_count = 0;
+
+	stack_nodes[stack_count] = 0;
+	stack_masks[stack_count++] = (1 << planes_count) - 1;
+
+	while (stack_count > 0)
+	{
+		--stack_count;
+		const int node = stack_nodes[stack_count];
+		int mask = stack_masks[stack_count];
+
+		const float* bounds = bvh->nodes_bounds + node * 6;
+
+		V3 centre = {
+			(bounds[0] + bounds[3]) * 0.5f,
+			(bounds[1] + bounds[4]) * 0.5f,
+			(bounds[2] + bounds[5]) * 0.5f
+		};
+
+		V3 extents = {
+			(bounds[3] - bounds[0]) * 0.5f,
+			(bounds[4] - bounds[1]) * 0.5f,
+			(bounds[5] - bounds[2]) * 0.5f
+		};
+
+		int outside = 0;
+
+		for (int j = 0; j < planes_count; ++j)
+		{
+			if (!(mask & (1 << j)))
+			{
+				continue;
+			}
+
+			// The distance of the AABB's furthest corner from the plane's centre.
+			const V3 n = planes[j].normal;
+			const float radius = fabsf(n.x) * extents.x + fabsf(n.y) * extents.y + fabsf(n.z) * extents.z;
+			const float dist = signed_distance(&planes[j], centre);
+
+			if (dist < -radius)
+			{
+				outside = 1;
+				break;
+			}
+			else if (dist >= radius)
+			{
+				mask &= ~(1 << j);
+			}
+		}
+
+		if (outside)
+		{
+			bvh_write_subtree(bvh, node, 0, 0, visible_flags, plane_masks);
+			continue;
+		}
+
+		// Completely inside the frustum, so no need to test the children.
+		if (0 == mask)
+		{
+			bvh_write_subtree(bvh, node, 1, 0, visible_flags, plane_masks);
+			continue;
+		}
+
+		const int left = bvh->nodes_left_children[node];
+		if (-1 != left && stack_count + 2 <= 64)
+		{
+			stack_nodes[stack_count] = left;
+			stack_masks[stack_count++] = mask;
+			stack_nodes[stack_count] = left + 1;
+			stack_masks[stack_count++] = mask;
+			continue;
+		}
+
+		// Test the instances' spheres against the remaining planes. This is also
+		// done if the stack is full, which is fine as the node's instances are
+		// still all covered.
+		const int first = bvh->nodes_first[node];
+		const int end = first + bvh->nodes_counts[node];
+
+		for (int i = first; i < end; ++i)
+		{
+			const int instance = bvh->instances[i];
+			const float* sphere = bvh->spheres + instance * STRIDE_SPHERE;
+			const V3 sphere_centre = { sphere[0], sphere[1], sphere[2] };
+
+			int instance_mask = 0;
+			int visible = 1;
+
+			for (int j = 0; j < planes_count; ++j)
+			{
+				if (!(mask & (1 << j)))
+				{
+					continue;
+				}
+
+				const float dist = signed_distance(&planes[j], sphere_centre);
+				if (dist < -sphere[3])
+				{
+					visible = 0;
+					break;
+				}
+				else if (dist < sphere[3])
+				{
+					instance_mask |= 1 << j;
+				}
+			}
+
+			visible_flags[instance] = visible;
+			plane_masks[instance] = visible ? instance_mask : 0;
+		}
+	}
+}
+
+void instance_bvh_destroy(InstanceBVH* bvh)
+{
+	free(bvh->nodes_bounds);
+	free(bvh->nodes_left_children);
+	free(bvh->nodes_parents);
+	free(bvh->nodes_first);
+	free(bvh->nodes_counts);
+	free(bvh->instances);
+	free(bvh->instances_leaves);
+	free(bvh->spheres);
+
+	memset(bvh, 0, sizeof(InstanceBVH));
+}
@@ -0,0 +1,59 @@
+#ifndef INSTANCE_BVH_H
+#define INSTANCE_BVH_H
+
+#include "renderer/frustum_culling.h"
+
+#include "common/status.h"
+
+/*
+
+Bounding volume hierarchy over the model instances' world space bounding spheres.
+
+Each node stores an AABB around the instances below it. The instances are ordered
+so that the instances under any node are a contiguous range, which means a
+subtree that is completely outside or inside the frustum can be written out
+without visiting its children.
+
+The tree is built top down by splitting the nodes at the midpoint of the longest
+axis of the instance centres. When an instance moves, only its leaf and the
+leaf's ancestors are refit. The tree is only rebuilt when instances are added,
+so lots of movement can make the tree looser, but never incorrect.
+
+*/
+
+#define BVH_MAX_LEAF_INSTANCES 4
+
+typedef struct
+{
+	int instances_count;
+	int nodes_count;
+	int dirty;					// Set when the tree needs rebuilding before it can be used.
+
+	// Nodes, the root is node 0. The children of a node are always next to
+	// each other, so only the left child is stored.
+	float* nodes_bounds;		// { min x, min y, min z, max x, max y, max z } for each node.
+	int* nodes_left_children;	// -1 if the node is a leaf.
+	int* nodes_parents;			// -1 for the root.
+	int* nodes_first;			// The node's first instance in the instances buffer.
+	int* nodes_counts;			// The number of instances under the node.
+
+	int* instances;				// The instance indices, ordered so each node's instances are contiguous.
+	int* instances_leaves;		// The leaf node of each instance.
+	float* spheres;				// The bounding sphere of each instance { x, y, z, radius }.
+
+} InstanceBVH;
+
+// Builds the tree from the instances bounding spheres.
+Status instance_bvh_build(InstanceBVH* bvh, const float* spheres, int instances_count);
+
+// Updates the instance's bounding sphere and refits the nodes above it.
+void instance_bvh_refit(InstanceBVH* bvh, int instance_index, const float* sphere);
+
+// Writes out for each instance whether it may be visible, and a mask of the
+// frustum planes that its bounding sphere intersects. Planes that are not in the
+// mask have the whole sphere inside them.
+void instance_bvh_cull(const InstanceBVH* bvh, const ViewFrustum* frustum, int* visible_flags, int* plane_masks);
+
+void instance_bvh_destroy(InstanceBVH* bvh);
+
+#endif
@@ -23,10 +23,23 @@ void point_lights_create(PointLights* point_lights, RenderBuffers* rbs, V3 posit
 	// TODO: I Would like to use STRIDE_POSITION without importing models.h.
 	resize_float_buffer(&point_lights->world_space_positions, new_count * STRIDE_POSITION);
 	resize_float_buffer(&point_lights->view_space_positions, new_count * STRIDE_POSITION);
+	resize_float_buffer(&point_lights->static_depth_maps_positions, new_count * STRIDE_POSITION);
+	resize_int_buffer(&point_lights->static_depth_maps_versions, new_count);
+	resize_int_buffer(&point_lights->depth_maps_frames, new_count);
+	resize_float_buffer(&point_lights->depth_maps_positions, new_count * STRIDE_POSITION);
+	resize_int_buffer(&point_lights->depth_maps_dirty_flags, new_count);
+	resize_float_buffer(&point_lights->depth_maps_caster_motion, new_count);
+	resize_int_buffer(&point_lights->light_space_positions_versions, new_count);
+	resize_int_buffer(&point_lights->depth_maps_schedule, new_count);
+	resize_float_buffer(&point_lights->depth_maps_priorities, new_count);
 
 	// Copy the lights position.
 	v3_write(point_lights->world_space_positions + point_lights->count * STRIDE_POSITION, position);
 
+	// The light space positions are written relative to this until the map is
+	// first drawn.
+	v3_write(point_lights->depth_maps_positions + point_lights->count * STRIDE_POSITION, position);
+
 	// Resize the point lights buffer.
 	int old_size = point_lights->count * STRIDE_POINT_LIGHT_ATTRIBUTES;
 	resize_float_buffer(&point_lights->attributes, old_size + STRIDE_POINT_LIGHT_ATTRIBUTES);
@@ -37,18 +50,13 @@ void point_lights_create(PointLights* point_lights, RenderBuffers* rbs, V3 posit
 	point_lights->attributes[++old_size] = colour.z;
 	point_lights->attributes[++old_size] = strength;
 
-	// TODO: Create shadow maps.
-	//		 All temporary for now.
-	// TODO: No idea what size would be best.
-	const int RES = 256;
-
-	// TODO: Need cubemap for point light.
 	// TODO: Potentially a depth buffer the same aspect ratio as the window could
 	//		 give better results. Not sure just a thought.
 
 	point_lights->count = new_count;
 
-	// Create a new depth buffer for the new light.
+	// The light's cube map is given a region of the renderer's shadow atlas
+	// when it is first rendered, see shadow_atlas.h.
 	DepthBuffer* temp = realloc(point_lights->depth_maps, (size_t)point_lights->count * sizeof(DepthBuffer));
 	if (!temp)
 	{
@@ -58,9 +66,48 @@ void point_lights_create(PointLights* point_lights, RenderBuffers* rbs, V3 posit
 	}
 	point_lights->depth_maps = temp;
 
-	depth_buffer_init(&point_lights->depth_maps[point_lights->count - 1], RES, RES);
-	depth_buffer_fill(&point_lights->depth_maps[point_lights->count - 1], 1.f);
+	memset(&point_lights->depth_maps[point_lights->count - 1], 0, sizeof(DepthBuffer));
+	point_lights->depth_maps_frames[point_lights->count - 1] = -1;
+	point_lights->light_space_positions_versions[point_lights->count - 1] = -1;
+	point_lights->depth_maps_dirty_flags[point_lights->count - 1] = 0;
+	point_lights->depth_maps_caster_motion[point_lights->count - 1] = 0;
+
+	// The static depth map is given the rest of the light's region of the 
+	// shadow atlas when the static shadows are cached.
+	temp = realloc(point_lights->static_depth_maps, (size_t)point_lights->count * sizeof(DepthBuffer));
+	if (!temp)
+	{
+		log_error("Failed to realloc for point_lights->static_depth_maps.");
+		return;
+	}
+	point_lights->static_depth_maps = temp;
+
+	memset(&point_lights->static_depth_maps[point_lights->count - 1], 0, sizeof(DepthBuffer));
+	point_lights->static_depth_maps_versions[point_lights->count - 1] = -1;
 
 	// Update the rbs lights count so we know to update the buffers.
 	rbs->lights_count = point_lights->count;
 }
+
+void point_lights_destroy(PointLights* point_lights)
+{
+	free(point_lights->world_space_positions);
+	free(point_lights->attributes);
+	free(point_lights->view_space_positions);
+
+	free(point_lights->depth_maps);
+
+	free(point_lights->static_depth_maps);
+	free(point_lights->static_depth_maps_positions);
+	free(point_lights->static_depth_maps_versions);
+
+	free(point_lights->depth_maps_frames);
+	free(point_lights->depth_maps_positions);
+	free(point_lights->light_space_positions_versions);
+	free(point_lights->depth_maps_dirty_flags);
+	free(point_lights->depth_maps_caster_motion);
+	free(point_lights->depth_maps_schedule);
+	free(point_lights->depth_maps_priorities);
+
+	memset(point_lights, 0, sizeof(PointLights));
+}
@@ -3,6 +3,7 @@
 
 #include "renderer/render_buffers.h"
 #include "renderer/depth_buffer.h"
+#include "renderer/cube_map.h"
 
 #include "maths/vector3.h"
 
@@ -19,6 +20,15 @@ a red colour.
 */
 
 // TODO: Not all point lights should cast shadows.
+
+// The range of the shadow cube maps' projection.
+#define POINT_LIGHT_SHADOW_NEAR_PLANE 1.f
+#define POINT_LIGHT_SHADOW_FAR_PLANE 100.f // TODO: Defined from strength of point light? with attenuation taken into account?
+
+// Projecting a point at a distance along a face's direction gives an NDC depth
+// of SCALE + OFFSET / distance, the same as m4_projection with these planes.
+#define POINT_LIGHT_SHADOW_DEPTH_SCALE ((POINT_LIGHT_SHADOW_FAR_PLANE + POINT_LIGHT_SHADOW_NEAR_PLANE) / (POINT_LIGHT_SHADOW_FAR_PLANE - POINT_LIGHT_SHADOW_NEAR_PLANE))
+#define POINT_LIGHT_SHADOW_DEPTH_OFFSET (-2.f * POINT_LIGHT_SHADOW_FAR_PLANE * POINT_LIGHT_SHADOW_NEAR_PLANE / (POINT_LIGHT_SHADOW_FAR_PLANE - POINT_LIGHT_SHADOW_NEAR_PLANE))
  
 typedef struct
 {
@@ -35,7 +45,37 @@ typedef struct
 	// Cache the point light's view space position.
 	float* view_space_positions; 
 
-	DepthBuffer* depth_maps;
+	DepthBuffer* depth_maps; // A cube map per light, see cube_map.h. They point into the renderer's shadow atlas.
+
+	// The depth maps of just the static instances, these are reused each frame
+	// until the light moves or a static instance changes. They follow the cube
+	// maps in the lights' regions of the shadow atlas. The light's position and
+	// the models' static version are saved when the map is drawn, a version of
+	// -1 means the map hasn't been drawn yet.
+	DepthBuffer* static_depth_maps;
+	float* static_depth_maps_positions;
+	int* static_depth_maps_versions;
+
+	// What the depth maps were drawn with, so when only a few can be redrawn
+	// each frame the most out of date ones go first. The frame is -1 if the
+	// map hasn't been drawn yet.
+	int* depth_maps_frames;
+	float* depth_maps_positions;
+
+	// The models' static version when all of the light's light space positions
+	// were last written, -1 if they haven't been. The non-static instances'
+	// positions are written every frame, even if the light's map isn't redrawn.
+	int* light_space_positions_versions;
+
+	// Whether an instance in range of the light has moved since its map was 
+	// drawn, and how far all those instances have moved in total.
+	int* depth_maps_dirty_flags;
+	float* depth_maps_caster_motion;
+
+	// The lights whose depth maps are redrawn this frame, most important first,
+	// followed by the lights that only have their light space positions written.
+	int* depth_maps_schedule;
+	float* depth_maps_priorities;
 
 } PointLights;
 
@@ -44,7 +84,9 @@ void point_lights_init(PointLights* point_lights);
 
 void point_lights_create(PointLights* point_lights, RenderBuffers* rbs, V3 position, V3 colour, float strength);
 
-// TODO: Destroy.
+// Frees the lights' buffers and static depth maps. The depth maps' data is
+// owned by the renderer's shadow atlas, so only the array is freed.
+void point_lights_destroy(PointLights* point_lights);
 
 
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "matrix4.h"
 
 #include "utils.h"
+#include "simd.h"
 
 void m4_mul_m4(const M4 m0, const M4 m1, M4 out)
 {
@@ -42,6 +43,43 @@ void m4_mul_v4(const M4 m, V4 v, V4* out)
 	out->w = m[3] * v.x + m[7] * v.y + m[11] * v.z + m[15] * v.w;
 }
 
+void m4_mul_positions(const M4 m, const float* positions, int count, float* out)
+{
+	int i = 0;
+
+#ifdef SIMD_LANES
+	// Each lane transforms its own position, so the matrix is broadcast.
+	const SimdF m0 = simd_set1(m[0]), m1 = simd_set1(m[1]), m2 = simd_set1(m[2]);
+	const SimdF m4 = simd_set1(m[4]), m5 = simd_set1(m[5]), m6 = simd_set1(m[6]);
+	const SimdF m8 = simd_set1(m[8]), m9 = simd_set1(m[9]), m10 = simd_set1(m[10]);
+	const SimdF m12 = simd_set1(m[12]), m13 = simd_set1(m[13]), m14 = simd_set1(m[14]);
+
+	for (; i + SIMD_LANES <= count; i += SIMD_LANES)
+	{
+		SimdF x, y, z;
+		simd_load_xyz(positions + i * 3, &x, &y, &z);
+
+		const SimdF out_x = simd_mul_add(m8, z, simd_mul_add(m4, y, simd_mul_add(m0, x, m12)));
+		const SimdF out_y = simd_mul_add(m9, z, simd_mul_add(m5, y, simd_mul_add(m1, x, m13)));
+		const SimdF out_z = simd_mul_add(m10, z, simd_mul_add(m6, y, simd_mul_add(m2, x, m14)));
+
+		simd_store_xyz(out + i * 3, out_x, out_y, out_z);
+	}
+#endif
+
+	// Scalar for the remainder.
+	for (; i < count; ++i)
+	{
+		const float x = positions[i * 3];
+		const float y = positions[i * 3 + 1];
+		const float z = positions[i * 3 + 2];
+
+		out[i * 3] = m[0] * x + m[4] * y + m[8] * z + m[12];
+		out[i * 3 + 1] = m[1] * x + m[5] * y + m[9] * z + m[13];
+		out[i * 3 + 2] = m[2] * x + m[6] * y + m[10] * z + m[14];
+	}
+}
+
 void m4_identity(M4 out)
 {
 	out[0] = 1;
@@ -32,6 +32,11 @@ void m4_mul_m4(const M4 m0, const M4 m1, M4 out);
 
 void m4_mul_v4(const M4 m, V4 v, V4* out);
 
+// Transforms count interleaved { x, y, z } positions with w = 1, writing the 
+// transformed { x, y, z }. The matrix must be affine as w isn't written. Uses
+// SIMD_LANES positions at a time when SIMD is available, out can be positions.
+void m4_mul_positions(const M4 m, const float* positions, int count, float* out);
+
 void m4_identity(M4 out);
 
 void m4_translation(V3 position, M4 out);
@@ -0,0 +1,205 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/*
+
+Thin wrappers around the SSE2 and AVX2 intrinsics so the same code can be
+written for either width. AVX2 is used when the compiler targets it (/arch:AVX2),
+otherwise SSE2, which every x64 cpu has.
+
+SIMD_LANES is only defined if one of them is available.
+
+Masks are the results of comparisons, so each lane is either all 1s or all 0s.
+
+*/
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define SIMD_LANES 8
+
+typedef __m256 SimdF;
+typedef __m256i SimdI;
+
+inline SimdF simd_set1(float a) { return _mm256_set1_ps(a); }
+inline SimdF simd_zero(void) { return _mm256_setzero_ps(); }
+inline SimdF simd_lane_indices(void) { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+
+inline SimdF simd_load(const float* p) { return _mm256_loadu_ps(p); }
+inline void simd_store(float* p, SimdF a) { _mm256_storeu_ps(p, a); }
+inline SimdI simd_load_int(const void* p) { return _mm256_loadu_si256((const __m256i*)p); }
+inline void simd_store_int(void* p, SimdI a) { _mm256_storeu_si256((__m256i*)p, a); }
+
+inline SimdF simd_add(SimdF a, SimdF b) { return _mm256_add_ps(a, b); }
+inline SimdF simd_sub(SimdF a, SimdF b) { return _mm256_sub_ps(a, b); }
+inline SimdF simd_mul(SimdF a, SimdF b) { return _mm256_mul_ps(a, b); }
+
+// Returns a * b + c, fused when FMA is available. Every AVX2 cpu has FMA, but
+// gcc and clang only allow the intrinsic if it is enabled separately (-mfma).
+#if defined(__FMA__) || defined(_MSC_VER)
+inline SimdF simd_mul_add(SimdF a, SimdF b, SimdF c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+inline SimdF simd_mul_add(SimdF a, SimdF b, SimdF c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+
+inline SimdF simd_less(SimdF a, SimdF b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline SimdF simd_greater(SimdF a, SimdF b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+
+inline SimdF simd_and(SimdF a, SimdF b) { return _mm256_and_ps(a, b); }
+inline SimdF simd_and_not(SimdF a, SimdF b) { return _mm256_andnot_ps(b, a); } // a & ~b
+inline SimdF simd_or(SimdF a, SimdF b) { return _mm256_or_ps(a, b); }
+inline SimdF simd_abs(SimdF a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+inline int simd_mask_bits(SimdF mask) { return _mm256_movemask_ps(mask); }
+
+// Returns b where the mask is set, otherwise a.
+inline SimdF simd_select(SimdF a, SimdF b, SimdF mask) { return _mm256_blendv_ps(a, b, mask); }
+inline SimdI simd_select_int(SimdI a, SimdI b, SimdF mask) { return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), mask)); }
+
+// Truncates towards zero like a (int) cast.
+inline SimdI simd_to_int(SimdF a) { return _mm256_cvttps_epi32(a); }
+inline SimdI simd_set1_int(int a) { return _mm256_set1_epi32(a); }
+inline SimdI simd_or_int(SimdI a, SimdI b) { return _mm256_or_si256(a, b); }
+inline SimdI simd_shift_left_int(SimdI a, int bits) { return _mm256_slli_epi32(a, bits); }
+inline SimdF simd_greater_int(SimdI a, SimdI b) { return _mm256_castsi256_ps(_mm256_cmpgt_epi32(a, b)); }
+
+inline SimdF simd_rcp_estimate(SimdF a) { return _mm256_rcp_ps(a); }
+
+// Reads data[rows * width + cols] for the lanes where the mask is set, the
+// other lanes are 0.
+inline SimdF simd_gather_2d(const float* data, int width, SimdI cols, SimdI rows, SimdF mask)
+{
+	const SimdI indices = _mm256_add_epi32(_mm256_mullo_epi32(rows, _mm256_set1_epi32(width)), cols);
+	return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), data, indices, mask, 4);
+}
+
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+
+#define SIMD_LANES 4
+
+typedef __m128 SimdF;
+typedef __m128i SimdI;
+
+inline SimdF simd_set1(float a) { return _mm_set1_ps(a); }
+inline SimdF simd_zero(void) { return _mm_setzero_ps(); }
+inline SimdF simd_lane_indices(void) { return _mm_setr_ps(0, 1, 2, 3); }
+
+inline SimdF simd_load(const float* p) { return _mm_loadu_ps(p); }
+inline void simd_store(float* p, SimdF a) { _mm_storeu_ps(p, a); }
+inline SimdI simd_load_int(const void* p) { return _mm_loadu_si128((const __m128i*)p); }
+inline void simd_store_int(void* p, SimdI a) { _mm_storeu_si128((__m128i*)p, a); }
+
+inline SimdF simd_add(SimdF a, SimdF b) { return _mm_add_ps(a, b); }
+inline SimdF simd_sub(SimdF a, SimdF b) { return _mm_sub_ps(a, b); }
+inline SimdF simd_mul(SimdF a, SimdF b) { return _mm_mul_ps(a, b); }
+inline SimdF simd_mul_add(SimdF a, SimdF b, SimdF c) { return _mm_add_ps(_mm_mul_ps(a, b), c); } // a * b + c
+
+inline SimdF simd_less(SimdF a, SimdF b) { return _mm_cmplt_ps(a, b); }
+inline SimdF simd_greater(SimdF a, SimdF b) { return _mm_cmpgt_ps(a, b); }
+
+inline SimdF simd_and(SimdF a, SimdF b) { return _mm_and_ps(a, b); }
+inline SimdF simd_and_not(SimdF a, SimdF b) { return _mm_andnot_ps(b, a); } // a & ~b
+inline SimdF simd_or(SimdF a, SimdF b) { return _mm_or_ps(a, b); }
+inline SimdF simd_abs(SimdF a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+inline int simd_mask_bits(SimdF mask) { return _mm_movemask_ps(mask); }
+
+// Returns b where the mask is set, otherwise a. SSE2 has no blend instruction.
+inline SimdF simd_select(SimdF a, SimdF b, SimdF mask) { return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a)); }
+inline SimdI simd_select_int(SimdI a, SimdI b, SimdF mask) { return _mm_castps_si128(simd_select(_mm_castsi128_ps(a), _mm_castsi128_ps(b), mask)); }
+
+// Truncates towards zero like a (int) cast.
+inline SimdI simd_to_int(SimdF a) { return _mm_cvttps_epi32(a); }
+inline SimdI simd_set1_int(int a) { return _mm_set1_epi32(a); }
+inline SimdI simd_or_int(SimdI a, SimdI b) { return _mm_or_si128(a, b); }
+inline SimdI simd_shift_left_int(SimdI a, int bits) { return _mm_slli_epi32(a, bits); }
+inline SimdF simd_greater_int(SimdI a, SimdI b) { return _mm_castsi128_ps(_mm_cmpgt_epi32(a, b)); }
+
+inline SimdF simd_rcp_estimate(SimdF a) { return _mm_rcp_ps(a); }
+
+// Reads data[rows * width + cols] for the lanes where the mask is set, the
+// other lanes are 0. SSE2 has no gather or 32 bit multiply, so do it per lane.
+inline SimdF simd_gather_2d(const float* data, int width, SimdI cols, SimdI rows, SimdF mask)
+{
+	int c[4], r[4];
+	float out[4];
+
+	_mm_storeu_si128((__m128i*)c, cols);
+	_mm_storeu_si128((__m128i*)r, rows);
+
+	const int bits = _mm_movemask_ps(mask);
+	for (int i = 0; i < 4; ++i)
+	{
+		out[i] = (bits & (1 << i)) ? data[r[i] * width + c[i]] : 0.f;
+	}
+
+	return _mm_loadu_ps(out);
+}
+
+#endif
+
+#ifdef SIMD_LANES
+
+// Reciprocal estimate refined with one Newton-Raphson step, much cheaper than
+// a divide and accurate to about 22 bits.
+inline SimdF simd_rcp(SimdF a)
+{
+	const SimdF r = simd_rcp_estimate(a);
+	return simd_mul(r, simd_sub(simd_set1(2.f), simd_mul(a, r)));
+}
+
+// Splits 4 interleaved { x, y, z } into a register per component. Both widths
+// are built from this, the AVX2 version does each half separately.
+inline void simd_load_xyz_4(const float* p, __m128* x, __m128* y, __m128* z)
+{
+	const __m128 a = _mm_loadu_ps(p);		// x0 y0 z0 x1
+	const __m128 b = _mm_loadu_ps(p + 4);	// y1 z1 x2 y2
+	const __m128 c = _mm_loadu_ps(p + 8);	// z2 x3 y3 z3
+
+	*x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(0, 1, 0, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+	*y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+	*z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+// The inverse of simd_load_xyz_4.
+inline void simd_store_xyz_4(float* p, __m128 x, __m128 y, __m128 z)
+{
+	const __m128 xy01 = _mm_unpacklo_ps(x, y);	// x0 y0 x1 y1
+	const __m128 xy23 = _mm_unpackhi_ps(x, y);	// x2 y2 x3 y3
+
+	_mm_storeu_ps(p, _mm_shuffle_ps(xy01, _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 1, 0)));
+	_mm_storeu_ps(p + 4, _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)), xy23, _MM_SHUFFLE(1, 0, 2, 0)));
+	_mm_storeu_ps(p + 8, _mm_shuffle_ps(_mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)), _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+// Loads SIMD_LANES interleaved { x, y, z } as a register per component.
+inline void simd_load_xyz(const float* p, SimdF* x, SimdF* y, SimdF* z)
+{
+#if SIMD_LANES == 8
+	__m128 x0, y0, z0, x1, y1, z1;
+	simd_load_xyz_4(p, &x0, &y0, &z0);
+	simd_load_xyz_4(p + 12, &x1, &y1, &z1);
+
+	*x = _mm256_set_m128(x1, x0);
+	*y = _mm256_set_m128(y1, y0);
+	*z = _mm256_set_m128(z1, z0);
+#else
+	simd_load_xyz_4(p, x, y, z);
+#endif
+}
+
+// Stores a register per component as SIMD_LANES interleaved { x, y, z }.
+inline void simd_store_xyz(float* p, SimdF x, SimdF y, SimdF z)
+{
+#if SIMD_LANES == 8
+	simd_store_xyz_4(p, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z));
+	simd_store_xyz_4(p + 12, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1));
+#else
+	simd_store_xyz_4(p, x, y, z);
+#endif
+}
+
+#endif
+
+#endif
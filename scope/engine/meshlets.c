@@ -0,0 +1,193 @@
+#include "meshlets.h"
+
+#include "strides.h"
+
+#include "maths/vector3.h"
+
+#include "utils/logger.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+// Interleaves the bottom 10 bits of x with two zero bits between each bit.
+static unsigned int morton_spread(unsigned int x)
+{
+	x &= 0x3ff;
+	x = (x | (x << 16)) & 0x030000ff;
+	x = (x | (x << 8)) & 0x0300f00f;
+	x = (x | (x << 4)) & 0x030c30c3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+static int compare_morton_keys(const void* a, const void* b)
+{
+	// Each key is { code, face }, sorting by face second keeps the order stable.
+	const unsigned int* ka = a;
+	const unsigned int* kb = b;
+
+	if (ka[0] != kb[0])
+	{
+		return ka[0] < kb[0] ? -1 : 1;
+	}
+	return (ka[1] > kb[1]) - (ka[1] < kb[1]);
+}
+
+Status meshlets_build(const float* positions, const int* face_position_indices, int faces_count, int* face_order, float* spheres, float* cones)
+{
+	// A model without faces has no meshlets, and malloc(0) can return NULL.
+	if (faces_count <= 0)
+	{
+		return STATUS_OK;
+	}
+
+	unsigned int* keys = malloc(sizeof(unsigned int) * 2 * faces_count);
+	if (!keys)
+	{
+		log_error("Failed to allocate the buffer for ordering the meshlet faces.");
+		return STATUS_ALLOC_FAILURE;
+	}
+
+	// Find the bounds of the face centres so the morton codes use the full range.
+	V3 min_centre = { INFINITY, INFINITY, INFINITY };
+	V3 max_centre = { -INFINITY, -INFINITY, -INFINITY };
+
+	for (int i = 0; i < faces_count; ++i)
+	{
+		const int* indices = face_position_indices + i * STRIDE_FACE_VERTICES;
+
+		V3 centre = v3_read(positions + indices[0] * STRIDE_POSITION);
+		v3_add_eq_v3(&centre, v3_read(positions + indices[1] * STRIDE_POSITION));
+		v3_add_eq_v3(&centre, v3_read(positions + indices[2] * STRIDE_POSITION));
+
+		min_centre.x = fminf(min_centre.x, centre.x);
+		min_centre.y = fminf(min_centre.y, centre.y);
+		min_centre.z = fminf(min_centre.z, centre.z);
+		max_centre.x = fmaxf(max_centre.x, centre.x);
+		max_centre.y = fmaxf(max_centre.y, centre.y);
+		max_centre.z = fmaxf(max_centre.z, centre.z);
+	}
+
+	const V3 extent = v3_sub_v3(max_centre, min_centre);
+	const float largest_extent = fmaxf(extent.x, fmaxf(extent.y, extent.z));
+	const float to_grid = largest_extent > 0 ? 1023.f / largest_extent : 0;
+
+	for (int i = 0; i < faces_count; ++i)
+	{
+		const int* indices = face_position_indices + i * STRIDE_FACE_VERTICES;
+
+		V3 centre = v3_read(positions + indices[0] * STRIDE_POSITION);
+		v3_add_eq_v3(&centre, v3_read(positions + indices[1] * STRIDE_POSITION));
+		v3_add_eq_v3(&centre, v3_read(positions + indices[2] * STRIDE_POSITION));
+
+		const V3 grid = v3_mul_f(v3_sub_v3(centre, min_centre), to_grid);
+
+		keys[i * 2] = morton_spread((unsigned int)grid.x) |
+			(morton_spread((unsigned int)grid.y) << 1) |
+			(morton_spread((unsigned int)grid.z) << 2);
+		keys[i * 2 + 1] = (unsigned int)i;
+	}
+
+	qsort(keys, faces_count, sizeof(unsigned int) * 2, compare_morton_keys);
+
+	for (int i = 0; i < faces_count; ++i)
+	{
+		face_order[i] = (int)keys[i * 2 + 1];
+	}
+
+	free(keys);
+
+	// Calculate the bounds of each meshlet.
+	const int count = meshlets_count(faces_count);
+
+	for (int m = 0; m < count; ++m)
+	{
+		const int first = m * MESHLET_MAX_FACES;
+		const int end = min(first + MESHLET_MAX_FACES, faces_count);
+
+		// The sphere is centred on the AABB of the meshlet's vertices.
+		V3 min_position = { INFINITY, INFINITY, INFINITY };
+		V3 max_position = { -INFINITY, -INFINITY, -INFINITY };
+
+		for (int i = first; i < end; ++i)
+		{
+			const int* indices = face_position_indices + face_order[i] * STRIDE_FACE_VERTICES;
+
+			for (int j = 0; j < STRIDE_FACE_VERTICES; ++j)
+			{
+				const V3 position = v3_read(positions + indices[j] * STRIDE_POSITION);
+
+				min_position.x = fminf(min_position.x, position.x);
+				min_position.y = fminf(min_position.y, position.y);
+				min_position.z = fminf(min_position.z, position.z);
+				max_position.x = fmaxf(max_position.x, position.x);
+				max_position.y = fmaxf(max_position.y, position.y);
+				max_position.z = fmaxf(max_position.z, position.z);
+			}
+		}
+
+		const V3 centre = v3_mul_f(v3_add_v3(min_position, max_position), 0.5f);
+
+		float radius_squared = 0;
+		V3 axis = { 0, 0, 0 };
+
+		for (int i = first; i < end; ++i)
+		{
+			const int* indices = face_position_indices + face_order[i] * STRIDE_FACE_VERTICES;
+
+			const V3 v0 = v3_read(positions + indices[0] * STRIDE_POSITION);
+			const V3 v1 = v3_read(positions + indices[1] * STRIDE_POSITION);
+			const V3 v2 = v3_read(positions + indices[2] * STRIDE_POSITION);
+
+			radius_squared = max(radius_squared, size_squared(v3_sub_v3(v0, centre)));
+			radius_squared = max(radius_squared, size_squared(v3_sub_v3(v1, centre)));
+			radius_squared = max(radius_squared, size_squared(v3_sub_v3(v2, centre)));
+
+			// Same winding as is_front_face.
+			const V3 normal = cross(v3_sub_v3(v1, v0), v3_sub_v3(v2, v0));
+			const float length = size(normal);
+			if (length > 0)
+			{
+				v3_add_eq_v3(&axis, v3_mul_f(normal, 1.f / length));
+			}
+		}
+
+		float* sphere = spheres + m * STRIDE_SPHERE;
+		v3_write(sphere, centre);
+		sphere[3] = sqrtf(radius_squared);
+
+		// The cone can only cull the meshlet if all the normals are within 90 
+		// degrees of the axis. Some slack is left so a cone that is almost a 
+		// half space isn't tested for no gain.
+		float* cone = cones + m * STRIDE_CONE;
+		float min_dot = -1;
+
+		const float axis_length = size(axis);
+		if (axis_length > 0)
+		{
+			v3_mul_eq_f(&axis, 1.f / axis_length);
+			min_dot = 1;
+
+			for (int i = first; i < end; ++i)
+			{
+				const int* indices = face_position_indices + face_order[i] * STRIDE_FACE_VERTICES;
+
+				const V3 v0 = v3_read(positions + indices[0] * STRIDE_POSITION);
+				const V3 v1 = v3_read(positions + indices[1] * STRIDE_POSITION);
+				const V3 v2 = v3_read(positions + indices[2] * STRIDE_POSITION);
+
+				const V3 normal = cross(v3_sub_v3(v1, v0), v3_sub_v3(v2, v0));
+				const float length = size(normal);
+				if (length > 0)
+				{
+					min_dot = fminf(min_dot, dot(normal, axis) / length);
+				}
+			}
+		}
+
+		v3_write(cone, axis);
+		cone[3] = min_dot <= 0.1f ? 1.f : sqrtf(1.f - min_dot * min_dot);
+	}
+
+	return STATUS_OK;
+}
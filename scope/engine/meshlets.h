@@ -0,0 +1,47 @@
+#ifndef MESHLETS_H
+#define MESHLETS_H
+
+#include "common/status.h"
+
+#include "maths/vector3.h"
+
+/*
+
+Meshlets split a model base's faces into small clusters so whole groups of faces 
+can be culled at once.
+
+The faces are ordered along a morton curve through their centres, so faces that 
+are close together end up next to each other, then each run of 
+MESHLET_MAX_FACES faces in that order is a meshlet. Each meshlet has a bounding
+sphere for frustum culling, and a cone around its face normals for backface 
+culling. The cone is the same as meshoptimizer's, the cutoff is the sine of the
+widest angle between the axis and a face normal, if the normals are too spread
+out for the cone to ever cull the meshlet, the cutoff is 1.
+
+*/
+
+#define MESHLET_MAX_FACES 64
+
+inline int meshlets_count(int faces_count)
+{
+	return (faces_count + MESHLET_MAX_FACES - 1) / MESHLET_MAX_FACES;
+}
+
+// Writes out the order of the faces, where meshlet i is faces 
+// [i * MESHLET_MAX_FACES, (i + 1) * MESHLET_MAX_FACES) in the order, as well as
+// the bounding sphere { x, y, z, radius } and cone { axis x, y, z, cutoff } of 
+// each meshlet. The positions and face indices are for a single model base.
+Status meshlets_build(const float* positions, const int* face_position_indices, int faces_count, int* face_order, float* spheres, float* cones);
+
+// Returns 1 if every face of the meshlet faces away from the camera. The 
+// camera position must be in the same space as the meshlet, the winding is -1
+// if the instance is mirrored.
+inline int meshlet_cone_culled(const float* sphere, const float* cone, V3 camera_position, float winding)
+{
+	const V3 to_centre = v3_sub_v3(v3_read(sphere), camera_position);
+	const V3 axis = v3_mul_f(v3_read(cone), winding);
+
+	return dot(to_centre, axis) >= cone[3] * size(to_centre) + sphere[3];
+}
+
+#endif
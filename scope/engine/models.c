@@ -3,11 +3,13 @@
 #endif
 
 #include "models.h"
+#include "meshlets.h"
 
 #include "renderer/render_buffers.h"
 
 #include "maths/vector3.h"
 #include "maths/matrix4.h"
+#include "maths/vector_maths.h"
 
 #include "common/status.h"
 
@@ -124,6 +126,7 @@ Status load_model_base_from_obj(Models* models, RenderBuffers* rbs, const char*
 	resize_float_buffer(&models->mbs_object_space_normals, new_total_normals * STRIDE_NORMAL);
 	resize_float_buffer(&models->mbs_uvs, new_total_uvs * STRIDE_UV);
 	resize_float_buffer(&models->mbs_object_space_centres, new_mbs_count * STRIDE_POSITION);
+	resize_float_buffer(&models->mbs_object_space_radii, new_mbs_count);
 
 	// Recreate the in/out buffers for clipping if this model base has the most
 	// faces yet.
@@ -265,6 +268,127 @@ Status load_model_base_from_obj(Models* models, RenderBuffers* rbs, const char*
 		}
 	}
 
+	// Find the unique (position, normal) pairs used by the faces. The pairs for
+	// each position are kept in a linked list as there are usually only a few.
+	const int first_face_vertex = models->mbs_total_faces * STRIDE_FACE_VERTICES;
+	const int face_vertices_count = face_count * STRIDE_FACE_VERTICES;
+
+	resize_int_buffer(&models->mbs_face_vertex_ids, new_total_vertices);
+	resize_int_buffer(&models->mbs_vertices_counts, new_mbs_count);
+
+	int* position_first_vertex = malloc(sizeof(int) * positions_count);
+	int* vertex_next = malloc(sizeof(int) * face_vertices_count);
+	int* vertex_normals = malloc(sizeof(int) * face_vertices_count);
+
+	if (!position_first_vertex || !vertex_next || !vertex_normals)
+	{
+		log_error("Failed to allocate the buffers for finding the unique vertices.");
+		
+		free(position_first_vertex);
+		free(vertex_next);
+		free(vertex_normals);
+		fclose(file);
+
+		return STATUS_ALLOC_FAILURE;
+	}
+
+	memset(position_first_vertex, -1, sizeof(int) * positions_count);
+
+	int vertices_count = 0;
+
+	for (int i = first_face_vertex; i < first_face_vertex + face_vertices_count; ++i)
+	{
+		const int position_index = models->mbs_face_position_indices[i];
+		const int normal_index = models->mbs_face_normal_indices[i];
+
+		int vertex_id = position_first_vertex[position_index];
+		while (-1 != vertex_id && vertex_normals[vertex_id] != normal_index)
+		{
+			vertex_id = vertex_next[vertex_id];
+		}
+
+		// First time the pair is used, so add it.
+		if (-1 == vertex_id)
+		{
+			vertex_id = vertices_count++;
+			vertex_normals[vertex_id] = normal_index;
+			vertex_next[vertex_id] = position_first_vertex[position_index];
+			position_first_vertex[position_index] = vertex_id;
+		}
+
+		models->mbs_face_vertex_ids[i] = vertex_id;
+	}
+
+	models->mbs_vertices_counts[mb_index] = vertices_count;
+
+	free(position_first_vertex);
+	free(vertex_next);
+	free(vertex_normals);
+
+	// Resize the per instance vertex buffers if this model base has the most
+	// vertices yet.
+	if (models->max_mb_vertices < vertices_count || models->max_mb_positions < positions_count || models->max_mb_normals < normals_count)
+	{
+		models->max_mb_vertices = max(models->max_mb_vertices, vertices_count);
+		models->max_mb_positions = max(models->max_mb_positions, positions_count);
+		models->max_mb_normals = max(models->max_mb_normals, normals_count);
+
+		rbs->mbs_max_vertices = models->max_mb_vertices;
+		rbs->mbs_max_positions = models->max_mb_positions;
+		rbs->mbs_max_normals = models->max_mb_normals;
+		render_buffers_resize(rbs);
+	}
+
+	// Calculate the plane of each face, so faces can be culled without 
+	// transforming their vertices.
+	resize_float_buffer(&models->mbs_object_space_face_planes, new_total_faces * STRIDE_PLANE);
+
+	const int mb_positions_offset = models->mbs_positions_offsets[mb_index];
+
+	for (int i = models->mbs_total_faces; i < new_total_faces; ++i)
+	{
+		const int* position_indices = models->mbs_face_position_indices + i * STRIDE_FACE_VERTICES;
+
+		const V3 v0 = v3_read(models->mbs_object_space_positions + (position_indices[0] + mb_positions_offset) * STRIDE_POSITION);
+		const V3 v1 = v3_read(models->mbs_object_space_positions + (position_indices[1] + mb_positions_offset) * STRIDE_POSITION);
+		const V3 v2 = v3_read(models->mbs_object_space_positions + (position_indices[2] + mb_positions_offset) * STRIDE_POSITION);
+
+		// Same winding as is_front_face.
+		const V3 normal = cross(v3_sub_v3(v1, v0), v3_sub_v3(v2, v0));
+
+		float* plane = models->mbs_object_space_face_planes + i * STRIDE_PLANE;
+		v3_write(plane, normal);
+		plane[3] = -dot(normal, v0);
+	}
+
+	// Split the faces into meshlets so they can be culled in groups.
+	const int meshlets_offset = models->mbs_total_meshlets;
+	const int new_meshlets_count = meshlets_count(face_count);
+	const int new_total_meshlets = meshlets_offset + new_meshlets_count;
+
+	resize_int_buffer(&models->mbs_meshlets_offsets, new_mbs_count);
+	resize_int_buffer(&models->mbs_meshlets_counts, new_mbs_count);
+	resize_int_buffer(&models->mbs_meshlet_face_indices, new_total_faces);
+	resize_float_buffer(&models->mbs_meshlet_spheres, new_total_meshlets * STRIDE_SPHERE);
+	resize_float_buffer(&models->mbs_meshlet_cones, new_total_meshlets * STRIDE_CONE);
+
+	models->mbs_meshlets_offsets[mb_index] = meshlets_offset;
+	models->mbs_meshlets_counts[mb_index] = new_meshlets_count;
+
+	const Status meshlets_status = meshlets_build(
+		models->mbs_object_space_positions + mb_positions_offset * STRIDE_POSITION,
+		models->mbs_face_position_indices + models->mbs_total_faces * STRIDE_FACE_VERTICES,
+		face_count,
+		models->mbs_meshlet_face_indices + models->mbs_total_faces,
+		models->mbs_meshlet_spheres + meshlets_offset * STRIDE_SPHERE,
+		models->mbs_meshlet_cones + meshlets_offset * STRIDE_CONE);
+
+	if (STATUS_OK != meshlets_status)
+	{
+		fclose(file);
+		return meshlets_status;
+	}
+
 	// Calculate the centre of the model base by taking the average of all the vertices.
 	// After testing using indexed rendering for this, we got the wrong centre, works 
 	// correctly with just averaging all the vertices, no matter how many times they're
@@ -292,6 +416,17 @@ Status load_model_base_from_obj(Models* models, RenderBuffers* rbs, const char*
 	models->mbs_object_space_centres[++index_centre] = centre.y;
 	models->mbs_object_space_centres[++index_centre] = centre.z;
 
+	// Calculate the radius of the bounding sphere around the centre, so instances
+	// can be culled without transforming their vertices.
+	float radius_squared = 0;
+	for (int i = 0; i < positions_count; ++i)
+	{
+		V3 position = v3_read(models->mbs_object_space_positions + (offset + i) * STRIDE_POSITION);
+		radius_squared = max(size_squared(v3_sub_v3(position, centre)), radius_squared);
+	}
+
+	models->mbs_object_space_radii[models->mbs_count] = sqrtf(radius_squared);
+
 	// Close the file.
 	if (fclose(file) != 0)
 	{
@@ -305,6 +440,7 @@ Status load_model_base_from_obj(Models* models, RenderBuffers* rbs, const char*
 	models->mbs_total_positions = new_total_positions;
 	models->mbs_total_normals = new_total_normals;
 	models->mbs_total_uvs = new_total_uvs;
+	models->mbs_total_meshlets = new_total_meshlets;
 
 	return STATUS_OK;
 }
@@ -323,30 +459,58 @@ void create_model_instances(Models* models, RenderBuffers* rbs, int mb_index, in
 	resize_int_buffer(&models->mis_base_ids, new_instances_count);
 	resize_int_buffer(&models->mis_texture_ids, new_instances_count);
 	resize_int_buffer(&models->mis_dirty_bounding_sphere_flags, new_instances_count);
-	resize_int_buffer(&models->mis_intersected_planes, new_instances_count * 7); // 1 for how many planes, 6 for the potential plane indices. 
+	resize_int_buffer(&models->mis_positions_offsets, new_instances_count);
+	resize_int_buffer(&models->mis_normals_offsets, new_instances_count);
+	resize_int_buffer(&models->mis_faces_offsets, new_instances_count);
+	resize_int_buffer(&models->mis_intersected_planes, new_instances_count * STRIDE_INTERSECTED_PLANES);
 	resize_int_buffer(&models->mis_passed_broad_phase_flags, new_instances_count);
+	resize_int_buffer(&models->mis_occluder_flags, new_instances_count);
+	resize_int_buffer(&models->mis_static_flags, new_instances_count);
+	resize_int_buffer(&models->mis_unmoved_frames, new_instances_count);
+	resize_int_buffer(&models->mis_promoted_static_flags, new_instances_count);
+	resize_int_buffer(&models->mis_dirty_shadow_flags, new_instances_count);
+	resize_float_buffer(&models->mis_shadow_motion, new_instances_count);
 
 	for (int i = models->mis_count; i < new_instances_count; ++i)
 	{
 		models->mis_base_ids[i] = mb_index;
 
+		// The instances are appended, so their offsets follow on from the 
+		// current totals.
+		const int k = i - models->mis_count;
+		models->mis_positions_offsets[i] = models->mis_total_positions + k * models->mbs_positions_counts[mb_index];
+		models->mis_normals_offsets[i] = models->mis_total_normals + k * models->mbs_normals_counts[mb_index];
+		models->mis_faces_offsets[i] = models->mis_total_faces + k * models->mbs_faces_counts[mb_index];
+
 		// TODO: Textures. Should be a parameter?
 		models->mis_texture_ids[i] = -1; // Default to no texture.
 
 		models->mis_dirty_bounding_sphere_flags[i] = 1;
 		models->mis_passed_broad_phase_flags[i] = 0;
+		models->mis_occluder_flags[i] = 0;
+		models->mis_static_flags[i] = 0;
+		models->mis_unmoved_frames[i] = 0;
+		models->mis_promoted_static_flags[i] = 0;
+		models->mis_shadow_motion[i] = 0;
 
-		// TODO: define 7 as a stride.
-		for (int j = i * 7; j < (i + 1) * 7; ++j)
+		for (int j = i * STRIDE_INTERSECTED_PLANES; j < (i + 1) * STRIDE_INTERSECTED_PLANES; ++j)
 		{
 			models->mis_intersected_planes[j] = 0;
 		}
 	}
 
 	resize_float_buffer(&models->mis_transforms, new_instances_count * STRIDE_MI_TRANSFORM);
+	resize_float_buffer(&models->mis_model_matrices, new_instances_count * STRIDE_M4);
+	resize_float_buffer(&models->mis_normal_matrices, new_instances_count * STRIDE_M4);
+	resize_int_buffer(&models->mis_dirty_normal_matrix_flags, new_instances_count);
 	
 	// Make space for the bounding sphere, this will be generated by the next render call.
 	resize_float_buffer(&models->mis_bounding_spheres, new_instances_count * STRIDE_SPHERE);
+	resize_float_buffer(&models->mis_world_bounding_spheres, new_instances_count * STRIDE_SPHERE);
+	resize_int_buffer(&models->mis_frustum_plane_masks, new_instances_count);
+
+	// The bvh must be rebuilt to include the new instances.
+	models->bvh.dirty = 1;
 
 	// Increase the totals to get the new buffer sizes.
 	const int faces_count = models->mbs_faces_counts[mb_index] * n;
@@ -370,11 +534,29 @@ void create_model_instances(Models* models, RenderBuffers* rbs, int mb_index, in
 
 	// Resize buffers used for indexed rendering.
 	resize_float_buffer(&models->view_space_positions, models->mis_total_positions * STRIDE_POSITION);
-	resize_float_buffer(&models->view_space_normals, models->mis_total_normals * STRIDE_NORMAL);
+	resize_float_buffer(&models->mis_model_view_matrices, new_instances_count * STRIDE_M4);
+	resize_float_buffer(&models->mis_view_normal_matrices, new_instances_count * STRIDE_M4);
 
 	
+	// The light space positions buffer is resized and the instances' offsets
+	// into it may have moved, so the static shadow maps must be redrawn.
+	++models->static_version;
+
+	// The new instances' spheres start at the origin, so setting the transform
+	// below counts as moving them there for the shadow maps.
+	memset(models->mis_world_bounding_spheres + models->mis_count * STRIDE_SPHERE, 0, sizeof(float) * n * STRIDE_SPHERE);
+
 	// Update the number of instances.
+	const int old_instances_count = models->mis_count;
 	models->mis_count = new_instances_count;
+
+	// Default to the identity transform, this also sets the world space bounding sphere.
+	const V3 zero = { 0, 0, 0 };
+	const V3 one = { 1, 1, 1 };
+	for (int i = old_instances_count; i < new_instances_count; ++i)
+	{
+		mi_set_transform(models, i, zero, zero, one);
+	}
 	
 	// Update render buffer counts.
 	rbs->instances_count = new_instances_count;
@@ -389,26 +571,57 @@ void free_models(Models* models)
 	free(models->mbs_faces_counts);
 	free(models->mbs_face_position_indices);
 	free(models->mbs_face_normal_indices);
+	free(models->mbs_face_uvs_indices);
+	free(models->mbs_face_vertex_ids);
+	free(models->mbs_vertices_counts);
 	free(models->mbs_object_space_positions);
 	free(models->mbs_object_space_normals);
 	free(models->mbs_uvs);
+	free(models->mbs_object_space_centres);
+	free(models->mbs_object_space_radii);
+	free(models->mbs_object_space_face_planes);
+	free(models->mbs_meshlet_face_indices);
+	free(models->mbs_meshlet_spheres);
+	free(models->mbs_meshlet_cones);
 
 	free(models->mbs_faces_offsets);
 	free(models->mbs_positions_offsets);
 	free(models->mbs_normals_offsets);
+	free(models->mbs_uvs_counts);
+	free(models->mbs_uvs_offsets);
+	free(models->mbs_meshlets_offsets);
+	free(models->mbs_meshlets_counts);
 
 	free(models->mis_base_ids);
+	free(models->mis_positions_offsets);
+	free(models->mis_normals_offsets);
+	free(models->mis_faces_offsets);
 	free(models->mis_texture_ids);
 	free(models->mis_dirty_bounding_sphere_flags);
 	free(models->mis_passed_broad_phase_flags);
+	free(models->mis_occluder_flags);
+	free(models->mis_static_flags);
+	free(models->mis_unmoved_frames);
+	free(models->mis_promoted_static_flags);
+	free(models->mis_dirty_shadow_flags);
+	free(models->mis_shadow_motion);
 	free(models->mis_intersected_planes);
 
 	free(models->mis_vertex_colours);
 	free(models->mis_transforms);
+	free(models->mis_model_matrices);
+	free(models->mis_normal_matrices);
+	free(models->mis_dirty_normal_matrix_flags);
 	free(models->mis_bounding_spheres);
+	free(models->mis_world_bounding_spheres);
+	free(models->mis_frustum_plane_masks);
+
+	instance_bvh_destroy(&models->bvh);
 
 	free(models->view_space_positions);
 	free(models->view_space_normals);
+	free(models->mis_model_view_matrices);
+	free(models->mis_view_normal_matrices);
 }
 
 void mi_set_transform(Models* models, int mi_index, V3 position, V3 eulers, V3 scale)
@@ -426,6 +639,92 @@ void mi_set_transform(Models* models, int mi_index, V3 position, V3 eulers, V3 s
 	models->mis_transforms[ti + 6] = scale.x;
 	models->mis_transforms[ti + 7] = scale.y;
 	models->mis_transforms[ti + 8] = scale.z;
+
+	// Cache the model matrix so it's only rebuilt when the transform changes,
+	// the normal matrix isn't needed until the instance is visible.
+	float* model_matrix = models->mis_model_matrices + mi_index * STRIDE_M4;
+	m4_model_matrix(position, eulers, scale, model_matrix);
+
+	models->mis_dirty_normal_matrix_flags[mi_index] = 1;
+
+	// Update the world space bounding sphere. Scaling the model base's radius by
+	// the largest axis always contains the transformed model.
+	const int mb_index = models->mis_base_ids[mi_index];
+
+	V4 centre = v3_read_to_v4(models->mbs_object_space_centres + mb_index * STRIDE_POSITION, 1.f);
+
+	V4 ws_centre;
+	m4_mul_v4(model_matrix, centre, &ws_centre);
+
+	const float max_scale = max(max(fabsf(scale.x), fabsf(scale.y)), fabsf(scale.z));
+
+	float* sphere = models->mis_world_bounding_spheres + mi_index * STRIDE_SPHERE;
+
+	const V3 old_centre = v3_read(sphere);
+	const float old_radius = sphere[3];
+
+	sphere[0] = ws_centre.x;
+	sphere[1] = ws_centre.y;
+	sphere[2] = ws_centre.z;
+	sphere[3] = models->mbs_object_space_radii[mb_index] * max_scale;
+
+	// The shadow maps of the lights near the instance are out of date.
+	models->mis_dirty_shadow_flags[mi_index] = 1;
+	models->mis_shadow_motion[mi_index] += size(v3_sub_v3(v4_xyz(ws_centre), old_centre)) + fabsf(sphere[3] - old_radius);
+
+	instance_bvh_refit(&models->bvh, mi_index, sphere);
+
+	// Moving a static instance invalidates the static shadow maps. One that was
+	// only made static for not moving goes back to being drawn each frame.
+	if (models->mis_static_flags[mi_index])
+	{
+		++models->static_version;
+
+		if (models->mis_promoted_static_flags[mi_index])
+		{
+			models->mis_static_flags[mi_index] = 0;
+			models->mis_promoted_static_flags[mi_index] = 0;
+		}
+	}
+
+	models->mis_unmoved_frames[mi_index] = 0;
+}
+
+void mi_set_occluder(Models* models, int mi_index, int is_occluder)
+{
+	models->mis_occluder_flags[mi_index] = is_occluder;
+}
+
+void mi_set_static(Models* models, int mi_index, int is_static)
+{
+	// Setting it explicitly means moving the instance doesn't change it.
+	models->mis_promoted_static_flags[mi_index] = 0;
+
+	if (models->mis_static_flags[mi_index] != is_static)
+	{
+		models->mis_static_flags[mi_index] = is_static;
+		++models->static_version;
+	}
+}
+
+void mis_promote_static(Models* models)
+{
+	for (int i = 0; i < models->mis_count; ++i)
+	{
+		if (models->mis_static_flags[i])
+		{
+			continue;
+		}
+
+		// The instances that reach the count on the same frame share the one 
+		// redraw of the static shadow maps.
+		if (++models->mis_unmoved_frames[i] >= MI_STATIC_PROMOTION_FRAMES)
+		{
+			models->mis_static_flags[i] = 1;
+			models->mis_promoted_static_flags[i] = 1;
+			++models->static_version;
+		}
+	}
 }
 
 #undef _CRT_SECURE_NO_WARNINGS
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define MODELS_H
 
 #include "renderer/render_buffers.h"
+#include "instance_bvh.h"
 
 #include "common/status.h"
 #include "maths/vector3.h"
@@ -9,6 +10,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+// How many frames in a row a mi must go without being moved before it is made
+// static.
+#define MI_STATIC_PROMOTION_FRAMES 60
+
 /*
 
 ModelBase
@@ -58,32 +63,47 @@ typedef struct
 	int mbs_count;
 	int mis_count;
 	int max_mb_faces;					// The highest number of faces in a mesh, out of all the models. Used for the temporary clipping buffers.
+	int max_mb_vertices;				// The highest number of unique vertices in a mesh, out of all the models. Used for the vertex lighting cache.
+	int max_mb_positions;				// The highest number of positions in a mesh, out of all the models. Used for transforming positions on demand.
+	int max_mb_normals;					// The highest number of normals in a mesh, out of all the models. Used for transforming normals on demand.
 
 	// ModelBase data
 	int mbs_total_faces;				// The total number of faces defined by all mbs.
 	int mbs_total_positions;
 	int mbs_total_normals;
 	int mbs_total_uvs;
+	int mbs_total_meshlets;
 
 	int* mbs_faces_offsets;
 	int* mbs_positions_offsets;
 	int* mbs_normals_offsets;
 	int* mbs_uvs_offsets;
+	int* mbs_meshlets_offsets;
 
 	int* mbs_positions_counts;			// The model matrix transform is model specific, therefore, we must store how many positions the mesh has.
 	int* mbs_normals_counts;			// The model normal matrix transform is model specific, therefore, we must store how many normals the mesh has.
 	int* mbs_faces_counts;				// Number of faces in the model.
 	int* mbs_uvs_counts;
+	int* mbs_vertices_counts;			// Number of unique (position, normal) pairs used by the faces of the model.
+	int* mbs_meshlets_counts;			// Number of meshlets the faces of the model are split into.
 
 	// TODO: Get rid of face prefix??
 	int* mbs_face_position_indices;		// The indices to positions that make up the faces, used for indexed rendering.
 	int* mbs_face_normal_indices;		// The indices to normals that make up the faces, used for indexed rendering.
 	int* mbs_face_uvs_indices;
+	int* mbs_face_vertex_ids;			// The unique (position, normal) pair of each face vertex, so faces that share a vertex can share its results.
 
 	float* mbs_object_space_positions;	// Original vertex positions without any transforms applied.
 	float* mbs_object_space_normals;
 	float* mbs_uvs;
 	float* mbs_object_space_centres;
+	float* mbs_object_space_radii;		// The radius of the bounding sphere around the centre.
+	float* mbs_object_space_face_planes;	// The plane of each face, the normal isn't normalised. Used for backface culling in object space.
+
+	// Meshlets, see meshlets.h.
+	int* mbs_meshlet_face_indices;		// The faces of the model in meshlet order, relative to the model's first face.
+	float* mbs_meshlet_spheres;			// The object space bounding sphere of each meshlet.
+	float* mbs_meshlet_cones;			// The object space normal cone of each meshlet.
 
 	// Instance data
 	// TODO: Naming.
@@ -92,19 +112,40 @@ typedef struct
 	int mis_total_normals;
 
 	int* mis_base_ids;						// The id of the model base.
+	int* mis_positions_offsets;				// The mi's first position in the view space positions, the sum of the positions counts of the mis before it.
+	int* mis_normals_offsets;				// Same for the normals.
+	int* mis_faces_offsets;					// Same for the faces, so each mi's front faces have their own space in the front faces buffers.
 	int* mis_texture_ids;					// The id of the texture.
 	int* mis_dirty_bounding_sphere_flags;	// If a mi's scale has changed, the bounding sphere centre needs to be recalculated.
-	int* mis_intersected_planes;			// For each mi, the number of planes intersected, then the indices of the planes.
+	int* mis_intersected_planes;			// For each mi, the number of planes intersected, then the indices of the planes. Each mi has STRIDE_INTERSECTED_PLANES ints.
 	int* mis_passed_broad_phase_flags;		// Whether the mi is visible after broad phase culling. TODO: Name.
+	int* mis_occluder_flags;				// Whether the mi is drawn to the occlusion buffer, should only be set for large instances that hide others.
+	int* mis_static_flags;					// Whether the mi doesn't move, static mis are drawn to the cached static shadow maps.
+	int static_version;						// Changed whenever a static mi is added, moved or changes whether it's static, so the static shadow maps know to redraw.
+	int* mis_unmoved_frames;				// How many frames in a row the mi hasn't been moved for, counted by mis_promote_static.
+	int* mis_promoted_static_flags;			// Whether the mi was made static for not moving rather than by mi_set_static, it stops being static when moved.
+	int* mis_dirty_shadow_flags;			// Whether the mi has been added or moved since the shadow maps were last scheduled.
+	float* mis_shadow_motion;				// How far the mi's bounding sphere has moved and grown since the shadow maps were last scheduled.
 
 	float* mis_vertex_colours;			// Per vertex colours for the instances.
 	float* mis_transforms;				// The instance world space transforms: [ Position, Direction, Scale ]
+	float* mis_model_matrices;			// Built from the transform by mi_set_transform, so they are shared by the camera and shadow passes.
+	float* mis_normal_matrices;			// Built from the transform when first needed after it changes.
+	int* mis_dirty_normal_matrix_flags;	// If a mi's transform has changed, the normal matrix needs to be recalculated.
 	float* mis_bounding_spheres;		// The bounding sphere for each instance in world space.
+	float* mis_world_bounding_spheres;	// Conservative world space bounding spheres, updated when the transform is set.
+	int* mis_frustum_plane_masks;		// The frustum planes each mi's world space sphere intersects, only these need testing in view space.
+
+	// Hierarchy of the world space bounding spheres for culling.
+	InstanceBVH bvh;
 
 	// Transform results buffers.
 	// TODO: These are specific to mis, should prefix. - or move to RenderBuffers.
 	float* view_space_positions;
-	float* view_space_normals;
+	float* view_space_normals;			// Only made when the fused pipeline isn't used, as it transforms each instance's normals into a scratch buffer.
+	int view_space_normals_count;		// The number of normals the view space normals buffer holds.
+	float* mis_model_view_matrices;		// Only the positions of front faces are transformed to view space, so the matrices are kept for cull_backfaces.
+	float* mis_view_normal_matrices;	// Same for the normals.
 	
 	
 } Models;
@@ -132,8 +173,22 @@ void create_model_instances(Models* models, RenderBuffers* rbs, int mb_index, in
 void free_models(Models* models);
 
 // Helpers
+
+// Sets the instance's transform and refits its bounds in the bvh.
 void mi_set_transform(Models* models, int mi_index, V3 position, V3 eulers, V3 scale);
 
+// Marks whether the instance is drawn to the occlusion buffer to hide the ones
+// behind it. Only large instances are worth drawing.
+void mi_set_occluder(Models* models, int mi_index, int is_occluder);
+
+// Marks whether the instance moves. Static instances are only drawn to the shadow
+// maps again when one of them changes, so they should rarely be moved.
+void mi_set_static(Models* models, int mi_index, int is_static);
+
+// Counts another frame for the instances that haven't been moved, and makes the
+// ones that haven't moved for MI_STATIC_PROMOTION_FRAMES static until they are.
+void mis_promote_static(Models* models);
+
 
 
 #endif
\ No newline at end of file
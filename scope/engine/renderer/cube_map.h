@@ -0,0 +1,91 @@
+#ifndef CUBE_MAP_H
+#define CUBE_MAP_H
+
+#include "depth_buffer.h"
+
+#include "maths/vector3.h"
+
+/*
+
+Cube maps
+
+A point light's shadow map is a cube around the light, so it covers every
+direction. The six faces are stored one after another in a single depth buffer
+that is one face wide and six faces tall, so the whole cube is one allocation
+and a face is just an offset into it.
+
+Each face is a 90 degree view from the light's position, looking along one of
+the axes. A position relative to the light is on the face of its largest axis,
+so finding the face is only a few comparisons.
+
+*/
+
+#define CUBE_MAP_FACES 6
+
+// The order of the faces in the depth buffer.
+typedef enum
+{
+	CUBE_MAP_FACE_POSITIVE_X,
+	CUBE_MAP_FACE_NEGATIVE_X,
+	CUBE_MAP_FACE_POSITIVE_Y,
+	CUBE_MAP_FACE_NEGATIVE_Y,
+	CUBE_MAP_FACE_POSITIVE_Z,
+	CUBE_MAP_FACE_NEGATIVE_Z
+
+} CubeMapFace;
+
+typedef struct
+{
+	V3 forward; // The direction the face looks along.
+	V3 up;
+	V3 right;	// cross(forward, up).
+
+} CubeMapFaceAxes;
+
+// The view of each face, the same as a camera looking down -z in view space.
+static const CubeMapFaceAxes CUBE_MAP_FACE_AXES[CUBE_MAP_FACES] = {
+	{ {  1,  0,  0 }, { 0, 1,  0 }, {  0, 0,  1 } },
+	{ { -1,  0,  0 }, { 0, 1,  0 }, {  0, 0, -1 } },
+	{ {  0,  1,  0 }, { 0, 0,  1 }, {  1, 0,  0 } },
+	{ {  0, -1,  0 }, { 0, 0, -1 }, {  1, 0,  0 } },
+	{ {  0,  0,  1 }, { 0, 1,  0 }, { -1, 0,  0 } },
+	{ {  0,  0, -1 }, { 0, 1,  0 }, {  1, 0,  0 } }
+};
+
+inline int cube_map_face_select(V3 v)
+{
+	// The face of the largest axis, ties go to x then y.
+	const float ax = fabsf(v.x);
+	const float ay = fabsf(v.y);
+	const float az = fabsf(v.z);
+
+	if (ax >= ay && ax >= az)
+	{
+		return v.x > 0 ? CUBE_MAP_FACE_POSITIVE_X : CUBE_MAP_FACE_NEGATIVE_X;
+	}
+
+	if (ay >= az)
+	{
+		return v.y > 0 ? CUBE_MAP_FACE_POSITIVE_Y : CUBE_MAP_FACE_NEGATIVE_Y;
+	}
+
+	return v.z > 0 ? CUBE_MAP_FACE_POSITIVE_Z : CUBE_MAP_FACE_NEGATIVE_Z;
+}
+
+// Puts a position relative to the light into the face's view space.
+inline V3 cube_map_face_view_space(int face, V3 v)
+{
+	const CubeMapFaceAxes* axes = &CUBE_MAP_FACE_AXES[face];
+
+	return (V3) { dot(v, axes->right), dot(v, axes->up), -dot(v, axes->forward) };
+}
+
+// The face as its own depth buffer, it shares the cube map's data.
+inline DepthBuffer cube_map_face(const DepthBuffer* cube_map, int face)
+{
+	const int size = cube_map->width;
+
+	return (DepthBuffer) { size, size, cube_map->data + face * size * size };
+}
+
+#endif
@@ -70,6 +70,11 @@ void depth_buffer_fill(DepthBuffer* depth_buffer, float depth)
 	}
 }
 
+void depth_buffer_copy(DepthBuffer* dest, const DepthBuffer* source)
+{
+	memcpy(dest->data, source->data, (size_t)source->width * source->height * sizeof(float));
+}
+
 void depth_buffer_draw(const DepthBuffer* source, Canvas* target, int x_offset, int y_offset)
 {
 	for (int y = 0; y < source->height; ++y)
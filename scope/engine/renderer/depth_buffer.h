@@ -20,6 +20,9 @@ Status depth_buffer_resize(DepthBuffer* depth_buffer, int width, int height);
 
 void depth_buffer_fill(DepthBuffer* depth_buffer, float depth);
 
+// Copies the source's depths, the buffers must be the same size.
+void depth_buffer_copy(DepthBuffer* dest, const DepthBuffer* source);
+
 void depth_buffer_draw(const DepthBuffer* source, Canvas* target, int x_offset, int y_offset);
 
 void depth_buffer_destroy(DepthBuffer* depth_buffer);
@@ -0,0 +1,124 @@
+#include "frame_graph.h"
+
+#include "utils/logger.h"
+
+#include <Windows.h>
+
+#include <string.h>
+
+static void run_stage(FrameGraph* fg, int stage_index, int worker_index)
+{
+	FrameStage* stage = &fg->stages[stage_index];
+
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter(&start);
+
+	stage->function(stage->data, stage->index, worker_index);
+
+	QueryPerformanceCounter(&end);
+	stage->elapsed_ms = (float)(end.QuadPart - start.QuadPart) * 1000.f / fg->frequency.QuadPart;
+}
+
+static void run_stages_job(void* data, int begin, int end, int worker_index)
+{
+	FrameGraph* fg = (FrameGraph*)data;
+
+	for (int i = begin; i < end; ++i)
+	{
+		run_stage(fg, fg->level_stages[i], worker_index);
+	}
+}
+
+void frame_graph_init(FrameGraph* fg)
+{
+	memset(fg, 0, sizeof(FrameGraph));
+
+	QueryPerformanceFrequency(&fg->frequency);
+}
+
+void frame_graph_begin(FrameGraph* fg)
+{
+	fg->stages_count = 0;
+	fg->levels_count = 0;
+}
+
+Status frame_graph_add_stage(FrameGraph* fg, const char* name, FrameStageFunction function, void* data, int index, FrameResources reads, FrameResources writes)
+{
+	if (fg->stages_count == MAX_FRAME_STAGES)
+	{
+		log_error("Failed to add the %s stage, the frame graph is full.", name);
+		return STATUS_FAILURE;
+	}
+
+	FrameStage* stage = &fg->stages[fg->stages_count];
+	stage->name = name;
+	stage->function = function;
+	stage->data = data;
+	stage->index = index;
+	stage->reads = reads;
+	stage->writes = writes;
+	stage->elapsed_ms = 0;
+
+	// The stages are added in order, so the stages it depends on are already
+	// in the graph.
+	stage->level = 0;
+
+	for (int i = 0; i < fg->stages_count; ++i)
+	{
+		const FrameStage* other = &fg->stages[i];
+
+		const int depends = (other->writes & (reads | writes)) || (other->reads & writes);
+		if (depends)
+		{
+			stage->level = max(stage->level, other->level + 1);
+		}
+	}
+
+	fg->levels_count = max(fg->levels_count, stage->level + 1);
+	++fg->stages_count;
+
+	return STATUS_OK;
+}
+
+void frame_graph_execute(FrameGraph* fg, JobSystem* js)
+{
+	for (int level = 0; level < fg->levels_count; ++level)
+	{
+		// Find the stages of the level, in the order they were added.
+		int count = 0;
+
+		for (int i = 0; i < fg->stages_count; ++i)
+		{
+			if (fg->stages[i].level == level)
+			{
+				fg->level_stages[count++] = i;
+			}
+		}
+
+		// A single stage doesn't need to wake the workers to run, it can still
+		// split its own work between them.
+		if (1 == count)
+		{
+			run_stage(fg, fg->level_stages[0], 0);
+		}
+		else
+		{
+			parallel_for(js, 0, count, 1, run_stages_job, fg);
+		}
+	}
+}
+
+float frame_graph_elapsed_ms(const FrameGraph* fg, const char* name)
+{
+	float elapsed_ms = 0;
+
+	for (int i = 0; i < fg->stages_count; ++i)
+	{
+		if (0 == strcmp(fg->stages[i].name, name))
+		{
+			elapsed_ms += fg->stages[i].elapsed_ms;
+		}
+	}
+
+	return elapsed_ms;
+}
@@ -0,0 +1,86 @@
+#ifndef FRAME_GRAPH_H
+#define FRAME_GRAPH_H
+
+#include "job_system.h"
+
+#include "common/status.h"
+
+#include <Windows.h>
+
+/*
+
+Frame graph
+
+The stages of a frame are added to the graph each frame, along with the
+resources they read and write. A stage depends on the earlier stages that
+write a resource it reads or writes, and on the earlier stages that read a
+resource it writes. So running the stages in dependency order gives the same
+result as running them in the order they were added.
+
+The stages are sorted into levels, each stage is one level after the last
+stage it depends on. The stages of a level don't depend on each other, so they
+are run at the same time on the job system's workers. A level with a single
+stage is run on the calling thread. A stage can use parallel_for itself either
+way, when it runs on a worker the range is shared with the other workers once
+they finish their own stages.
+
+Each stage is timed as it runs.
+
+*/
+
+#define MAX_FRAME_STAGES 32
+
+// A bit mask of the resources a stage uses, what each bit means is up to the
+// stages.
+typedef unsigned long long FrameResources;
+
+// The index is the one the stage was added with, so the same function can be
+// used for several stages.
+typedef void (*FrameStageFunction)(void* data, int index, int worker_index);
+
+typedef struct
+{
+	const char* name;
+	FrameStageFunction function;
+	void* data;
+	int index;
+
+	FrameResources reads;
+	FrameResources writes;
+
+	int level;			// The number of stages on the longest chain of stages it depends on.
+	float elapsed_ms;	// How long the stage took to run last frame.
+
+} FrameStage;
+
+typedef struct
+{
+	FrameStage stages[MAX_FRAME_STAGES];
+	int stages_count;
+	int levels_count;
+
+	// The stages of the level that is running.
+	int level_stages[MAX_FRAME_STAGES];
+
+	LARGE_INTEGER frequency;
+
+} FrameGraph;
+
+void frame_graph_init(FrameGraph* fg);
+
+// Removes the last frame's stages.
+void frame_graph_begin(FrameGraph* fg);
+
+// Adds a stage that runs after the stages it depends on. Returns STATUS_OK, or
+// an error if the graph is full.
+Status frame_graph_add_stage(FrameGraph* fg, const char* name, FrameStageFunction function, void* data, int index, FrameResources reads, FrameResources writes);
+
+// Runs all the stages, returns once they are done.
+void frame_graph_execute(FrameGraph* fg, JobSystem* js);
+
+// Returns how long the stages with the name took to run last frame in total, 
+// in milliseconds. The stages of a level run at the same time, so this can be
+// more than the frame took.
+float frame_graph_elapsed_ms(const FrameGraph* fg, const char* name);
+
+#endif
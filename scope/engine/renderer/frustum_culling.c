@@ -97,4 +97,53 @@ void view_frustum_init(ViewFrustum* view_frustum, float near_dist, float far_dis
 	view_frustum->planes[view_frustum->planes_count++] = left;
 	view_frustum->planes[view_frustum->planes_count++] = top;
 	view_frustum->planes[view_frustum->planes_count++] = bottom;
+}
+
+void guard_band_frustum_init(ViewFrustum* guard_band_frustum, float near_dist, float far_dist, float fov, float aspect_ratio)
+{
+	// Scaling the tangent of half the fov scales the size of the near and far
+	// planes, so the side planes go through the edges of the guard band.
+	const float guard_band_fov = 2.f * atanf(GUARD_BAND_SCALE * tanf(radians(fov) * 0.5f)) * 180.f / PI;
+
+	view_frustum_init(guard_band_frustum, near_dist, far_dist, guard_band_fov, aspect_ratio);
+}
+
+void view_frustum_from_m4(ViewFrustum* view_frustum, const M4 m)
+{
+	memset(view_frustum, 0, sizeof(ViewFrustum));
+
+	// A point is inside the frustum if -w <= x, y, z <= w in clip space. Each of
+	// these is a plane equation made from the rows of the matrix, e.g. the left 
+	// plane is (row3 + row0) . v >= 0. The matrix is column major so row r is 
+	// m[r], m[r + 4], m[r + 8], m[r + 12].
+	// The order matches view_frustum_init: near, far, right, left, top, bottom.
+	const float signs[MAX_FRUSTUM_PLANES] = { 1.f, -1.f, -1.f, 1.f, -1.f, 1.f };
+	const int rows[MAX_FRUSTUM_PLANES] = { 2, 2, 0, 0, 1, 1 };
+
+	for (int i = 0; i < MAX_FRUSTUM_PLANES; ++i)
+	{
+		const int r = rows[i];
+		const float s = signs[i];
+
+		V3 normal = {
+			m[3] + m[r] * s,
+			m[7] + m[r + 4] * s,
+			m[11] + m[r + 8] * s
+		};
+
+		float d = m[15] + m[r + 12] * s;
+
+		// Normalise so the signed distance is in world units.
+		const float inv_length = 1.f / size(normal);
+		normal = v3_mul_f(normal, inv_length);
+		d *= inv_length;
+
+		// The plane stores a point rather than d, so use the closest point to the origin.
+		Plane plane = {
+			.normal = normal,
+			.point = v3_mul_f(normal, -d)
+		};
+
+		view_frustum->planes[view_frustum->planes_count++] = plane;
+	}
 }
\ No newline at end of file
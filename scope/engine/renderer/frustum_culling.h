@@ -2,9 +2,25 @@
 #define FRUSTUM_CULLING_H
 
 #include "maths/plane.h"
+#include "maths/matrix4.h"
 
 #define MAX_FRUSTUM_PLANES 6
 
+// The guard band is this many times the size of the screen in each axis.
+#define GUARD_BAND_SCALE 4.f
+
+// The order of the planes in a ViewFrustum.
+typedef enum
+{
+	FRUSTUM_PLANE_NEAR,
+	FRUSTUM_PLANE_FAR,
+	FRUSTUM_PLANE_RIGHT,
+	FRUSTUM_PLANE_LEFT,
+	FRUSTUM_PLANE_TOP,
+	FRUSTUM_PLANE_BOTTOM
+
+} FrustumPlane;
+
 typedef struct
 {
 	Plane planes[MAX_FRUSTUM_PLANES];
@@ -14,5 +30,15 @@ typedef struct
 
 void view_frustum_init(ViewFrustum* view_frustum, float near_dist, float far_dist, float fov, float aspect_ratio);
 
+// Same as view_frustum_init, but the side planes are moved out to the edges of 
+// the guard band. Triangles inside the guard band can be drawn without clipping
+// them against the side planes, the rasteriser only draws the pixels on screen.
+void guard_band_frustum_init(ViewFrustum* guard_band_frustum, float near_dist, float far_dist, float fov, float aspect_ratio);
+
+// Extracts the frustum planes from a view projection matrix, the planes are in
+// the space that the matrix transforms from. E.g. projection * view gives a
+// world space frustum. The plane normals point into the frustum.
+void view_frustum_from_m4(ViewFrustum* view_frustum, const M4 view_projection);
+
 
 #endif
\ No newline at end of file
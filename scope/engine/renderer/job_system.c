@@ -0,0 +1,290 @@
+#include "job_system.h"
+
+#include "utils/logger.h"
+
+#include <Windows.h>
+
+#include <string.h>
+
+static int job_queue_push(JobQueue* queue, Job job)
+{
+	EnterCriticalSection(&queue->lock);
+
+	// If the queue is full the caller runs the job itself.
+	const int pushed = queue->bottom - queue->top < JOB_QUEUE_CAPACITY;
+	if (pushed)
+	{
+		queue->jobs[queue->bottom % JOB_QUEUE_CAPACITY] = job;
+		++queue->bottom;
+	}
+
+	LeaveCriticalSection(&queue->lock);
+
+	return pushed;
+}
+
+static int job_queue_pop(JobQueue* queue, Job* out)
+{
+	// Takes the most recently pushed job, which is the smallest.
+	EnterCriticalSection(&queue->lock);
+
+	const int popped = queue->bottom > queue->top;
+	if (popped)
+	{
+		--queue->bottom;
+		*out = queue->jobs[queue->bottom % JOB_QUEUE_CAPACITY];
+
+		if (queue->top == queue->bottom)
+		{
+			queue->top = 0;
+			queue->bottom = 0;
+		}
+	}
+
+	LeaveCriticalSection(&queue->lock);
+
+	return popped;
+}
+
+static int job_queue_steal(JobQueue* queue, Job* out)
+{
+	// Takes the oldest job, which is the largest.
+	EnterCriticalSection(&queue->lock);
+
+	const int stolen = queue->bottom > queue->top;
+	if (stolen)
+	{
+		*out = queue->jobs[queue->top % JOB_QUEUE_CAPACITY];
+		++queue->top;
+
+		// Start from the beginning again once the queue is empty, so the
+		// indices never grow too large.
+		if (queue->top == queue->bottom)
+		{
+			queue->top = 0;
+			queue->bottom = 0;
+		}
+	}
+
+	LeaveCriticalSection(&queue->lock);
+
+	return stolen;
+}
+
+static void run_job(JobSystem* js, int worker_index, Job job)
+{
+	JobQueue* queue = &js->workers[worker_index].queue;
+	JobGroup* group = job.group;
+
+	// Keep the first half and leave the second for this worker, or a thief,
+	// until the range is small enough.
+	while (job.end - job.begin > group->grain)
+	{
+		const int middle = job.begin + (job.end - job.begin) / 2;
+
+		const Job second_half = { middle, job.end, group };
+		if (!job_queue_push(queue, second_half))
+		{
+			break;
+		}
+
+		job.end = middle;
+	}
+
+	group->function(group->data, job.begin, job.end, worker_index);
+
+	// The group can be gone as soon as its last items are counted.
+	InterlockedExchangeAdd(&group->remaining, -(job.end - job.begin));
+}
+
+static void job_system_work(JobSystem* js, int worker_index, const JobGroup* group)
+{
+	// Run jobs until every item of the group's range is done, the jobs can be
+	// from any group. This worker's queue is checked first, then the other 
+	// workers' queues, starting from the next one so the thieves are spread out.
+	while (group->remaining > 0)
+	{
+		Job job;
+		int found = job_queue_pop(&js->workers[worker_index].queue, &job);
+
+		for (int i = 1; !found && i < js->workers_count; ++i)
+		{
+			const int victim = (worker_index + i) % js->workers_count;
+			found = job_queue_steal(&js->workers[victim].queue, &job);
+		}
+
+		if (found)
+		{
+			run_job(js, worker_index, job);
+		}
+		else
+		{
+			// The last jobs are still running on the other workers.
+			YieldProcessor();
+		}
+	}
+}
+
+static DWORD WINAPI job_worker_main(LPVOID param)
+{
+	JobWorker* worker = (JobWorker*)param;
+	JobSystem* js = worker->js;
+
+	while (1)
+	{
+		WaitForSingleObject(worker->start_event, INFINITE);
+
+		if (!js->running)
+		{
+			break;
+		}
+
+		job_system_work(js, worker->index, js->group);
+
+		SetEvent(worker->done_event);
+	}
+
+	return 0;
+}
+
+Status job_system_init(JobSystem* js)
+{
+	memset(js, 0, sizeof(JobSystem));
+
+	// Use a worker per logical processor.
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+
+	js->workers_count = min(max((int)system_info.dwNumberOfProcessors, 1), MAX_JOB_WORKERS);
+	js->running = 1;
+
+	for (int i = 0; i < js->workers_count; ++i)
+	{
+		JobWorker* worker = &js->workers[i];
+		worker->js = js;
+		worker->index = i;
+
+		InitializeCriticalSection(&worker->queue.lock);
+
+		// The first worker is the thread that calls parallel_for.
+		if (0 == i)
+		{
+			continue;
+		}
+
+		// The events are made first, so a thread is only started once it has 
+		// something to wait on.
+		worker->start_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		worker->done_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+		if (worker->start_event && worker->done_event)
+		{
+			worker->thread = CreateThread(NULL, 0, job_worker_main, worker, 0, NULL);
+		}
+
+		if (!worker->thread)
+		{
+			log_error("Failed to create job worker thread.");
+
+			if (worker->start_event)
+			{
+				CloseHandle(worker->start_event);
+			}
+			if (worker->done_event)
+			{
+				CloseHandle(worker->done_event);
+			}
+
+			DeleteCriticalSection(&worker->queue.lock);
+
+			// Stop the workers that were started.
+			js->workers_count = i;
+			job_system_destroy(js);
+			js->workers_count = 0;
+
+			return STATUS_WIN32_FAILURE;
+		}
+	}
+
+	return STATUS_OK;
+}
+
+void parallel_for(JobSystem* js, int worker_index, int count, int grain, JobFunction function, void* data)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	// Not worth waking the workers for a single job.
+	grain = max(grain, 1);
+
+	if (js->workers_count <= 1 || count <= grain)
+	{
+		function(data, 0, count, worker_index);
+		return;
+	}
+
+	JobGroup group = { function, data, grain, count };
+	const Job job = { 0, count, &group };
+
+	// If this is called from a job, the other workers are already running and
+	// will steal from this worker's queue. If the queue is full the range is 
+	// run here.
+	if (js->busy)
+	{
+		if (!job_queue_push(&js->workers[worker_index].queue, job))
+		{
+			function(data, 0, count, worker_index);
+			return;
+		}
+
+		job_system_work(js, worker_index, &group);
+		return;
+	}
+
+	js->busy = 1;
+	js->group = &group;
+
+	job_queue_push(&js->workers[0].queue, job);
+
+	// Wake the workers, they start by stealing from this thread's queue.
+	for (int i = 1; i < js->workers_count; ++i)
+	{
+		SetEvent(js->workers[i].start_event);
+	}
+
+	job_system_work(js, 0, &group);
+
+	// The workers can still be reading the job data until they stop.
+	for (int i = 1; i < js->workers_count; ++i)
+	{
+		WaitForSingleObject(js->workers[i].done_event, INFINITE);
+	}
+
+	js->busy = 0;
+	js->group = NULL;
+}
+
+void job_system_destroy(JobSystem* js)
+{
+	// Stop the worker threads.
+	js->running = 0;
+
+	for (int i = 1; i < js->workers_count; ++i)
+	{
+		JobWorker* worker = &js->workers[i];
+
+		SetEvent(worker->start_event);
+		WaitForSingleObject(worker->thread, INFINITE);
+
+		CloseHandle(worker->thread);
+		CloseHandle(worker->start_event);
+		CloseHandle(worker->done_event);
+	}
+
+	for (int i = 0; i < js->workers_count; ++i)
+	{
+		DeleteCriticalSection(&js->workers[i].queue.lock);
+	}
+}
@@ -0,0 +1,100 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include "common/status.h"
+
+#include <Windows.h>
+
+/*
+
+Job system
+
+A pool of worker threads that is kept for the lifetime of the renderer, so the
+per instance stages and the tiled rasteriser's tiles can be split between them
+without creating threads each frame.
+
+parallel_for pushes the whole range as a single job onto the calling thread's
+queue. Whenever a worker takes a job that is larger than the grain size, it
+splits it in half, pushes the second half back onto the bottom of its own
+queue and keeps going with the first. Workers with an empty queue steal from
+the top of the others', which is where the largest remaining ranges are.
+
+Each job is given the index of the worker running it, so it can use that
+worker's own scratch buffers. The calling thread is always worker 0. A job can
+call parallel_for itself, the range is pushed onto the queue of the worker 
+running the job, where the other workers can steal from it. While it waits for
+the range to finish, the worker runs any jobs it can find, so it is never idle.
+
+*/
+
+#define MAX_JOB_WORKERS 32
+#define JOB_QUEUE_CAPACITY 64 // Ranges are halved before being pushed, so a queue only ever holds a few.
+
+typedef void (*JobFunction)(void* data, int begin, int end, int worker_index);
+
+// The jobs of a single parallel_for call.
+typedef struct
+{
+	JobFunction function;
+	void* data;
+	int grain;
+	volatile LONG remaining; // The number of items that haven't been run yet.
+
+} JobGroup;
+
+typedef struct
+{
+	int begin;
+	int end;
+	JobGroup* group;
+
+} Job;
+
+typedef struct
+{
+	// The owner pushes and pops at the bottom, thieves take from the top. The
+	// lock is only held for a few instructions so contention is rare.
+	CRITICAL_SECTION lock;
+	Job jobs[JOB_QUEUE_CAPACITY];
+	int top;
+	int bottom;
+
+} JobQueue;
+
+typedef struct JobSystem JobSystem;
+
+typedef struct
+{
+	JobSystem* js;
+	int index;
+	HANDLE thread;
+	HANDLE start_event;
+	HANDLE done_event;
+
+	JobQueue queue;
+
+} JobWorker;
+
+struct JobSystem
+{
+	int workers_count;
+	JobWorker workers[MAX_JOB_WORKERS];
+	int running;
+	int busy; // Whether a parallel_for is running.
+
+	// The jobs of the outermost parallel_for, the workers keep running jobs 
+	// until it is done.
+	JobGroup* group;
+};
+
+Status job_system_init(JobSystem* js);
+
+// Calls function for sub ranges of [0, count) that are at most grain items long,
+// on all the workers, returns once the whole range is done. The function must
+// not depend on the order the ranges are run in. worker_index is the worker 
+// that is calling it, 0 if it isn't called from a job.
+void parallel_for(JobSystem* js, int worker_index, int count, int grain, JobFunction function, void* data);
+
+void job_system_destroy(JobSystem* js);
+
+#endif
@@ -0,0 +1,238 @@
+#include "occlusion_culling.h"
+
+#include "render.h"
+
+#include "maths/vector4.h"
+#include "maths/vector_maths.h"
+
+#include "utils/logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+Status occlusion_buffer_init(OcclusionBuffer* ob, int width, int height)
+{
+	memset(ob, 0, sizeof(OcclusionBuffer));
+
+	return occlusion_buffer_resize(ob, width, height);
+}
+
+Status occlusion_buffer_resize(OcclusionBuffer* ob, int width, int height)
+{
+	int level_width = max(width / OCCLUSION_BUFFER_SCALE, 1);
+	int level_height = max(height / OCCLUSION_BUFFER_SCALE, 1);
+
+	ob->levels_count = 0;
+
+	while (ob->levels_count < MAX_DEPTH_PYRAMID_LEVELS)
+	{
+		// The levels that haven't been used yet are zeroed, so the resize will
+		// allocate them.
+		Status status = depth_buffer_resize(&ob->levels[ob->levels_count], level_width, level_height);
+		if (STATUS_OK != status)
+		{
+			log_error("Failed to resize the occlusion buffer.");
+			return status;
+		}
+
+		++ob->levels_count;
+
+		if (1 == level_width && 1 == level_height)
+		{
+			break;
+		}
+
+		// Round up so the texels at the edge are still covered.
+		level_width = (level_width + 1) / 2;
+		level_height = (level_height + 1) / 2;
+	}
+
+	return STATUS_OK;
+}
+
+void occlusion_buffer_clear(OcclusionBuffer* ob)
+{
+	depth_buffer_fill(&ob->levels[0], 1.f);
+}
+
+V4 occlusion_buffer_project(const DepthBuffer* db, const M4 projection_matrix, V3 v)
+{
+	// Same as project, but for the occlusion buffer's size.
+	V4 clip;
+	m4_mul_v4(projection_matrix, v3_to_v4(v, 1.f), &clip);
+
+	const float inv_w = 1.f / clip.w;
+
+	V4 out = {
+		(clip.x * inv_w + 1) * 0.5f * db->width,
+		(-clip.y * inv_w + 1) * 0.5f * db->height,
+		(clip.z * inv_w + 1) * 0.5f,
+		inv_w
+	};
+
+	return out;
+}
+
+void occlusion_buffer_draw_triangle(OcclusionBuffer* ob, const M4 projection_matrix, float near_plane, V3 v0, V3 v1, V3 v2)
+{
+	// Clip the triangle against the near plane, the camera looks down -z.
+	// Clipping a triangle against one plane gives at most a quad.
+	const V3 in[3] = { v0, v1, v2 };
+	V3 out[4];
+	int out_count = 0;
+
+	const float near_z = -near_plane;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		const V3 a = in[i];
+		const V3 b = in[(i + 1) % 3];
+
+		const int a_inside = a.z <= near_z;
+		const int b_inside = b.z <= near_z;
+
+		if (a_inside)
+		{
+			out[out_count++] = a;
+		}
+
+		// The edge crosses the plane, so add the intersection.
+		if (a_inside != b_inside)
+		{
+			const float t = (near_z - a.z) / (b.z - a.z);
+			out[out_count++] = v3_add_v3(a, v3_mul_f(v3_sub_v3(b, a), t));
+		}
+	}
+
+	if (out_count < 3)
+	{
+		return;
+	}
+
+	DepthBuffer* db = &ob->levels[0];
+
+	V4 projected[4];
+	for (int i = 0; i < out_count; ++i)
+	{
+		projected[i] = occlusion_buffer_project(db, projection_matrix, out[i]);
+	}
+
+	draw_depth_triangle(db, projected[0], projected[1], projected[2]);
+
+	if (4 == out_count)
+	{
+		draw_depth_triangle(db, projected[0], projected[2], projected[3]);
+	}
+}
+
+void occlusion_buffer_build_pyramid(OcclusionBuffer* ob)
+{
+	for (int i = 1; i < ob->levels_count; ++i)
+	{
+		const DepthBuffer* src = &ob->levels[i - 1];
+		DepthBuffer* dst = &ob->levels[i];
+
+		for (int y = 0; y < dst->height; ++y)
+		{
+			// If the source has an odd size, the last texel only covers one.
+			const int sy0 = y * 2;
+			const int sy1 = min(sy0 + 1, src->height - 1);
+
+			const float* row0 = src->data + sy0 * src->width;
+			const float* row1 = src->data + sy1 * src->width;
+
+			for (int x = 0; x < dst->width; ++x)
+			{
+				const int sx0 = x * 2;
+				const int sx1 = min(sx0 + 1, src->width - 1);
+
+				// Keep the furthest depth so the test is conservative.
+				const float d0 = max(row0[sx0], row0[sx1]);
+				const float d1 = max(row1[sx0], row1[sx1]);
+
+				dst->data[y * dst->width + x] = max(d0, d1);
+			}
+		}
+	}
+}
+
+int occlusion_buffer_test_sphere(const OcclusionBuffer* ob, const M4 projection_matrix, float near_plane, V3 centre, float radius)
+{
+	// The sphere crosses the near plane, so it can't be behind anything.
+	const float nearest_z = centre.z + radius;
+	if (nearest_z > -near_plane)
+	{
+		return 1;
+	}
+
+	// The projected sphere is inside the projected corners of its bounding box,
+	// which are all in front of the near plane. For each axis the extremes are
+	// at the nearest or furthest depth. The projection only scales x and y and
+	// w is -z.
+	const float inv_near_w = 1.f / -nearest_z;
+	const float inv_far_w = 1.f / -(centre.z - radius);
+
+	const float min_x = min((centre.x - radius) * inv_near_w, (centre.x - radius) * inv_far_w) * projection_matrix[0];
+	const float max_x = max((centre.x + radius) * inv_near_w, (centre.x + radius) * inv_far_w) * projection_matrix[0];
+	const float min_y = min((centre.y - radius) * inv_near_w, (centre.y - radius) * inv_far_w) * projection_matrix[5];
+	const float max_y = max((centre.y + radius) * inv_near_w, (centre.y + radius) * inv_far_w) * projection_matrix[5];
+
+	// The depth of the nearest point, in the same range as the depth buffer.
+	const float depth = ((projection_matrix[10] * nearest_z + projection_matrix[14]) * inv_near_w + 1) * 0.5f;
+
+	// Convert the bounds to texels of the first level. Screen space y is flipped.
+	// The bounds are grown by a texel because the occluders are drawn at a low
+	// resolution, so the texels at their edges may only be partly covered.
+	const DepthBuffer* base = &ob->levels[0];
+
+	int x0 = (int)floorf((min_x + 1) * 0.5f * base->width) - 1;
+	int x1 = (int)floorf((max_x + 1) * 0.5f * base->width) + 1;
+	int y0 = (int)floorf((-max_y + 1) * 0.5f * base->height) - 1;
+	int y1 = (int)floorf((-min_y + 1) * 0.5f * base->height) + 1;
+
+	x0 = max(x0, 0);
+	y0 = max(y0, 0);
+	x1 = min(x1, base->width - 1);
+	y1 = min(y1, base->height - 1);
+
+	// Off the screen, leave it to frustum culling.
+	if (x0 > x1 || y0 > y1)
+	{
+		return 1;
+	}
+
+	// Find the first level where the bounds cover at most 2x2 texels.
+	int level = 0;
+	while (level < ob->levels_count - 1 &&
+		((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+	{
+		++level;
+	}
+
+	const DepthBuffer* db = &ob->levels[level];
+
+	float max_depth = 0;
+
+	for (int y = y0 >> level; y <= y1 >> level; ++y)
+	{
+		for (int x = x0 >> level; x <= x1 >> level; ++x)
+		{
+			max_depth = max(max_depth, db->data[y * db->width + x]);
+		}
+	}
+
+	return depth <= max_depth;
+}
+
+void occlusion_buffer_destroy(OcclusionBuffer* ob)
+{
+	// depth_buffer_destroy frees the struct itself, the levels are part of the
+	// occlusion buffer so just free their data.
+	for (int i = 0; i < MAX_DEPTH_PYRAMID_LEVELS; ++i)
+	{
+		free(ob->levels[i].data);
+	}
+
+	memset(ob, 0, sizeof(OcclusionBuffer));
+}
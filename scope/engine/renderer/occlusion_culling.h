@@ -0,0 +1,57 @@
+#ifndef OCCLUSION_CULLING_H
+#define OCCLUSION_CULLING_H
+
+#include "depth_buffer.h"
+
+#include "common/status.h"
+
+#include "maths/vector3.h"
+#include "maths/matrix4.h"
+
+/*
+
+Software occlusion culling.
+
+The occluders are drawn into a small depth buffer, then a pyramid is built from
+it where each texel stores the furthest depth of the 2x2 texels below it. An
+instance is hidden if the nearest point of its bounding sphere is behind the
+furthest depth under its projected bounds, which only needs a few texel reads
+from the level where the bounds cover at most 2x2 texels.
+
+*/
+
+// The occlusion buffer is 1/4 the size of the render target in each axis.
+#define OCCLUSION_BUFFER_SCALE 4
+
+#define MAX_DEPTH_PYRAMID_LEVELS 16
+
+typedef struct
+{
+	// Level 0 is the occluders' depth buffer, each level after is half the size
+	// of the one before it, down to 1x1.
+	DepthBuffer levels[MAX_DEPTH_PYRAMID_LEVELS];
+	int levels_count;
+
+} OcclusionBuffer;
+
+// The width and height are the size of the render target.
+Status occlusion_buffer_init(OcclusionBuffer* ob, int width, int height);
+Status occlusion_buffer_resize(OcclusionBuffer* ob, int width, int height);
+
+void occlusion_buffer_clear(OcclusionBuffer* ob);
+
+// Draws the view space triangle to the first level, the triangle is clipped
+// against the near plane so it can't project behind the camera.
+void occlusion_buffer_draw_triangle(OcclusionBuffer* ob, const M4 projection_matrix, float near_plane, V3 v0, V3 v1, V3 v2);
+
+// Builds the rest of the levels from the first, must be called after all the
+// occluders are drawn and before testing.
+void occlusion_buffer_build_pyramid(OcclusionBuffer* ob);
+
+// Returns 1 if any of the view space sphere may be visible, 0 if it is
+// completely hidden by the occluders.
+int occlusion_buffer_test_sphere(const OcclusionBuffer* ob, const M4 projection_matrix, float near_plane, V3 centre, float radius);
+
+void occlusion_buffer_destroy(OcclusionBuffer* ob);
+
+#endif
@@ -15,13 +15,16 @@
 
 #include "utils/timer.h"
 #include "utils/common.h"
+#include "utils/logger.h"
 
 #include "globals.h"
 
 #include "resources.h"
+#include "meshlets.h"
 
 #include <stdio.h>
 #include <string.h>
+#include <float.h>
 
 void debug_draw_point_lights(Canvas* canvas, const RenderSettings* settings, PointLights* point_lights)
 {
@@ -267,6 +270,129 @@ void debug_draw_mi_normals(Canvas* canvas, const RenderSettings* settings, const
 	}*/
 }
 
+int shadow_map_test(V4 projected, const DepthBuffer* db)
+{
+	// The light space position is relative to the light, so the largest axis 
+	// picks the face of the cube map.
+	const V3 v = { projected.x, projected.y, projected.z };
+
+	const int face = cube_map_face_select(v);
+	const V3 face_view_space = cube_map_face_view_space(face, v);
+
+	// Nothing is drawn to the map outside of the near and far planes.
+	const float distance = -face_view_space.z;
+	if (distance < POINT_LIGHT_SHADOW_NEAR_PLANE || distance > POINT_LIGHT_SHADOW_FAR_PLANE)
+	{
+		return -1;
+	}
+
+	// Same as projecting with the face's 90 degree projection matrix, the w
+	// after projecting is the distance.
+	const float inv_distance = 1.f / distance;
+	const int size = db->width;
+
+	int cols = (int)((face_view_space.x * inv_distance + 1) * size * 0.5f);
+	int rows = (int)((-face_view_space.y * inv_distance + 1) * size * 0.5f);
+
+	// TODO: Some of the values are just wrong that's why we get the issue
+	if (cols > -1 && cols < size && rows > -1 && rows < size)
+	{
+		float light_min_depth = db->data[(face * size + rows) * size + cols];
+
+		float pixel_light_depth = (POINT_LIGHT_SHADOW_DEPTH_SCALE + POINT_LIGHT_SHADOW_DEPTH_OFFSET * inv_distance + 1) * 0.5f;
+
+		return pixel_light_depth > light_min_depth;
+	}
+
+	return -1;
+}
+
+void depth_tiles_update(RenderTarget* rt, int x0, int x1, int y)
+{
+	// Recalculates the furthest depth of the tiles that the span overlaps. Only
+	// the span's row of each tile is read, the other rows are kept up to date
+	// by their own spans.
+	const int width = rt->canvas.width;
+	const int tile_y = y / DEPTH_TILE_SIZE;
+	const int row = y % DEPTH_TILE_SIZE;
+	const int rows_count = min(DEPTH_TILE_SIZE, rt->canvas.height - tile_y * DEPTH_TILE_SIZE);
+
+	const float* depths = rt->depth_buffer + y * width;
+
+	for (int tile_x = x0 / DEPTH_TILE_SIZE; tile_x <= (x1 - 1) / DEPTH_TILE_SIZE; ++tile_x)
+	{
+		const int tile_index = tile_y * rt->depth_tiles_cols + tile_x;
+
+		const int start = tile_x * DEPTH_TILE_SIZE;
+		const int end = min(start + DEPTH_TILE_SIZE, width);
+
+		float row_max = depths[start];
+		for (int x = start + 1; x < end; ++x)
+		{
+			row_max = max(row_max, depths[x]);
+		}
+
+		float* rows_max = rt->depth_tile_rows_max + tile_index * DEPTH_TILE_SIZE;
+
+		// Depths only ever get closer, so if this row wasn't the furthest in the
+		// tile, the tile's furthest depth can't have changed.
+		const int was_furthest = rows_max[row] >= rt->depth_tiles_max[tile_index];
+		rows_max[row] = row_max;
+
+		if (!was_furthest)
+		{
+			continue;
+		}
+
+		float tile_max = rows_max[0];
+		for (int i = 1; i < rows_count; ++i)
+		{
+			tile_max = max(tile_max, rows_max[i]);
+		}
+
+		rt->depth_tiles_max[tile_index] = tile_max;
+	}
+}
+
+int depth_tiles_occluded(const RenderTarget* rt, int x0, int y0, int x1, int y1, float min_z)
+{
+	for (int tile_y = y0 / DEPTH_TILE_SIZE; tile_y <= (y1 - 1) / DEPTH_TILE_SIZE; ++tile_y)
+	{
+		const float* tiles_max = rt->depth_tiles_max + tile_y * rt->depth_tiles_cols;
+
+		for (int tile_x = x0 / DEPTH_TILE_SIZE; tile_x <= (x1 - 1) / DEPTH_TILE_SIZE; ++tile_x)
+		{
+			// A pixel is only drawn if it is closer than the depth buffer.
+			if (min_z < tiles_max[tile_x])
+			{
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+int triangle_occluded(const RenderTarget* rt, const float* vc0, const float* vc1, const float* vc2, const Rect* clip)
+{
+	// The bounds are grown by a pixel so they definitely contain every pixel 
+	// the rasterisers could draw.
+	const int x0 = max((int)floorf(min(min(vc0[0], vc1[0]), vc2[0])) - 1, clip->x0);
+	const int x1 = min((int)ceilf(max(max(vc0[0], vc1[0]), vc2[0])) + 1, clip->x1);
+	const int y0 = max((int)floorf(min(min(vc0[1], vc1[1]), vc2[1])) - 1, clip->y0);
+	const int y1 = min((int)ceilf(max(max(vc0[1], vc1[1]), vc2[1])) + 1, clip->y1);
+
+	// Nothing to draw anyway.
+	if (x0 >= x1 || y0 >= y1)
+	{
+		return 1;
+	}
+
+	const float min_z = min(min(vc0[2], vc1[2]), vc2[2]);
+
+	return depth_tiles_occluded(rt, x0, y0, x1, y1, min_z);
+}
+
 void draw_scanline(RenderTarget* rt,
 	RenderBuffers* rbs,
 	int x0, int x1,
@@ -275,7 +401,8 @@ void draw_scanline(RenderTarget* rt,
 	float w0, float w1,
 	V3 ac0, V3 ac1,
 	V3 lc0, V3 lc1,
-	float* lsps, int lights_count, DepthBuffer* depth_maps)
+	float* lsps, int lights_count, DepthBuffer* depth_maps,
+	const Rect* clip)
 {
 	// If this per pixel stuff gets too much, flat shading might have to be the way forward. Not sure how the shadows
 	// would play into that.
@@ -286,25 +413,25 @@ void draw_scanline(RenderTarget* rt,
 	if (x0 == x1) return;
 
 	// Precalculate deltas.
-	const unsigned int dx = x1 - x0;
+	const int dx = x1 - x0;
 	float inv_dx = 1.f / dx;
 
 	float w_step = (w1 - w0) * inv_dx;
+	float z_step = (z1 - z0) * inv_dx;
+
+	// Only draw the part of the scanline that is inside the clip rect.
+	const int start_i = max(0, clip->x0 - x0);
+	const int end_i = min(dx, clip->x1 - x0);
 
 	// Offset x by the given y.
 	int row_offset = rt->canvas.width * y;
 
-	int start_x = x0 + row_offset;
-	int end_x = x1 + row_offset;
+	int start_x = x0 + row_offset + start_i;
 
 	// Render the scanline
 	unsigned int* pixels = rt->canvas.pixels + start_x;
 	float* depth_buffer = rt->depth_buffer + start_x;
 
-	float inv_w = w0;
-	float z = z0;
-	float z_step = (z1 - z0) * inv_dx;
-
 	// TODO: Should be step not deltas?
 	float* lsp_deltas = rbs->scanline_light_space_pos_deltas;
 	float* current_lsps = rbs->scanline_light_space_current_pos;
@@ -321,13 +448,7 @@ void draw_scanline(RenderTarget* rt,
 		lsp_deltas[index + 2] = (lsps[lsp_i + 6] - lsps[lsp_i + 2]) * inv_dx;
 		lsp_deltas[index + 3] = (lsps[lsp_i + 7] - lsps[lsp_i + 3]) * inv_dx;
 
-		
-		//printf("%f %f %f %f\n", lsps[lsp_i + 0], lsps[lsp_i+ 1], lsps[lsp_i + 2], lsps[lsp_i + 3]);
-		//printf("%f %f %f %f\n", lsps[lsp_i + 4], lsps[lsp_i + 5], lsps[lsp_i + 6], lsps[lsp_i + 7]);
-		//printf("%f %f %f %f\n\n", lsp_deltas[index + 0], lsp_deltas[index + 1], lsp_deltas[index + 2], lsp_deltas[index + 3]);
-		
-		// Also write out the initial lsp so we can increment it.
-		// TODO: maybe we should separate lsp0 and lsp1 so we can just add to lsp0.
+		// Also write out the lsp at the start of the span so we can increment it.
 		current_lsps[index + 0] = lsps[lsp_i + 0];
 		current_lsps[index + 1] = lsps[lsp_i + 1];
 		current_lsps[index + 2] = lsps[lsp_i + 2];
@@ -345,9 +466,31 @@ void draw_scanline(RenderTarget* rt,
 	// TODO: TEMP: HARdcoeded
 	V3 ambient = { 0.1, 0.1, 0.1 };
 
+	// Start the per pixel values at the start of the span.
+	float z = z0;
+	float inv_w = w0;
+
 	V3 ac = ac0;
+	V3 lc = lc0;
 
-	for (unsigned int i = 0; i < dx; ++i)
+	// Step over the pixels before the clip rect the same way as the drawn ones,
+	// so a span that is cut by a tile draws exactly the same pixels as the 
+	// whole span would.
+	for (int i = 0; i < start_i; ++i)
+	{
+		z += z_step;
+		inv_w += w_step;
+
+		v3_add_eq_v3(&ac, ac_step);
+		v3_add_eq_v3(&lc, lc_step);
+
+		for (int j = 0; j < lights_count * STRIDE_V4; ++j)
+		{
+			current_lsps[j] += lsp_deltas[j];
+		}
+	}
+
+	for (int i = start_i; i < end_i; ++i)
 	{
 		// Depth test, only draw closer values.
 		if (*depth_buffer > z)
@@ -356,7 +499,6 @@ void draw_scanline(RenderTarget* rt,
 			const float w = 1.0f / inv_w;
 
 			// Calculate the colour of the vertex.
-			
 			float albedo_r = ac.x * w;
 			float albedo_g = ac.y * w;
 			float albedo_b = ac.z * w;
@@ -375,45 +517,14 @@ void draw_scanline(RenderTarget* rt,
 					current_lsps[lsp_i + 3] * w
 				};
 
-				float light_w = 1.f / projected.w;
-
-				DepthBuffer db = depth_maps[j];
-
-				V3 shadow_coords = {
-					(projected.x * light_w + 1) * db.width * 0.5f,
-					(-projected.y * light_w + 1) * db.height * 0.5f,
-					(projected.z * light_w + 1) * 0.5f
-				};
-
-				int cols = (int)((shadow_coords.x));
-				int rows = (int)((shadow_coords.y));
-				
-				// TODO: Some of the values are just wrong that's why we get the issue
-				if (cols > -1 && cols < db.width && rows > -1 && rows < db.height)
+				const int result = shadow_map_test(projected, &depth_maps[j]);
+				if (1 == result)
 				{
-					// In shadow
-					int xo = rt->canvas.width - db.width;
-
-					int index = (int)(rows * rt->canvas.width + xo + cols);
-					float light_min_depth = db.data[rows * db.width + cols];
-
-					// TODO: We're quite close...... i think....
-					// TODO: But why does the effect change with the camera? That seems to be an issue here
-					//float pixel_light_depth = lsp_start[2];
-					float pixel_light_depth = shadow_coords.z;
-
-
-					
-
-					
-					if (pixel_light_depth > light_min_depth)
-					{
-						shadow = 1;
-					}
-					else
-					{
-						
-						/*
+					shadow = 1;
+				}
+				else if (0 == result)
+				{
+					/*
 
 					Actually...... if we're in shadow for one light, we can't light those pixels with it, but the other lights might.....
 					how can we do this.
@@ -426,10 +537,8 @@ void draw_scanline(RenderTarget* rt,
 
 					*/
 
-
-						shadow = 0;
-						break;
-					}
+					shadow = 0;
+					break;
 				}
 			}
 
@@ -441,15 +550,11 @@ void draw_scanline(RenderTarget* rt,
 			}
 			else
 			{
-				
-				
-				float light_r = (lc0.x * w) * albedo_r;
-				float light_g = (lc0.y * w) * albedo_g;
-				float light_b = (lc0.z * w) * albedo_b;
+				float light_r = (lc.x * w) * albedo_r;
+				float light_g = (lc.y * w) * albedo_g;
+				float light_b = (lc.z * w) * albedo_b;
 
 				*pixels = float_rgb_to_int(light_r, light_g, light_b);
-				
-
 			}
 
 			*depth_buffer = z;			
@@ -464,7 +569,7 @@ void draw_scanline(RenderTarget* rt,
 		inv_w += w_step;
 
 		v3_add_eq_v3(&ac, ac_step);
-		v3_add_eq_v3(&lc0, lc_step);
+		v3_add_eq_v3(&lc, lc_step);
 
 		// Step light space positions, doing it component by component.
 		// Not sure what is faster.
@@ -475,7 +580,315 @@ void draw_scanline(RenderTarget* rt,
 	}
 }
 
-void draw_flat_bottom_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0, float* vc1, float* vc2, int vertex_stride, int lights_count, DepthBuffer* depth_maps)
+#ifdef SIMD_LANES
+void draw_scanline_simd(RenderTarget* rt,
+	RenderBuffers* rbs,
+	int x0, int x1,
+	int y,
+	float z0, float z1,
+	float w0, float w1,
+	V3 ac0, V3 ac1,
+	V3 lc0, V3 lc1,
+	float* lsps, int lights_count, DepthBuffer* depth_maps,
+	const Rect* clip)
+{
+	// Same as draw_scanline but shades SIMD_LANES pixels at a time. The pixels 
+	// that fail the depth test are masked out of the writes.
+	// The groups of pixels are aligned to the start of the span, not the clip
+	// rect, so every pixel is drawn the same whichever tile it is drawn for.
+
+	if (x0 == x1) return;
+
+	const int dx = x1 - x0;
+	const float inv_dx = 1.f / dx;
+
+	const float w_step = (w1 - w0) * inv_dx;
+	const float z_step = (z1 - z0) * inv_dx;
+
+	const int start_i = max(0, clip->x0 - x0);
+	const int end_i = min(dx, clip->x1 - x0);
+
+	const int start_x = x0 + rt->canvas.width * y;
+
+	unsigned int* pixels = rt->canvas.pixels + start_x;
+	float* depth_buffer = rt->depth_buffer + start_x;
+
+	float* lsp_deltas = rbs->scanline_light_space_pos_deltas;
+
+	for (int i = 0; i < lights_count; ++i)
+	{
+		int index = i * STRIDE_V4;
+		int lsp_i = i * STRIDE_V4 * 2;
+
+		lsp_deltas[index + 0] = (lsps[lsp_i + 4] - lsps[lsp_i + 0]) * inv_dx;
+		lsp_deltas[index + 1] = (lsps[lsp_i + 5] - lsps[lsp_i + 1]) * inv_dx;
+		lsp_deltas[index + 2] = (lsps[lsp_i + 6] - lsps[lsp_i + 2]) * inv_dx;
+		lsp_deltas[index + 3] = (lsps[lsp_i + 7] - lsps[lsp_i + 3]) * inv_dx;
+	}
+
+	V3 ac_step = v3_mul_f(v3_sub_v3(ac1, ac0), inv_dx);
+	V3 lc_step = v3_mul_f(v3_sub_v3(lc1, lc0), inv_dx);
+
+	// TODO: TEMP: HARdcoeded
+	const SimdF ambient = simd_set1(0.1f);
+
+	const SimdF zero = simd_zero();
+	const SimdF one = simd_set1(1.f);
+	const SimdF half = simd_set1(0.5f);
+	const SimdF colour_scale = simd_set1(255.f);
+	const SimdI minus_one = simd_set1_int(-1);
+	const SimdF lane_indices = simd_lane_indices();
+
+	const SimdF near_plane = simd_set1(POINT_LIGHT_SHADOW_NEAR_PLANE);
+	const SimdF far_plane = simd_set1(POINT_LIGHT_SHADOW_FAR_PLANE);
+	const SimdF depth_scale = simd_set1(POINT_LIGHT_SHADOW_DEPTH_SCALE);
+	const SimdF depth_offset = simd_set1(POINT_LIGHT_SHADOW_DEPTH_OFFSET);
+
+	const SimdF first = simd_set1(start_i - 0.5f);
+	const SimdF last = simd_set1((float)end_i);
+
+	// Buffers for groups that are only partially inside the span, these must not
+	// read or write outside of it as another thread may be drawing there.
+	float depth_lanes[SIMD_LANES];
+	unsigned int pixel_lanes[SIMD_LANES];
+
+	for (int i = start_i - start_i % SIMD_LANES; i < end_i; i += SIMD_LANES)
+	{
+		const SimdF t = simd_add(simd_set1((float)i), lane_indices);
+		const int partial = i < start_i || i + SIMD_LANES > end_i;
+
+		SimdF depth;
+		if (partial)
+		{
+			for (int j = 0; j < SIMD_LANES; ++j)
+			{
+				const int k = i + j;
+				depth_lanes[j] = (k >= start_i && k < end_i) ? depth_buffer[k] : 0.f;
+			}
+
+			depth = simd_load(depth_lanes);
+		}
+		else
+		{
+			depth = simd_load(depth_buffer + i);
+		}
+
+		// Depth test, only draw closer values.
+		const SimdF z = simd_add(simd_set1(z0), simd_mul(simd_set1(z_step), t));
+		SimdF closer = simd_less(z, depth);
+		
+		if (partial)
+		{
+			closer = simd_and(closer, simd_and(simd_greater(t, first), simd_less(t, last)));
+		}
+
+		if (!simd_mask_bits(closer))
+		{
+			continue;
+		}
+
+		// Recover w
+		const SimdF w = simd_rcp(simd_add(simd_set1(w0), simd_mul(simd_set1(w_step), t)));
+
+		const SimdF albedo_r = simd_mul(simd_add(simd_set1(ac0.x), simd_mul(simd_set1(ac_step.x), t)), w);
+		const SimdF albedo_g = simd_mul(simd_add(simd_set1(ac0.y), simd_mul(simd_set1(ac_step.y), t)), w);
+		const SimdF albedo_b = simd_mul(simd_add(simd_set1(ac0.z), simd_mul(simd_set1(ac_step.z), t)), w);
+
+		// Same as the scalar version, a pixel is in shadow if the last light whose
+		// depth map it is inside of shadows it, and stops at the first light that
+		// lights it. Once a lane is lit it ignores the other lights.
+		SimdF shadow = simd_zero();
+		SimdF pending = closer;
+
+		for (int j = 0; j < lights_count; ++j)
+		{
+			const int lsp_i = j * STRIDE_V4 * 2;
+			const int delta_i = j * STRIDE_V4;
+
+			const SimdF px = simd_mul(simd_add(simd_set1(lsps[lsp_i + 0]), simd_mul(simd_set1(lsp_deltas[delta_i + 0]), t)), w);
+			const SimdF py = simd_mul(simd_add(simd_set1(lsps[lsp_i + 1]), simd_mul(simd_set1(lsp_deltas[delta_i + 1]), t)), w);
+			const SimdF pz = simd_mul(simd_add(simd_set1(lsps[lsp_i + 2]), simd_mul(simd_set1(lsp_deltas[delta_i + 2]), t)), w);
+
+			// Select each lane's cube map face the same as cube_map_face_select, 
+			// then put it in the face's view space using CUBE_MAP_FACE_AXES.
+			const SimdF ax = simd_abs(px);
+			const SimdF ay = simd_abs(py);
+			const SimdF az = simd_abs(pz);
+
+			const SimdF not_x = simd_or(simd_less(ax, ay), simd_less(ax, az));
+			const SimdF not_y = simd_less(ay, az);
+
+			const SimdF positive_x = simd_greater(px, zero);
+			const SimdF positive_y = simd_greater(py, zero);
+			const SimdF positive_z = simd_greater(pz, zero);
+
+			const SimdF neg_px = simd_sub(zero, px);
+			const SimdF neg_pz = simd_sub(zero, pz);
+
+			const SimdF face_x = simd_select(
+				simd_select(neg_pz, pz, positive_x),
+				simd_select(px, simd_select(px, neg_px, positive_z), not_y),
+				not_x);
+
+			const SimdF face_y = simd_select(py, simd_select(simd_select(neg_pz, pz, positive_y), py, not_y), not_x);
+			const SimdF distance = simd_select(ax, simd_select(ay, az, not_y), not_x);
+
+			const SimdF face = simd_select(
+				simd_select(simd_set1(CUBE_MAP_FACE_NEGATIVE_X), simd_set1(CUBE_MAP_FACE_POSITIVE_X), positive_x),
+				simd_select(
+					simd_select(simd_set1(CUBE_MAP_FACE_NEGATIVE_Y), simd_set1(CUBE_MAP_FACE_POSITIVE_Y), positive_y),
+					simd_select(simd_set1(CUBE_MAP_FACE_NEGATIVE_Z), simd_set1(CUBE_MAP_FACE_POSITIVE_Z), positive_z),
+					not_y),
+				not_x);
+
+			const SimdF inv_distance = simd_rcp(distance);
+
+			const DepthBuffer* db = &depth_maps[j];
+			const int size = db->width;
+			const SimdF half_size = simd_set1(size * 0.5f);
+
+			const SimdF sx = simd_mul(simd_add(simd_mul(face_x, inv_distance), one), half_size);
+			const SimdF sy = simd_mul(simd_sub(one, simd_mul(face_y, inv_distance)), half_size);
+			const SimdF sz = simd_mul(simd_add(simd_add(depth_scale, simd_mul(depth_offset, inv_distance)), one), half);
+
+			const SimdI cols = simd_to_int(sx);
+			const SimdI rows = simd_to_int(sy);
+
+			SimdF in_map = simd_and(simd_greater_int(cols, minus_one), simd_greater_int(simd_set1_int(size), cols));
+			in_map = simd_and(in_map, simd_and(simd_greater_int(rows, minus_one), simd_greater_int(simd_set1_int(size), rows)));
+
+			// Nothing is drawn to the map outside of the near and far planes.
+			in_map = simd_and_not(in_map, simd_or(simd_less(distance, near_plane), simd_greater(distance, far_plane)));
+
+			// Only look up the lanes that still need to know.
+			const SimdF test = simd_and(in_map, pending);
+			if (!simd_mask_bits(test))
+			{
+				continue;
+			}
+
+			// The faces are stacked vertically, so offset the rows to the lane's face.
+			const SimdI cube_rows = simd_to_int(simd_add(sy, simd_mul(face, simd_set1((float)size))));
+
+			const SimdF light_min_depth = simd_gather_2d(db->data, size, cols, cube_rows, test);
+			const SimdF shadowed = simd_greater(sz, light_min_depth);
+
+			shadow = simd_select(shadow, shadowed, test);
+			pending = simd_and_not(pending, simd_and_not(test, shadowed));
+
+			if (!simd_mask_bits(pending))
+			{
+				break;
+			}
+		}
+
+		// Shadowed pixels only get the ambient.
+		const SimdF light_r = simd_mul(simd_mul(simd_add(simd_set1(lc0.x), simd_mul(simd_set1(lc_step.x), t)), w), albedo_r);
+		const SimdF light_g = simd_mul(simd_mul(simd_add(simd_set1(lc0.y), simd_mul(simd_set1(lc_step.y), t)), w), albedo_g);
+		const SimdF light_b = simd_mul(simd_mul(simd_add(simd_set1(lc0.z), simd_mul(simd_set1(lc_step.z), t)), w), albedo_b);
+
+		const SimdF r = simd_select(light_r, simd_mul(albedo_r, ambient), shadow);
+		const SimdF g = simd_select(light_g, simd_mul(albedo_g, ambient), shadow);
+		const SimdF b = simd_select(light_b, simd_mul(albedo_b, ambient), shadow);
+
+		// Pack the colours in the same way as float_rgb_to_int.
+		SimdI colour = simd_shift_left_int(simd_to_int(simd_mul(r, colour_scale)), 16);
+		colour = simd_or_int(colour, simd_shift_left_int(simd_to_int(simd_mul(g, colour_scale)), 8));
+		colour = simd_or_int(colour, simd_to_int(simd_mul(b, colour_scale)));
+
+		if (partial)
+		{
+			// Only write back the lanes that passed.
+			simd_store_int(pixel_lanes, colour);
+			simd_store(depth_lanes, z);
+
+			const int bits = simd_mask_bits(closer);
+			for (int j = 0; j < SIMD_LANES; ++j)
+			{
+				if (bits & (1 << j))
+				{
+					pixels[i + j] = pixel_lanes[j];
+					depth_buffer[i + j] = depth_lanes[j];
+				}
+			}
+		}
+		else
+		{
+			simd_store_int(pixels + i, simd_select_int(simd_load_int(pixels + i), colour, closer));
+			simd_store(depth_buffer + i, simd_select(depth, z, closer));
+		}
+	}
+}
+#endif
+
+void draw_visible_scanline(RenderTarget* rt,
+	RenderBuffers* rbs,
+	int x0, int x1,
+	int y,
+	float z0, float z1,
+	float w0, float w1,
+	V3 ac0, V3 ac1,
+	V3 lc0, V3 lc1,
+	float* lsps, int lights_count, DepthBuffer* depth_maps,
+	const Rect* clip)
+{
+	const int span_x0 = max(x0, clip->x0);
+	const int span_x1 = min(x1, clip->x1);
+
+	if (span_x0 >= span_x1)
+	{
+		return;
+	}
+
+	// The same z as the scanline functions calculate.
+	const float z_step = (z1 - z0) * (1.f / (x1 - x0));
+
+	const float* tiles_max = rt->depth_tiles_max + (y / DEPTH_TILE_SIZE) * rt->depth_tiles_cols;
+
+	// Trims the tiles the span is behind from both ends. Splitting the span 
+	// around hidden tiles in the middle costs more in setup than it saves.
+	const int first_tile = span_x0 / DEPTH_TILE_SIZE;
+	const int last_tile = (span_x1 - 1) / DEPTH_TILE_SIZE;
+
+	int run_x0 = span_x1;
+	int run_x1 = span_x0;
+
+	for (int tile_x = first_tile; tile_x <= last_tile; ++tile_x)
+	{
+		const int start = max(tile_x * DEPTH_TILE_SIZE, span_x0);
+		const int end = min((tile_x + 1) * DEPTH_TILE_SIZE, span_x1);
+
+		// z is linear along the span, so the closest is at one of the ends.
+		const float start_z = z0 + z_step * (float)(start - x0);
+		const float end_z = z0 + z_step * (float)(end - 1 - x0);
+
+		if (min(start_z, end_z) < tiles_max[tile_x])
+		{
+			run_x0 = min(run_x0, start);
+			run_x1 = end;
+		}
+	}
+
+	if (run_x0 >= run_x1)
+	{
+		return;
+	}
+
+	// The scanline functions only draw the pixels inside the clip rect and the 
+	// values don't depend on it.
+	Rect run = *clip;
+	run.x0 = run_x0;
+	run.x1 = run_x1;
+
+#ifdef SIMD_SCANLINES
+	draw_scanline_simd(rt, rbs, x0, x1, y, z0, z1, w0, w1, ac0, ac1, lc0, lc1, lsps, lights_count, depth_maps, &run);
+#else
+	draw_scanline(rt, rbs, x0, x1, y, z0, z1, w0, w1, ac0, ac1, lc0, lc1, lsps, lights_count, depth_maps, &run);
+#endif
+	depth_tiles_update(rt, run.x0, run.x1, y);
+}
+
+void draw_flat_bottom_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0, float* vc1, float* vc2, int vertex_stride, int lights_count, DepthBuffer* depth_maps, const Rect* clip)
 {
 	// Sort the flat vertices left to right.
 	if (vc1[0] > vc2[0])
@@ -503,6 +916,16 @@ void draw_flat_bottom_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0,
 	int start_y = (int)(ceil(v0.y - 0.5f));
 	int end_y = (int)(ceil(v2.y - 0.5f));
 
+	// Only draw the rows inside the clip rect. Each row is lerped from the
+	// first vertex so this does not change the values of the drawn rows.
+	start_y = max(start_y, clip->y0);
+	end_y = min(end_y, clip->y1);
+
+	if (start_y >= end_y)
+	{
+		return;
+	}
+
 	// Albedo
 	V3 ac0 = v3_read(vc0 + 4);
 	V3 ac1 = v3_read(vc1 + 4);
@@ -584,11 +1007,11 @@ void draw_flat_bottom_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0,
 		}
 	
 
-		draw_scanline(rt, rbs, start_x, end_x, y, z0, z1, start_w, end_w, start_ac, end_ac, start_lc, end_lc, lsp_out, lights_count, depth_maps);
+		draw_visible_scanline(rt, rbs, start_x, end_x, y, z0, z1, start_w, end_w, start_ac, end_ac, start_lc, end_lc, lsp_out, lights_count, depth_maps, clip);
 	}
 }
 
-void draw_flat_top_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0, float* vc1, float* vc2, int vertex_stride, int lights_count, DepthBuffer* depth_maps)
+void draw_flat_top_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0, float* vc1, float* vc2, int vertex_stride, int lights_count, DepthBuffer* depth_maps, const Rect* clip)
 {
 	// Sort the flat vertices left to right.
 	if (vc0[0] > vc1[0])
@@ -616,6 +1039,16 @@ void draw_flat_top_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0, fl
 	int start_y = (int)(ceil(v0.y - 0.5f));
 	int end_y = (int)(ceil(v2.y - 0.5f));
 
+	// Only draw the rows inside the clip rect. Each row is lerped from the
+	// first vertex so this does not change the values of the drawn rows.
+	start_y = max(start_y, clip->y0);
+	end_y = min(end_y, clip->y1);
+
+	if (start_y >= end_y)
+	{
+		return;
+	}
+
 	// Albedo
 	V3 ac0 = v3_read(vc0 + 4);
 	V3 ac1 = v3_read(vc1 + 4);
@@ -694,14 +1127,20 @@ void draw_flat_top_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0, fl
 			lsp_out[index + 7] = lsp1[in_offset + 3] + dlsp_dy[index + 7] * a;
 		}
 
-		draw_scanline(rt, rbs, start_x, end_x, y, z0, z1, start_w, end_w, start_ac, end_ac, start_lc, end_lc, lsp_out, lights_count, depth_maps);
+		draw_visible_scanline(rt, rbs, start_x, end_x, y, z0, z1, start_w, end_w, start_ac, end_ac, start_lc, end_lc, lsp_out, lights_count, depth_maps, clip);
 	}
 }
 
-void draw_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0, float* vc1, float* vc2, float* vc3, int vertex_stride, int lights_count, DepthBuffer* depth_maps)
+void draw_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0, float* vc1, float* vc2, float* vc3, int vertex_stride, int lights_count, DepthBuffer* depth_maps, const Rect* clip)
 {
 	// vc = vertex components
 
+	// Skip the triangle if it's behind everything already drawn where it is.
+	if (triangle_occluded(rt, vc0, vc1, vc2, clip))
+	{
+		return;
+	}
+
 	// Sort vertices in ascending order.
 	if (vc0[1] > vc1[1])
 	{ 
@@ -725,13 +1164,13 @@ void draw_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0, float* vc1,
 	// Handle if the triangle is already flat.
 	if (vc0[1] == vc1[1])
 	{
-		draw_flat_top_triangle(rt, rbs, vc0, vc1, vc2, vertex_stride, lights_count, depth_maps);
+		draw_flat_top_triangle(rt, rbs, vc0, vc1, vc2, vertex_stride, lights_count, depth_maps, clip);
 		return;
 	}
 
 	if (vc1[1] == vc2[1])
 	{
-		draw_flat_bottom_triangle(rt, rbs, vc0, vc1, vc2, vertex_stride, lights_count, depth_maps);
+		draw_flat_bottom_triangle(rt, rbs, vc0, vc1, vc2, vertex_stride, lights_count, depth_maps, clip);
 		return;
 	}
 	
@@ -755,19 +1194,322 @@ void draw_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0, float* vc1,
 		vc3[i] = vc0[i] + (vc2[i] - vc0[i]) * t;
 	}
 
-	draw_flat_top_triangle(rt, rbs, vc1, vc3, vc2, vertex_stride, lights_count, depth_maps);
-	draw_flat_bottom_triangle(rt, rbs, vc0, vc1, vc3, vertex_stride, lights_count, depth_maps);
+	draw_flat_top_triangle(rt, rbs, vc1, vc3, vc2, vertex_stride, lights_count, depth_maps, clip);
+	draw_flat_bottom_triangle(rt, rbs, vc0, vc1, vc3, vertex_stride, lights_count, depth_maps, clip);
 }
 
-void draw_textured_scanline(RenderTarget* rt, int x0, int x1, int y, float z0, float z1, float w0, float w1, const V3 c0, const V3 c1, const V2 uv0, const V2 uv1, const Canvas* texture)
+typedef struct
 {
-	// TODO: Refactor function args.
+	float a, b;		// Change in the edge function per pixel in x and y.
+	float ox, oy;	// The vertex the edge function is evaluated relative to.
+	int top_left;	// Top-left edges own the pixels that lie exactly on them.
 
-	// Precalculate deltas.
-	const unsigned int dx = x1 - x0;
-	float inv_dx = 1.f / dx;
+} EdgeFunction;
 
-	float w_step = (w1 - w0) * inv_dx;
+void edge_function_init(EdgeFunction* ef, const float* v0, const float* v1)
+{
+	// The edge function is always evaluated relative to the same vertex, no 
+	// matter which direction the edge goes, so triangles that share the edge
+	// get exactly opposite values. Otherwise rounding can leave gaps or draw
+	// pixels along the shared edge twice.
+	const float* origin = v0;
+	if (v1[1] < v0[1] || (v1[1] == v0[1] && v1[0] < v0[0]))
+	{
+		origin = v1;
+	}
+
+	ef->a = v0[1] - v1[1];
+	ef->b = v1[0] - v0[0];
+	ef->ox = origin[0];
+	ef->oy = origin[1];
+
+	// Inside is positive, and y points down, so a left edge goes up and a top 
+	// edge goes right.
+	ef->top_left = ef->a > 0 || (ef->a == 0 && ef->b > 0);
+}
+
+inline float edge_function_evaluate(const EdgeFunction* ef, float x, float y)
+{
+	return ef->a * (x - ef->ox) + ef->b * (y - ef->oy);
+}
+
+inline int edge_function_inside(const EdgeFunction* ef, float e)
+{
+	return e > 0 || (e == 0 && ef->top_left);
+}
+
+void draw_triangle_half_space(RenderTarget* rt, RenderBuffers* rbs, const float* vc0, const float* vc1, const float* vc2, int vertex_stride, int lights_count, DepthBuffer* depth_maps, const Rect* clip)
+{
+	// Make the winding consistent so the inside of every edge is positive.
+	float area = (vc1[0] - vc0[0]) * (vc2[1] - vc0[1]) - (vc1[1] - vc0[1]) * (vc2[0] - vc0[0]);
+	if (area == 0)
+	{
+		return;
+	}
+
+	if (triangle_occluded(rt, vc0, vc1, vc2, clip))
+	{
+		return;
+	}
+
+	if (area < 0)
+	{
+		const float* temp = vc1;
+		vc1 = vc2;
+		vc2 = temp;
+		area = -area;
+	}
+
+	// Each edge function is the barycentric weight of the opposite vertex, 
+	// scaled by the area.
+	EdgeFunction e0, e1, e2;
+	edge_function_init(&e0, vc1, vc2);
+	edge_function_init(&e1, vc2, vc0);
+	edge_function_init(&e2, vc0, vc1);
+
+	const float inv_area = 1.f / area;
+
+	// Find the pixels whose centres could be inside the triangle.
+	const float min_x = min(min(vc0[0], vc1[0]), vc2[0]);
+	const float max_x = max(max(vc0[0], vc1[0]), vc2[0]);
+	const float min_y = min(min(vc0[1], vc1[1]), vc2[1]);
+	const float max_y = max(max(vc0[1], vc1[1]), vc2[1]);
+
+	const int px0 = max((int)ceilf(min_x - 0.5f), clip->x0);
+	const int px1 = min((int)floorf(max_x - 0.5f) + 1, clip->x1);
+	const int py0 = max((int)ceilf(min_y - 0.5f), clip->y0);
+	const int py1 = min((int)floorf(max_y - 0.5f) + 1, clip->y1);
+
+	if (px0 >= px1 || py0 >= py1)
+	{
+		return;
+	}
+
+	// Plane equations for z and 1/w.
+	const float dzdx = ((vc1[2] - vc0[2]) * e1.a + (vc2[2] - vc0[2]) * e2.a) * inv_area;
+	const float dzdy = ((vc1[2] - vc0[2]) * e1.b + (vc2[2] - vc0[2]) * e2.b) * inv_area;
+	const float dwdx = ((vc1[3] - vc0[3]) * e1.a + (vc2[3] - vc0[3]) * e2.a) * inv_area;
+	const float dwdy = ((vc1[3] - vc0[3]) * e1.b + (vc2[3] - vc0[3]) * e2.b) * inv_area;
+
+	// Plane equations for the rest of the attributes, these have already been
+	// multiplied by 1/w so are linear in screen space.
+	V3 ac0 = v3_read(vc0 + 4);
+	V3 acdx = v3_mul_f(v3_add_v3(v3_mul_f(v3_sub_v3(v3_read(vc1 + 4), ac0), e1.a), v3_mul_f(v3_sub_v3(v3_read(vc2 + 4), ac0), e2.a)), inv_area);
+	V3 acdy = v3_mul_f(v3_add_v3(v3_mul_f(v3_sub_v3(v3_read(vc1 + 4), ac0), e1.b), v3_mul_f(v3_sub_v3(v3_read(vc2 + 4), ac0), e2.b)), inv_area);
+
+	V3 lc0 = v3_read(vc0 + 7);
+	V3 lcdx = v3_mul_f(v3_add_v3(v3_mul_f(v3_sub_v3(v3_read(vc1 + 7), lc0), e1.a), v3_mul_f(v3_sub_v3(v3_read(vc2 + 7), lc0), e2.a)), inv_area);
+	V3 lcdy = v3_mul_f(v3_add_v3(v3_mul_f(v3_sub_v3(v3_read(vc1 + 7), lc0), e1.b), v3_mul_f(v3_sub_v3(v3_read(vc2 + 7), lc0), e2.b)), inv_area);
+
+	// The light space positions depend on the number of lights so they are 
+	// stored in the buffers as { d/dx, d/dy } pairs.
+	const int lsps_count = lights_count * STRIDE_V4;
+	float* lsp_gradients = rbs->light_space_pos_gradients;
+	float* lsp_row_values = rbs->row_light_space_positions;
+
+	for (int i = 0; i < lsps_count; ++i)
+	{
+		const float da1 = vc1[10 + i] - vc0[10 + i];
+		const float da2 = vc2[10 + i] - vc0[10 + i];
+
+		lsp_gradients[i * 2 + 0] = (da1 * e1.a + da2 * e2.a) * inv_area;
+		lsp_gradients[i * 2 + 1] = (da1 * e1.b + da2 * e2.b) * inv_area;
+	}
+
+	// TODO: TEMP: HARdcoeded
+	V3 ambient = { 0.1, 0.1, 0.1 };
+
+	const int width = rt->canvas.width;
+
+	// Walk the bounding box in blocks. The blocks are aligned to the screen rather 
+	// than the bounding box, so the values for a pixel don't depend on the clip rect.
+	for (int by = py0 & ~(HALF_SPACE_BLOCK_SIZE - 1); by < py1; by += HALF_SPACE_BLOCK_SIZE)
+	{
+		const int y_start = max(by, py0);
+		const int y_end = min(by + HALF_SPACE_BLOCK_SIZE, py1);
+
+		for (int bx = px0 & ~(HALF_SPACE_BLOCK_SIZE - 1); bx < px1; bx += HALF_SPACE_BLOCK_SIZE)
+		{
+			const int x_start = max(bx, px0);
+			const int x_end = min(bx + HALF_SPACE_BLOCK_SIZE, px1);
+
+			// The edge functions are linear, so testing the corners of the block
+			// is enough to know if the whole block is inside or outside an edge.
+			const float block_x = bx + 0.5f;
+			const float top_y = y_start + 0.5f;
+			const float bottom_y = (y_end - 1) + 0.5f;
+			const float left_t = (float)(x_start - bx);
+			const float right_t = (float)(x_end - 1 - bx);
+
+			int accept = 1;
+			int reject = 0;
+
+			const EdgeFunction* edges[3] = { &e0, &e1, &e2 };
+			for (int i = 0; i < 3; ++i)
+			{
+				const EdgeFunction* ef = edges[i];
+				const float top = edge_function_evaluate(ef, block_x, top_y);
+				const float bottom = edge_function_evaluate(ef, block_x, bottom_y);
+
+				const float c0 = top + ef->a * left_t;
+				const float c1 = top + ef->a * right_t;
+				const float c2 = bottom + ef->a * left_t;
+				const float c3 = bottom + ef->a * right_t;
+
+				if (c0 < 0 && c1 < 0 && c2 < 0 && c3 < 0)
+				{
+					reject = 1;
+					break;
+				}
+
+				if (c0 <= 0 || c1 <= 0 || c2 <= 0 || c3 <= 0)
+				{
+					accept = 0;
+				}
+			}
+
+			if (reject)
+			{
+				continue;
+			}
+
+			// Skip the block if the triangle is behind everything drawn in it. z is
+			// linear, so the closest is at one of the corners.
+			const float z_top = vc0[2] + dzdx * (block_x - vc0[0]) + dzdy * (top_y - vc0[1]);
+			const float z_bottom = vc0[2] + dzdx * (block_x - vc0[0]) + dzdy * (bottom_y - vc0[1]);
+
+			const float block_min_z = min(
+				min(z_top + dzdx * left_t, z_top + dzdx * right_t),
+				min(z_bottom + dzdx * left_t, z_bottom + dzdx * right_t));
+
+			if (depth_tiles_occluded(rt, x_start, y_start, x_end, y_end, block_min_z))
+			{
+				continue;
+			}
+
+			for (int y = y_start; y < y_end; ++y)
+			{
+				const float pixel_y = y + 0.5f;
+
+				// Evaluate the row from the block's origin and step across it.
+				const float e0_row = edge_function_evaluate(&e0, block_x, pixel_y);
+				const float e1_row = edge_function_evaluate(&e1, block_x, pixel_y);
+				const float e2_row = edge_function_evaluate(&e2, block_x, pixel_y);
+
+				const float ox = block_x - vc0[0];
+				const float oy = pixel_y - vc0[1];
+
+				const float z_row = vc0[2] + dzdx * ox + dzdy * oy;
+				const float w_row = vc0[3] + dwdx * ox + dwdy * oy;
+
+				const V3 ac_row = v3_add_v3(ac0, v3_add_v3(v3_mul_f(acdx, ox), v3_mul_f(acdy, oy)));
+				const V3 lc_row = v3_add_v3(lc0, v3_add_v3(v3_mul_f(lcdx, ox), v3_mul_f(lcdy, oy)));
+
+				// The light space positions for the row are only needed if a pixel
+				// passes the depth test.
+				int lsp_row_ready = 0;
+				int row_written = 0;
+
+				unsigned int* pixels = rt->canvas.pixels + y * width;
+				float* depth_buffer = rt->depth_buffer + y * width;
+
+				for (int x = x_start; x < x_end; ++x)
+				{
+					const float t = (float)(x - bx);
+
+					if (!accept &&
+						!(edge_function_inside(&e0, e0_row + e0.a * t) &&
+						  edge_function_inside(&e1, e1_row + e1.a * t) &&
+						  edge_function_inside(&e2, e2_row + e2.a * t)))
+					{
+						continue;
+					}
+
+					// Depth test, only draw closer values.
+					const float z = z_row + dzdx * t;
+					if (depth_buffer[x] <= z)
+					{
+						continue;
+					}
+
+					if (!lsp_row_ready)
+					{
+						for (int i = 0; i < lsps_count; ++i)
+						{
+							lsp_row_values[i] = vc0[10 + i] + lsp_gradients[i * 2 + 0] * ox + lsp_gradients[i * 2 + 1] * oy;
+						}
+
+						lsp_row_ready = 1;
+					}
+
+					// Recover w
+					const float w = 1.0f / (w_row + dwdx * t);
+
+					float albedo_r = (ac_row.x + acdx.x * t) * w;
+					float albedo_g = (ac_row.y + acdx.y * t) * w;
+					float albedo_b = (ac_row.z + acdx.z * t) * w;
+
+					int shadow = 0;
+
+					for (int j = 0; j < lights_count; ++j)
+					{
+						const int lsp_i = j * STRIDE_V4;
+
+						V4 projected = {
+							(lsp_row_values[lsp_i + 0] + lsp_gradients[(lsp_i + 0) * 2] * t) * w,
+							(lsp_row_values[lsp_i + 1] + lsp_gradients[(lsp_i + 1) * 2] * t) * w,
+							(lsp_row_values[lsp_i + 2] + lsp_gradients[(lsp_i + 2) * 2] * t) * w,
+							(lsp_row_values[lsp_i + 3] + lsp_gradients[(lsp_i + 3) * 2] * t) * w
+						};
+
+						const int result = shadow_map_test(projected, &depth_maps[j]);
+						if (1 == result)
+						{
+							shadow = 1;
+						}
+						else if (0 == result)
+						{
+							shadow = 0;
+							break;
+						}
+					}
+
+					if (shadow)
+					{
+						// Apply only the ambient.
+						pixels[x] = float_rgb_to_int(albedo_r * ambient.x, albedo_g * ambient.y, albedo_b * ambient.z);
+					}
+					else
+					{
+						float light_r = ((lc_row.x + lcdx.x * t) * w) * albedo_r;
+						float light_g = ((lc_row.y + lcdx.y * t) * w) * albedo_g;
+						float light_b = ((lc_row.z + lcdx.z * t) * w) * albedo_b;
+
+						pixels[x] = float_rgb_to_int(light_r, light_g, light_b);
+					}
+
+					depth_buffer[x] = z;
+					row_written = 1;
+				}
+
+				if (row_written)
+				{
+					depth_tiles_update(rt, x_start, x_end, y);
+				}
+			}
+		}
+	}
+}
+
+void draw_textured_scanline(RenderTarget* rt, int x0, int x1, int y, float z0, float z1, float w0, float w1, const V3 c0, const V3 c1, const V2 uv0, const V2 uv1, const Canvas* texture)
+{
+	// TODO: Refactor function args.
+
+	// Precalculate deltas.
+	const unsigned int dx = x1 - x0;
+	float inv_dx = 1.f / dx;
+
+	float w_step = (w1 - w0) * inv_dx;
 
 	// Offset x by the given y.
 	int row_offset = rt->canvas.width * y;
@@ -1059,11 +1801,24 @@ void draw_textured_triangle(RenderTarget* rt, V4 v0, V4 v1, V4 v2, V3 c0, V3 c1,
 
 void draw_depth_scanline(DepthBuffer* db, int x0, int x1, int y, float z0, float z1)
 {
-	if (x0 == x1) return;
+	if (x0 >= x1 || y < 0 || y >= db->height) return;
 
 	// Precalculate deltas.
+	float inv_dx = 1.f / (x1 - x0);
+	float z_step = (z1 - z0) * inv_dx;
+
+	// Only draw the part of the scanline inside the depth buffer.
+	if (x0 < 0)
+	{
+		z0 -= z_step * x0;
+		x0 = 0;
+	}
+
+	x1 = min(x1, db->width);
+
+	if (x0 >= x1) return;
+
 	const unsigned int dx = x1 - x0;
-	float inv_dx = 1.f / dx;
 
 	// Offset x by the given y.
 	int row_offset = db->width * y;
@@ -1075,7 +1830,6 @@ void draw_depth_scanline(DepthBuffer* db, int x0, int x1, int y, float z0, float
 	float* depth_buffer = db->data + start_x;
 
 	float z = z0;
-	float z_step = (z1 - z0) * inv_dx;
 
 	for (unsigned int i = 0; i < dx; ++i)
 	{
@@ -1120,6 +1874,10 @@ void draw_depth_flat_bottom_triangle(DepthBuffer* db, V4 v0, V4 v1, V4 v2)
 	int yStart = (int)(ceil(v0.y - 0.5f));
 	int yEnd = (int)(ceil(v2.y - 0.5f));
 
+	// Only loop over the rows inside the depth buffer.
+	yStart = max(yStart, 0);
+	yEnd = min(yEnd, db->height);
+
 	for (int y = yStart; y < yEnd; ++y) {
 		// Must lerp for the vertex attributes otherwise the accuracy is poor.
 		// TODO: Would be nice to not have to actually lerp but step instead.
@@ -1165,6 +1923,10 @@ void draw_depth_flat_top_triangle(DepthBuffer* db, V4 v0, V4 v1, V4 v2)
 	int yStart = (int)(ceil(v0.y - 0.5f));
 	int yEnd = (int)(ceil(v2.y - 0.5f));
 
+	// Only loop over the rows inside the depth buffer.
+	yStart = max(yStart, 0);
+	yEnd = min(yEnd, db->height);
+
 	for (int y = yStart; y < yEnd; ++y) {
 		// Must lerp for the vertex attributes to get them accurately.
 		// TODO: Would be nice to find a way to step not lerp.
@@ -1256,6 +2018,50 @@ float calculate_diffuse_factor(const V3 v, const V3 n, const V3 light_pos, float
 	return dp;
 }
 
+V3 calculate_vertex_diffuse(const PointLights* point_lights, V3 position, V3 normal)
+{
+	// The total diffuse light the vertex receives.
+	V3 diffuse_part = { 0, 0, 0 };
+
+	// For each light
+	for (int i_light = 0; i_light < point_lights->count; ++i_light)
+	{
+		// Read the light's properties.
+		const V3 light_pos = v3_read(point_lights->view_space_positions + i_light * STRIDE_POSITION);
+
+		int i_light_attr = i_light * STRIDE_POINT_LIGHT_ATTRIBUTES;
+		V3 light_colour = v3_read(point_lights->attributes + i_light_attr);
+		float strength = point_lights->attributes[i_light_attr + 3];
+
+		float a = 0.1f / strength;
+		float b = 0.01f / strength;
+
+		float df = calculate_diffuse_factor(position, normal, light_pos, a, b);
+
+		v3_mul_eq_f(&light_colour, df);
+		v3_add_eq_v3(&diffuse_part, light_colour);
+	}
+
+	return diffuse_part;
+}
+
+V3 calculate_vertex_light(V3 albedo, V3 diffuse, V3 ambient_light)
+{
+	// Clamp diffuse contribution to a valid range 0-1. 
+	V3 light = {
+		albedo.x * (diffuse.x + ambient_light.x),
+		albedo.y * (diffuse.y + ambient_light.y),
+		albedo.z * (diffuse.z + ambient_light.z)
+	};
+
+	// Clamp to max, should never be negative.
+	light.x = min(1.f, light.x);
+	light.y = min(1.f, light.y);
+	light.z = min(1.f, light.z);
+
+	return light;
+}
+
 void project(const Canvas* canvas, const M4 projection_matrix, V4 v, V4* out)
 {
 	// Opengl uses a right handed coordinate system, camera looks down the -z axis,
@@ -1294,105 +2100,104 @@ void project(const Canvas* canvas, const M4 projection_matrix, V4 v, V4* out)
 	out->w = inv_w;
 }
 
-void model_to_view_space(Models* models, const M4 view_matrix)
+void world_space_frustum_culling(Models* models, const ViewFrustum* world_frustum)
 {
-	// Combines the model and view matrices.
-	// Calculates the new radius of the bounding sphere.
+	// Culls the instances whose world space bounding sphere is completely outside
+	// of the frustum, so they can skip being transformed to view space. The 
+	// spheres are only used to reject instances and skip planes they're inside of,
+	// broad_phase_frustum_culling still works out the planes to clip against from
+	// the tighter view space sphere.
+	if (models->bvh.dirty)
+	{
+		instance_bvh_build(&models->bvh, models->mis_world_bounding_spheres, models->mis_count);
+	}
 
-	const int mis_count = models->mis_count;
+	instance_bvh_cull(&models->bvh, world_frustum, models->mis_passed_broad_phase_flags, models->mis_frustum_plane_masks);
+}
 
+void model_to_view_space_range(Models* models, const M4 view_matrix, int begin, int end)
+{
+	// Combines the model and view matrices.
+	// Calculates the new radius of the bounding sphere.
 	const float* mis_transforms = models->mis_transforms;
+	const float* mis_model_matrices = models->mis_model_matrices;
+	float* mis_normal_matrices = models->mis_normal_matrices;
+	int* mis_dirty_normal_matrix_flags = models->mis_dirty_normal_matrix_flags;
 
 	const int* mis_base_ids = models->mis_base_ids;
+	const int* mis_positions_offsets = models->mis_positions_offsets;
+	const int* mis_passed_broad_phase_flags = models->mis_passed_broad_phase_flags;
 	int* mis_dirty_bounding_sphere_flags = models->mis_dirty_bounding_sphere_flags;
 
 	const int* mbs_positions_counts = models->mbs_positions_counts;
 	const int* mbs_positions_offsets = models->mbs_positions_offsets;
-	const int* mbs_normals_counts = models->mbs_normals_counts;
-	const int* mbs_normals_offsets = models->mbs_normals_offsets;
 
 	const float* object_space_positions = models->mbs_object_space_positions;
-	const float* object_space_normals = models->mbs_object_space_normals;
 	const float* object_space_centres = models->mbs_object_space_centres;
 
 	float* view_space_positions = models->view_space_positions;
-	float* view_space_normals = models->view_space_normals;
 
 	float* mis_bounding_spheres = models->mis_bounding_spheres;
+	float* mis_model_view_matrices = models->mis_model_view_matrices;
+	float* mis_view_normal_matrices = models->mis_view_normal_matrices;
+	const int* mis_occluder_flags = models->mis_occluder_flags;
 
 	// TODO: For some of this I could probably put in {} to let some go out of scope?
-	int vsp_out_index = 0;
-	int vsn_out_index = 0;
 
 	// TODO: Rename vars.
 
-	for (int i = 0; i < mis_count; ++i)
+	for (int i = begin; i < end; ++i)
 	{
+		// Skip the instances that were culled in world space, the later stages 
+		// won't read their view space data.
+		if (!mis_passed_broad_phase_flags[i])
+		{
+			continue;
+		}
+
 		// Convert the model base object space positions to world space
 		// for the current model instance.
 		const int mb_index = mis_base_ids[i];
 		const int mb_positions_count = mbs_positions_counts[mb_index];
-		const int normals_count = mbs_normals_counts[mb_index];
 
-		// Calculate the new model/normal matrix from the mi's transform.
-		int transform_index = i * STRIDE_MI_TRANSFORM;
+		// The model matrix is cached when the transform is set, the normal 
+		// matrix is only rebuilt if the transform changed since it was last used.
+		const float* model_matrix = mis_model_matrices + i * STRIDE_M4;
+		float* normal_matrix = mis_normal_matrices + i * STRIDE_M4;
 
-		V3 position = v3_read(mis_transforms + transform_index);
-		V3 eulers = v3_read(mis_transforms + transform_index + 3);
-		V3 scale = v3_read(mis_transforms + transform_index + 6);
+		if (mis_dirty_normal_matrix_flags[i])
+		{
+			const int transform_index = i * STRIDE_MI_TRANSFORM;
+
+			m4_normal_matrix(
+				v3_read(mis_transforms + transform_index + 3), 
+				v3_read(mis_transforms + transform_index + 6), 
+				normal_matrix
+			);
 
-		M4 model_matrix;
-		m4_model_matrix(position, eulers, scale, model_matrix);
+			mis_dirty_normal_matrix_flags[i] = 0;
+		}
 
 		M4 model_view_matrix;
 		m4_mul_m4(view_matrix, model_matrix, model_view_matrix);
 
-		M4 normal_matrix;
-		m4_normal_matrix(eulers, scale, normal_matrix);
-
 		M4 view_normal_matrix;
 		m4_mul_m4(view_matrix, normal_matrix, view_normal_matrix);
 
 
 
-		// Store the initial out index so we can iterate over the 
-		// wsp later when calculating the radius of the bounding sphere.
-		const int start_vsp_out_index = vsp_out_index;
+		// Keep the matrices so cull_backfaces can transform the positions and 
+		// normals of the front faces on demand.
+		memcpy(mis_model_view_matrices + i * STRIDE_M4, model_view_matrix, sizeof(M4));
+		memcpy(mis_view_normal_matrices + i * STRIDE_M4, view_normal_matrix, sizeof(M4));
 
 		const int mb_positions_offset = mbs_positions_offsets[mb_index];
 
-		for (int j = 0; j < mb_positions_count; ++j)
-		{
-			int index_object_space_position = (j + mb_positions_offset) * STRIDE_POSITION;
-
-			V4 object_space_position = v3_read_to_v4(object_space_positions + index_object_space_position, 1.f);
-
-			V4 view_space_position; 
-			m4_mul_v4(model_view_matrix, object_space_position, &view_space_position);
-
-			view_space_positions[vsp_out_index++] = view_space_position.x;
-			view_space_positions[vsp_out_index++] = view_space_position.y;
-			view_space_positions[vsp_out_index++] = view_space_position.z;
-		}
-
-		// TODO: Only convert the normals after backface culling? We don't need them until lighting.
-		//		 Make a function, model_normals_to_view_space.
-
-		// Do the same for normals.		
-		const int mb_normals_offset = mbs_normals_offsets[mb_index];
-
-		for (int j = 0; j < normals_count; ++j)
+		// Occluders are drawn before backface culling, so they need all their
+		// positions.
+		if (mis_occluder_flags[i])
 		{
-			int index_object_space_normals = (j + mb_normals_offset) * STRIDE_NORMAL;
-
-			V4 object_space_normal = v3_read_to_v4(object_space_normals + index_object_space_normals, 0.f);
-
-			// TODO: Kinda messy.
-			V4 view_space_normal;
-			m4_mul_v4(view_normal_matrix, object_space_normal, &view_space_normal);
-
-			v3_write(view_space_normals + vsn_out_index, normalised(v4_xyz(view_space_normal)));
-			vsn_out_index += 3;
+			m4_mul_positions(model_view_matrix, object_space_positions + mb_positions_offset * STRIDE_POSITION, mb_positions_count, view_space_positions + mis_positions_offsets[i] * STRIDE_POSITION);
 		}
 
 		// Update the mi's bounding sphere.
@@ -1401,7 +2206,6 @@ void model_to_view_space(Models* models, const M4 view_matrix)
 		// Convert the model base centre to view space for the instance.
 		V4 vs_centre;
 		m4_mul_v4(model_view_matrix, centre, &vs_centre);
-		V3 vs_centre_v3 = v4_xyz(vs_centre);
 		
 		const int bs_index = i * STRIDE_SPHERE;
 		mis_bounding_spheres[bs_index] = vs_centre.x;
@@ -1414,14 +2218,19 @@ void model_to_view_space(Models* models, const M4 view_matrix)
 		{
 			mis_dirty_bounding_sphere_flags[i] = 0;
 
-			// Calculate the new radius of the mi's bounding sphere.
+			// Calculate the new radius of the mi's bounding sphere. The view 
+			// matrix doesn't scale, so only the instance's scale changes the 
+			// distances from the centre, there's no need to transform the positions.
 			float radius_squared = -1;
 
-			for (int j = start_vsp_out_index; j < vsp_out_index; j += STRIDE_POSITION)
+			const V3 mb_centre = v4_xyz(centre);
+			const V3 scale = v3_read(mis_transforms + i * STRIDE_MI_TRANSFORM + 6);
+
+			for (int j = 0; j < mb_positions_count; ++j)
 			{
-				V3 v = v3_read(view_space_positions + j);
+				V3 v = v3_read(object_space_positions + (j + mb_positions_offset) * STRIDE_POSITION);
 
-				V3 between = v3_sub_v3(v, vs_centre_v3);
+				V3 between = v3_mul_v3(v3_sub_v3(v, mb_centre), scale);
 
 				radius_squared = max(size_squared(between), radius_squared);
 			}
@@ -1432,6 +2241,11 @@ void model_to_view_space(Models* models, const M4 view_matrix)
 	}
 }
 
+void model_to_view_space(Models* models, const M4 view_matrix)
+{
+	model_to_view_space_range(models, view_matrix, 0, models->mis_count);
+}
+
 void lights_world_to_view_space(PointLights* point_lights, const M4 view_matrix)
 {
 	// Transform the world space light positions.
@@ -1453,24 +2267,28 @@ void lights_world_to_view_space(PointLights* point_lights, const M4 view_matrix)
 	}
 }
 
-void broad_phase_frustum_culling(Models* models, const ViewFrustum* view_frustum)
+void broad_phase_frustum_culling_range(Models* models, const ViewFrustum* view_frustum, const ViewFrustum* guard_band_frustum, int begin, int end)
 {
 	// Performs broad phase frustum culling on the models, writes out the planes
 	// that can need to be clipped against.
-	const int mis_count = models->mis_count;
 	const float* bounding_spheres = models->mis_bounding_spheres;
 
-	// Should be wrote out in the 
 	int* intersected_planes = models->mis_intersected_planes;
-	int intersected_planes_out_index = 0;
 	int* passed_broad_phase_flags = models->mis_passed_broad_phase_flags;
+	const int* frustum_plane_masks = models->mis_frustum_plane_masks;
 
 	const int planes_count = view_frustum->planes_count;
 	const Plane* planes = view_frustum->planes;
 
 	// Perform frustum culling per model instance.
-	for (int i = 0; i < mis_count; ++i)
+	for (int i = begin; i < end; ++i)
 	{
+		// Already culled in world space.
+		if (!passed_broad_phase_flags[i])
+		{
+			continue;
+		}
+
 		// Perform board phase bounding sphere check against each plane.
 		int index_bounding_sphere = i * STRIDE_SPHERE;
 
@@ -1489,9 +2307,17 @@ void broad_phase_frustum_culling(Models* models, const ViewFrustum* view_frustum
 		int clip_against_plane[MAX_FRUSTUM_PLANES] = { 0 };
 		int num_planes_to_clip_against = 0;
 
-		// Broad phase bounding sphere test.
+		// Broad phase bounding sphere test. Only the planes that the world space
+		// sphere intersects need testing, the view space sphere is inside it.
+		const int plane_mask = frustum_plane_masks[i];
+
 		for (int j = 0; j < planes_count; ++j)
 		{
+			if (!(plane_mask & (1 << j)))
+			{
+				continue;
+			}
+
 			float dist = signed_distance(&planes[j], view_space_centre);
 			if (dist < -radius)
 			{
@@ -1501,6 +2327,14 @@ void broad_phase_frustum_culling(Models* models, const ViewFrustum* view_frustum
 			}
 			else if (dist < radius)
 			{
+				// The rasteriser scissors the triangles that cross a side plane,
+				// so they only need clipping if they can leave the guard band.
+				if (guard_band_frustum && j >= FRUSTUM_PLANE_RIGHT &&
+					signed_distance(&guard_band_frustum->planes[j], view_space_centre) >= radius)
+				{
+					continue;
+				}
+
 				// Mark that we need to clip against this plane.
 				clip_against_plane[num_planes_to_clip_against] = j;
 				++num_planes_to_clip_against;
@@ -1521,109 +2355,359 @@ void broad_phase_frustum_culling(Models* models, const ViewFrustum* view_frustum
 
 			// Write out for narrow phase to use.
 			// In format: num_planes_intersecting, plane_index_0, plane_index_1, ...
-			intersected_planes[intersected_planes_out_index++] = num_planes_to_clip_against;
+			int* mi_intersected_planes = intersected_planes + i * STRIDE_INTERSECTED_PLANES;
+			mi_intersected_planes[0] = num_planes_to_clip_against;
 
 			for (int j = 0; j < num_planes_to_clip_against; ++j)
 			{
-				intersected_planes[intersected_planes_out_index++] = clip_against_plane[j];
+				mi_intersected_planes[j + 1] = clip_against_plane[j];
 			}
 		}
 	}
 }
 
-void cull_backfaces(Renderer* renderer, const Scene* scene)
+void broad_phase_frustum_culling(Models* models, const ViewFrustum* view_frustum, const ViewFrustum* guard_band_frustum)
 {
-	// TODO: Would it be quicker to copy or not.
-	Models* models = &scene->models;
-	int shadow_maps_count = scene->point_lights.count;
+	broad_phase_frustum_culling_range(models, view_frustum, guard_band_frustum, 0, models->mis_count);
+}
 
+void occlusion_culling(Renderer* renderer, Models* models)
+{
+	OcclusionBuffer* ob = &renderer->occlusion_buffer;
+	const RenderSettings* settings = &renderer->settings;
 
-	// TODO: Also, does a step like backface culling gain anything from doing it all at once?
+	const int mis_count = models->mis_count;
 
-	const int* passed_broad_phase_flags = models->mis_passed_broad_phase_flags;
+	int* passed_broad_phase_flags = models->mis_passed_broad_phase_flags;
+	const int* occluder_flags = models->mis_occluder_flags;
 
-	const int* mbs_positions_counts = models->mbs_positions_counts;
-	const int* mbs_normals_counts = models->mbs_normals_counts;
+	const int* mis_positions_offsets = models->mis_positions_offsets;
 	const int* mbs_faces_offsets = models->mbs_faces_offsets;
-	const int* mbs_uvs_offsets = models->mbs_uvs_offsets;
 	const int* mbs_faces_counts = models->mbs_faces_counts;
-
 	const int* face_position_indices = models->mbs_face_position_indices;
-	const int* face_normal_indices = models->mbs_face_normal_indices;
-	const int* face_uvs_indices = models->mbs_face_uvs_indices;
-	
-	const float* view_space_positions = models->view_space_positions;
-	const float* view_space_normals = models->view_space_normals;
-	const float* uvs = models->mbs_uvs;
-	
-	float* front_faces = renderer->buffers.front_faces;
-	int* front_faces_counts = renderer->buffers.front_faces_counts;
-
-	float* light_space_front_faces = renderer->buffers.front_face_light_space_positions;
-	const float* light_space_positions = renderer->buffers.light_space_positions;
 
+	const float* view_space_positions = models->view_space_positions;
 
-	const float* vertex_colours = models->mis_vertex_colours;
+	occlusion_buffer_clear(ob);
 
-	int face_offset = 0;
-	int front_face_out = 0;
-	int light_space_front_face_out = 0;
-	int positions_offset = 0;
-	int normals_offset = 0;
-	int uvs_offset = 0;
+	// Draw the front faces of the occluders that passed the broad phase.
+	int occluders_count = 0;
 
-	for (int i = 0; i < models->mis_count; ++i)
+	for (int i = 0; i < mis_count; ++i)
 	{
-		const int mb_index = models->mis_base_ids[i];
-
-		// Only need to do backface culling if the mi passed the broad phase.
-		if (!passed_broad_phase_flags[i])
+		if (passed_broad_phase_flags[i] && occluder_flags[i])
 		{
-			front_faces_counts[i] = 0;
+			const int mb_index = models->mis_base_ids[i];
+			const int positions_offset = mis_positions_offsets[i];
 
-			// Update the offsets for per instance data.
-			positions_offset += mbs_positions_counts[mb_index];
-			normals_offset += mbs_normals_counts[mb_index];
-
-			continue;
-		}
+			for (int j = 0; j < mbs_faces_counts[mb_index]; ++j)
+			{
+				const int face_index = (mbs_faces_offsets[mb_index] + j) * STRIDE_FACE_VERTICES;
 
-		// Get the offsets for the buffers that are not instance specific.
-		const int mb_faces_offset = mbs_faces_offsets[mb_index];
-		const int mb_uvs_offset = mbs_uvs_offsets[mb_index];
+				const V3 v0 = v3_read(view_space_positions + (face_position_indices[face_index] + positions_offset) * STRIDE_POSITION);
+				const V3 v1 = v3_read(view_space_positions + (face_position_indices[face_index + 1] + positions_offset) * STRIDE_POSITION);
+				const V3 v2 = v3_read(view_space_positions + (face_position_indices[face_index + 2] + positions_offset) * STRIDE_POSITION);
 
-		int front_face_count = 0;
+				// Back faces aren't drawn, so they can't hide anything.
+				if (is_front_face(v0, v1, v2))
+				{
+					occlusion_buffer_draw_triangle(ob, settings->projection_matrix, settings->near_plane, v0, v1, v2);
+				}
+			}
 
-		for (int j = 0; j < mbs_faces_counts[mb_index]; ++j)
-		{
-			const int face_index = (mb_faces_offset + j) * STRIDE_FACE_VERTICES;
+			++occluders_count;
+		}
+	}
 
-			// Get the indices to the first component of each vertex position.
-			const int index_v0 = face_position_indices[face_index] + positions_offset;
-			const int index_v1 = face_position_indices[face_index + 1] + positions_offset;
-			const int index_v2 = face_position_indices[face_index + 2] + positions_offset;
+	if (0 == occluders_count)
+	{
+		return;
+	}
 
-			const int index_parts_v0 = index_v0 * STRIDE_POSITION;
-			const int index_parts_v1 = index_v1 * STRIDE_POSITION;
-			const int index_parts_v2 = index_v2 * STRIDE_POSITION;
+	occlusion_buffer_build_pyramid(ob);
 
-			// Get the vertices from the face indices.
-			const V3 v0 = v3_read(view_space_positions + index_parts_v0);
-			const V3 v1 = v3_read(view_space_positions + index_parts_v1);
-			const V3 v2 = v3_read(view_space_positions + index_parts_v2);
+	// Test the instances against the occluders.
+	const float* bounding_spheres = models->mis_bounding_spheres;
+
+	for (int i = 0; i < mis_count; ++i)
+	{
+		if (!passed_broad_phase_flags[i])
+		{
+			continue;
+		}
+
+		const int bs_index = i * STRIDE_SPHERE;
+		const V3 centre = v3_read(bounding_spheres + bs_index);
+		const float radius = bounding_spheres[bs_index + 3];
+
+		if (!occlusion_buffer_test_sphere(ob, settings->projection_matrix, settings->near_plane, centre, radius))
+		{
+			passed_broad_phase_flags[i] = 0;
+		}
+	}
+}
+
+MeshletVisibility classify_meshlet(const float* sphere, const float* cone, V3 camera_position, float winding, const float* model_view_matrix, float max_scale, const Plane* view_planes, const Plane* clip_planes, const int* plane_indices, int planes_count)
+{
+	if (meshlet_cone_culled(sphere, cone, camera_position, winding))
+	{
+		return MESHLET_CULLED;
+	}
+
+	// Nothing to clip against, so the sphere doesn't need transforming.
+	if (0 == planes_count)
+	{
+		return MESHLET_INSIDE;
+	}
+
+	V4 view_space_centre;
+	m4_mul_v4(model_view_matrix, v3_read_to_v4(sphere, 1.f), &view_space_centre);
+
+	const V3 centre = { view_space_centre.x, view_space_centre.y, view_space_centre.z };
+	const float radius = sphere[3] * max_scale;
+
+	MeshletVisibility visibility = MESHLET_INSIDE;
+
+	for (int i = 0; i < planes_count; ++i)
+	{
+		const int plane_index = plane_indices[i];
+
+		// The guard band planes are outside the view planes, so the meshlet can
+		// be culled by the view plane even if it only needs clipping against the
+		// guard band.
+		if (signed_distance(&view_planes[plane_index], centre) < -radius)
+		{
+			return MESHLET_CULLED;
+		}
+
+		if (signed_distance(&clip_planes[plane_index], centre) < radius)
+		{
+			visibility = MESHLET_CLIPPED;
+		}
+	}
+
+	return visibility;
+}
+
+void cull_instance_backfaces(Renderer* renderer, const Scene* scene, int mi_index, const int* plane_indices, int planes_count, int positions_transformed, InstanceBuffers* ib)
+{
+	const Models* models = &scene->models;
+	const int shadow_maps_count = scene->point_lights.count;
+
+	const int mb_index = models->mis_base_ids[mi_index];
+
+	const int* mbs_positions_counts = models->mbs_positions_counts;
+	const int* mbs_normals_counts = models->mbs_normals_counts;
+	const int* mbs_faces_offsets = models->mbs_faces_offsets;
+	const int* mbs_uvs_offsets = models->mbs_uvs_offsets;
+	const int* mbs_faces_counts = models->mbs_faces_counts;
+
+	const int* face_position_indices = models->mbs_face_position_indices;
+	const int* face_normal_indices = models->mbs_face_normal_indices;
+	const int* face_uvs_indices = models->mbs_face_uvs_indices;
+	
+	const float* object_space_positions = models->mbs_object_space_positions;
+	const float* face_planes = models->mbs_object_space_face_planes;
+	const float* mis_model_view_matrices = models->mis_model_view_matrices;
+	const float* mis_transforms = models->mis_transforms;
+	const int* mbs_positions_offsets = models->mbs_positions_offsets;
+
+	int* position_transformed_flags = ib->scratch->position_transformed_flags;
+
+	// Normals aren't needed until lighting, so they are only transformed for
+	// the front faces too.
+	const float* object_space_normals = models->mbs_object_space_normals;
+	const float* mis_view_normal_matrices = models->mis_view_normal_matrices;
+	const int* mbs_normals_offsets = models->mbs_normals_offsets;
+	int* normal_transformed_flags = ib->scratch->normal_transformed_flags;
+
+	// Meshlet culling.
+	const int* mbs_meshlets_offsets = models->mbs_meshlets_offsets;
+	const int* mbs_meshlets_counts = models->mbs_meshlets_counts;
+	const int* meshlet_face_indices = models->mbs_meshlet_face_indices;
+	const float* meshlet_spheres = models->mbs_meshlet_spheres;
+	const float* meshlet_cones = models->mbs_meshlet_cones;
+
+	const Plane* view_planes = renderer->settings.view_frustum.planes;
+	const Plane* clip_planes = renderer->settings.guard_band_clipping ? 
+		renderer->settings.guard_band_frustum.planes : 
+		renderer->settings.view_frustum.planes;
+
+	const float* uvs = models->mbs_uvs;
+	const int* face_vertex_ids = models->mbs_face_vertex_ids;
+	const float* vertex_colours = models->mis_vertex_colours;
+	const float* light_space_positions = renderer->buffers.light_space_positions;
+
+	// In the indexed mode only the indices of the front faces are written out.
+	const int indexed = renderer->settings.indexed_front_faces;
+
+	// The instance's results go to the buffers it was given.
+	float* view_space_positions = ib->view_space_positions;
+	float* view_space_normals = ib->view_space_normals;
+	const int light_space_offset = ib->light_space_positions_offset;
+
+	float* front_faces = ib->front_faces;
+	int* front_faces_vertex_ids = ib->front_faces_vertex_ids;
+	int* front_faces_indices = ib->front_faces_indices;
+
+	int front_face_out = 0;
+	int front_face_vertex_ids_out = 0;
+	int front_faces_indices_out = 0;
+
+	// Get the offsets for the buffers that are not instance specific.
+	const int mb_faces_offset = mbs_faces_offsets[mb_index];
+	const int mb_uvs_offset = mbs_uvs_offsets[mb_index];
+
+	int front_face_count = 0;
+
+	// Put the camera in the instance's object space, so each face can be 
+	// classified against its precomputed plane without transforming it. The
+	// model view matrix is a rotation and translation of a scale, so each of 
+	// its first three columns is a rotated axis times the scale on that axis.
+	const float* model_view_matrix = mis_model_view_matrices + mi_index * STRIDE_M4;
+	const V3 translation = v3_read(model_view_matrix + 12);
+
+	const V3 axis_x = v3_read(model_view_matrix);
+	const V3 axis_y = v3_read(model_view_matrix + 4);
+	const V3 axis_z = v3_read(model_view_matrix + 8);
+
+	const V3 camera_position = {
+		-dot(axis_x, translation) / size_squared(axis_x),
+		-dot(axis_y, translation) / size_squared(axis_y),
+		-dot(axis_z, translation) / size_squared(axis_z)
+	};
+
+	// Mirroring the instance flips the winding of its faces.
+	const V3 scale = v3_read(mis_transforms + mi_index * STRIDE_MI_TRANSFORM + 6);
+	const float winding = (scale.x * scale.y * scale.z < 0) ? -1.f : 1.f;
+
+	// Only the positions used by the front faces are transformed, unless they
+	// were all transformed already.
+	if (!positions_transformed)
+	{
+		memset(position_transformed_flags, 0, sizeof(int) * mbs_positions_counts[mb_index]);
+	}
+
+	const int mb_positions_offset = mbs_positions_offsets[mb_index];
+
+	const float* view_normal_matrix = mis_view_normal_matrices + mi_index * STRIDE_M4;
+	const int mb_normals_offset = mbs_normals_offsets[mb_index];
+	memset(normal_transformed_flags, 0, sizeof(int) * mbs_normals_counts[mb_index]);
+
+	// The largest scale of the model view matrix's axes, for putting the 
+	// meshlets' spheres in view space.
+	const float max_scale = sqrtf(max(max(size_squared(axis_x), size_squared(axis_y)), size_squared(axis_z)));
+
+	const int mb_meshlets_offset = mbs_meshlets_offsets[mb_index];
+	const int mb_meshlets_end = mb_meshlets_offset + mbs_meshlets_counts[mb_index];
+	const int mb_faces_count = mbs_faces_counts[mb_index];
+
+	// The meshlets that don't need clipping are written out first, so their
+	// faces can be drawn without checking them against the planes.
+	const int passes_count = planes_count > 0 ? 2 : 1;
+
+	for (int pass = 0; pass < passes_count; ++pass)
+	{
+		const MeshletVisibility pass_visibility = 0 == pass ? MESHLET_INSIDE : MESHLET_CLIPPED;
+
+		for (int m = mb_meshlets_offset; m < mb_meshlets_end; ++m)
+		{
+			const MeshletVisibility visibility = classify_meshlet(
+				meshlet_spheres + m * STRIDE_SPHERE, 
+				meshlet_cones + m * STRIDE_CONE,
+				camera_position, winding,
+				model_view_matrix, max_scale,
+				view_planes, clip_planes, plane_indices, planes_count);
+
+			if (visibility != pass_visibility)
+			{
+				continue;
+			}
+
+			const int first_face = (m - mb_meshlets_offset) * MESHLET_MAX_FACES;
+			const int end_face = min(first_face + MESHLET_MAX_FACES, mb_faces_count);
+
+			for (int f = first_face; f < end_face; ++f)
+			{
+				const int j = meshlet_face_indices[mb_faces_offset + f];
+				const int face_index = (mb_faces_offset + j) * STRIDE_FACE_VERTICES;
+
+				// Same as is_front_face, the camera is in front of or on the plane.
+				const float* plane = face_planes + (mb_faces_offset + j) * STRIDE_PLANE;
+				if ((dot(v3_read(plane), camera_position) + plane[3]) * winding < 0)
+				{
+					continue;
+				}
+
+				// Transform the face's positions if no other front face has used them.
+				if (!positions_transformed)
+				{
+					for (int k = 0; k < STRIDE_FACE_VERTICES; ++k)
+					{
+						const int position_index = face_position_indices[face_index + k];
+
+						if (!position_transformed_flags[position_index])
+						{
+							V4 object_space_position = v3_read_to_v4(object_space_positions + (position_index + mb_positions_offset) * STRIDE_POSITION, 1.f);
+
+							V4 view_space_position;
+							m4_mul_v4(model_view_matrix, object_space_position, &view_space_position);
+
+							v4_write_xyz(view_space_positions + position_index * STRIDE_POSITION, view_space_position);
+							position_transformed_flags[position_index] = 1;
+						}
+					}
+				}
+
+				// Same for the normals, these are used by the indexed mode too.
+				for (int k = 0; k < STRIDE_FACE_VERTICES; ++k)
+				{
+					const int normal_index = face_normal_indices[face_index + k];
+
+					if (!normal_transformed_flags[normal_index])
+					{
+						V4 object_space_normal = v3_read_to_v4(object_space_normals + (normal_index + mb_normals_offset) * STRIDE_NORMAL, 0.f);
+
+						V4 view_space_normal;
+						m4_mul_v4(view_normal_matrix, object_space_normal, &view_space_normal);
+
+						v3_write(view_space_normals + normal_index * STRIDE_NORMAL, normalised(v4_xyz(view_space_normal)));
+						normal_transformed_flags[normal_index] = 1;
+					}
+				}
+
+				// The indexed mode only needs the face's index, the vertices are
+				// read when the face is assembled.
+				if (indexed)
+				{
+					front_faces_indices[front_faces_indices_out++] = j;
+					++front_face_count;
+					continue;
+				}
+
+				// Get the indices to the first component of each vertex position.
+				const int index_v0 = face_position_indices[face_index];
+				const int index_v1 = face_position_indices[face_index + 1];
+				const int index_v2 = face_position_indices[face_index + 2];
+
+				const int index_parts_v0 = index_v0 * STRIDE_POSITION;
+				const int index_parts_v1 = index_v1 * STRIDE_POSITION;
+				const int index_parts_v2 = index_v2 * STRIDE_POSITION;
+
+				// Get the vertices from the face indices.
+				const V3 v0 = v3_read(view_space_positions + index_parts_v0);
+				const V3 v1 = v3_read(view_space_positions + index_parts_v1);
+				const V3 v2 = v3_read(view_space_positions + index_parts_v2);
 
-			// If the face is front facing, we can possibly see it.
-			if (is_front_face(v0, v1, v2))
-			{		
 				// Get the indices to the first component of each vertex normal.
-				const int index_n0 = face_normal_indices[face_index] + normals_offset;
-				const int index_n1 = face_normal_indices[face_index + 1] + normals_offset;
-				const int index_n2 = face_normal_indices[face_index + 2] + normals_offset;
+				const int index_n0 = face_normal_indices[face_index];
+				const int index_n1 = face_normal_indices[face_index + 1];
+				const int index_n2 = face_normal_indices[face_index + 2];
 
 				int index_parts_n0 = index_n0 * STRIDE_NORMAL;
 				int index_parts_n1 = index_n1 * STRIDE_NORMAL;
 				int index_parts_n2 = index_n2 * STRIDE_NORMAL;
-				
+		
 				const int index_uv0 = face_uvs_indices[face_index] + mb_uvs_offset;
 				const int index_uv1 = face_uvs_indices[face_index + 1] + mb_uvs_offset;
 				const int index_uv2 = face_uvs_indices[face_index + 2] + mb_uvs_offset;
@@ -1638,9 +2722,14 @@ void cull_backfaces(Renderer* renderer, const Scene* scene)
 				const int index_parts_c2 = (face_index + 2) * STRIDE_COLOUR;
 
 				// Light space positions are wrote out light by light.
-				const int index_lsp_parts_v0 = index_v0 * STRIDE_V4;
-				const int index_lsp_parts_v1 = index_v1 * STRIDE_V4;
-				const int index_lsp_parts_v2 = index_v2 * STRIDE_V4;
+				const int index_lsp_parts_v0 = (index_v0 + light_space_offset) * STRIDE_V4;
+				const int index_lsp_parts_v1 = (index_v1 + light_space_offset) * STRIDE_V4;
+				const int index_lsp_parts_v2 = (index_v2 + light_space_offset) * STRIDE_V4;
+
+				// Store the unique vertices so the lighting can be shared between faces.
+				front_faces_vertex_ids[front_face_vertex_ids_out++] = face_vertex_ids[face_index];
+				front_faces_vertex_ids[front_face_vertex_ids_out++] = face_vertex_ids[face_index + 1];
+				front_faces_vertex_ids[front_face_vertex_ids_out++] = face_vertex_ids[face_index + 2];
 
 				// Copy all the face vertex data.
 				// We copy the attributes over here as well because when clipping we need the data
@@ -1667,7 +2756,7 @@ void cull_backfaces(Renderer* renderer, const Scene* scene)
 
 				for (int k = 0; k < shadow_maps_count; ++k)
 				{
-					
+			
 					// TODO: Is this right...
 					int lsp_index = index_lsp_parts_v0 + models->mis_total_faces * STRIDE_FACE_VERTICES * STRIDE_V4 * k;
 					front_faces[front_face_out++] = light_space_positions[lsp_index];
@@ -1700,7 +2789,7 @@ void cull_backfaces(Renderer* renderer, const Scene* scene)
 
 				for (int k = 0; k < shadow_maps_count; ++k)
 				{
-					
+			
 					// TODO: Is this right...
 					int lsp_index = index_lsp_parts_v1 + models->mis_total_faces * STRIDE_FACE_VERTICES * STRIDE_V4 * k;
 					front_faces[front_face_out++] = light_space_positions[lsp_index];
@@ -1731,7 +2820,7 @@ void cull_backfaces(Renderer* renderer, const Scene* scene)
 
 				for (int k = 0; k < shadow_maps_count; ++k)
 				{
-					
+			
 					// TODO: Is this right...
 					int lsp_index = index_lsp_parts_v2 + models->mis_total_faces * STRIDE_FACE_VERTICES * STRIDE_V4 * k;
 					front_faces[front_face_out++] = light_space_positions[lsp_index];
@@ -1744,461 +2833,506 @@ void cull_backfaces(Renderer* renderer, const Scene* scene)
 			}
 		}
 
-		// Update the number of front faces for the current mesh.
-		// This is needed for frustum culling.
-		front_faces_counts[i] = front_face_count;
-		
-		// Update the offsets for per instance data.
-		positions_offset += mbs_positions_counts[mb_index];
-		normals_offset += mbs_normals_counts[mb_index];
+		if (0 == pass)
+		{
+			ib->unclipped_front_faces_count = front_face_count;
+		}
 	}
+
+	ib->front_faces_count = front_face_count;
 }
 
-void light_front_faces(Renderer* renderer, Scene* scene)
+void cull_backfaces_range(Renderer* renderer, const Scene* scene, RenderBuffers* scratch, int begin, int end)
 {
-	// TODO: For optimising this, some sort of broad phase could be implemented.
-	//		 Potentially when we 
+	const Models* models = &scene->models;
+	RenderBuffers* rbs = &renderer->buffers;
 
-	// Apply lighting to all the front faces.
-	// We do this before clipping so if we don't get inconsistent results. 
-	float* front_faces = renderer->buffers.front_faces;
-	const int* front_faces_counts = renderer->buffers.front_faces_counts;
+	const int* passed_broad_phase_flags = models->mis_passed_broad_phase_flags;
+	const int* intersected_planes = models->mis_intersected_planes;
+	const int* mis_occluder_flags = models->mis_occluder_flags;
 
-	int face_offset = 0;
+	const int* mis_positions_offsets = models->mis_positions_offsets;
+	const int* mis_normals_offsets = models->mis_normals_offsets;
+	const int* mis_faces_offsets = models->mis_faces_offsets;
 
-	const int mis_count = scene->models.mis_count;
+	int* front_faces_counts = rbs->front_faces_counts;
+	int* unclipped_front_faces_counts = rbs->unclipped_front_faces_counts;
 
-	const int* passed_broad_phase_flags = scene->models.mis_passed_broad_phase_flags;
+	const int FACE_COMPONENTS = (STRIDE_BASE_FRONT_VERTEX + scene->point_lights.count * STRIDE_V4) * STRIDE_FACE_VERTICES;
 
-	const int point_lights_count = scene->point_lights.count;
+	for (int i = begin; i < end; ++i)
+	{
+		// Only need to do backface culling if the mi passed the broad phase.
+		if (passed_broad_phase_flags[i])
+		{
+			const int planes_count = intersected_planes[i * STRIDE_INTERSECTED_PLANES];
+			const int* plane_indices = intersected_planes + i * STRIDE_INTERSECTED_PLANES + 1;
+
+			// Each instance has space for all of its faces in the scene sized
+			// buffers, so its front faces don't depend on the other instances'.
+			const int face_offset = mis_faces_offsets[i];
+
+			InstanceBuffers ib = { 0 };
+			ib.view_space_positions = models->view_space_positions + mis_positions_offsets[i] * STRIDE_POSITION;
+			ib.view_space_normals = models->view_space_normals + mis_normals_offsets[i] * STRIDE_NORMAL;
+			ib.light_space_positions_offset = mis_positions_offsets[i];
+			ib.front_faces = rbs->front_faces + face_offset * FACE_COMPONENTS;
+			ib.front_faces_vertex_ids = rbs->front_faces_vertex_ids + face_offset * STRIDE_FACE_VERTICES;
+			ib.front_faces_indices = rbs->front_faces_indices + face_offset;
+			ib.scratch = scratch;
+
+			// Occluders already had all of their positions transformed.
+			cull_instance_backfaces(renderer, scene, i, plane_indices, planes_count, mis_occluder_flags[i], &ib);
+
+			front_faces_counts[i] = ib.front_faces_count;
+			unclipped_front_faces_counts[i] = ib.unclipped_front_faces_count;
+		}
+		else
+		{
+			front_faces_counts[i] = 0;
+			unclipped_front_faces_counts[i] = 0;
+		}
+	}
+}
+
+void cull_backfaces(Renderer* renderer, const Scene* scene)
+{
+	cull_backfaces_range(renderer, scene, &renderer->buffers, 0, scene->models.mis_count);
+}
+
+void light_instance_front_faces(Renderer* renderer, const Scene* scene, int mi_index, const InstanceBuffers* ib)
+{
+	// Apply lighting to all the front faces.
+	// We do this before clipping so if we don't get inconsistent results. 
+	float* front_faces = ib->front_faces;
+	const int* front_faces_vertex_ids = ib->front_faces_vertex_ids;
+	const int front_faces_count = ib->front_faces_count;
+
+	// The diffuse light only depends on the position and normal, so it is 
+	// calculated once per unique vertex of the instance and shared between the 
+	// faces that use it.
+	float* vertex_lighting = ib->scratch->vertex_lighting;
+	int* vertex_lit_flags = ib->scratch->vertex_lit_flags;
 
-	const float* pls_view_space_positions = scene->point_lights.view_space_positions;
-	const float* pls_attributes = scene->point_lights.attributes;
+	const int point_lights_count = scene->point_lights.count;
 
 	const V3 ambient_light = scene->ambient_light;
 
 	const int VERTEX_COMPONENTS = STRIDE_BASE_FRONT_VERTEX + point_lights_count * STRIDE_V4;
 
-	for (int i = 0; i < mis_count; ++i)
-	{
-		// Mesh isn't visible, so move to the next.
-		if (!passed_broad_phase_flags[i])
-		{
-			// Move to the next mi.
-			face_offset += front_faces_counts[i];
-			continue;
-		}
+	// Only the vertices used by the front faces are lit.
+	memset(vertex_lit_flags, 0, sizeof(int) * scene->models.mbs_vertices_counts[scene->models.mis_base_ids[mi_index]]);
 
-		const int front_faces_count = front_faces_counts[i];
+	for (int j = 0; j < front_faces_count; ++j)
+	{
+		int index_face = j * VERTEX_COMPONENTS * STRIDE_FACE_VERTICES;
 
-		for (int j = face_offset; j < face_offset + front_faces_count; ++j)
+		// For each vertex calculate the diffuse contribution.
+		for (int v = 0; v < STRIDE_FACE_VERTICES; ++v)
 		{
-			int index_face = j * VERTEX_COMPONENTS * STRIDE_FACE_VERTICES;
+			const int k = index_face + v * VERTEX_COMPONENTS;
+			const int vertex_id = front_faces_vertex_ids[j * STRIDE_FACE_VERTICES + v];
+			float* vertex_diffuse = vertex_lighting + vertex_id * STRIDE_COLOUR;
 
-			// For each vertex calculate the diffuse contribution.
-			for (int k = index_face; k < index_face + VERTEX_COMPONENTS * STRIDE_FACE_VERTICES; k += VERTEX_COMPONENTS)
+			if (!vertex_lit_flags[vertex_id])
 			{
 				const V3 pos = v3_read(front_faces + k);
 				const V3 normal = v3_read(front_faces + k + 5);
 
-				// The base colour of the surface under diffuse lighting.
-				V3 albedo = v3_read(front_faces + k + 8);
-				
-				// The total diffuse light the vertex receives.
-				V3 diffuse_part = { 0, 0, 0 };
-
-				// For each light
-				for (int i_light = 0; i_light < point_lights_count; ++i_light)
-				{
-					// Read the light's properties.
-					const V3 light_pos = v3_read(pls_view_space_positions + i_light * STRIDE_POSITION);
-
-					int i_light_attr = i_light * STRIDE_POINT_LIGHT_ATTRIBUTES;
-					V3 light_colour = v3_read(pls_attributes + i_light_attr);
-					float strength = pls_attributes[i_light_attr + 3];
-
-					float a = 0.1f / strength;
-					float b = 0.01f / strength;
+				v3_write(vertex_diffuse, calculate_vertex_diffuse(&scene->point_lights, pos, normal));
+				vertex_lit_flags[vertex_id] = 1;
+			}
 
-					float df = calculate_diffuse_factor(pos, normal, light_pos, a, b);
+			// The base colour of the surface under diffuse lighting, this is
+			// per face vertex so can't be cached.
+			const V3 albedo = v3_read(front_faces + k + 8);
 
-					v3_mul_eq_f(&light_colour, df);
-					v3_add_eq_v3(&diffuse_part, light_colour);
-				}
+			const V3 light = calculate_vertex_light(albedo, v3_read(vertex_diffuse), ambient_light);
 
-				// Clamp diffuse contribution to a valid range 0-1. 
-				V3 light = {
-					albedo.x * (diffuse_part.x + ambient_light.x),
-					albedo.y * (diffuse_part.y + ambient_light.y),
-					albedo.z * (diffuse_part.z + ambient_light.z)
-				};
+			// Write out the calculated diffuse part of the vertex.
+			// If we introduce specular, this can include that.
 
-				// Clamp to max, should never be negative.
-				light.x = min(1.f, light.x);
-				light.y = min(1.f, light.y);
-				light.z = min(1.f, light.z);
-
-				/*
-				v3_mul_eq_v3(&diffuse_part, albedo);
-				
-				// Combine the ambient and diffuse contributions to calculate the vertex colour.
-				V3 colour = v3_add_v3(diffuse_part, v3_mul_v3(albedo, ambient_light));
-				
-				colour.x = min(colour.x, 1.f);
-				colour.y = min(colour.y, 1.f);
-				colour.z = min(colour.z, 1.f);
-				*/
-
-				// Write out the calculated diffuse part of the vertex.
-				// If we introduce specular, this can include that.
-
-				//xyz, uv, xyz, rgb, rgb
-				v3_write(front_faces + k + 11, light);
-			}
+			//xyz, uv, xyz, rgb, rgb
+			v3_write(front_faces + k + 11, light);
 		}
-	
-		face_offset += front_faces_count;
 	}
 }
 
-void clip_to_screen(
-	Renderer* renderer,
-	const M4 view_matrix, 
-	Scene* scene,
-	const Resources* resources)
+void light_front_faces_range(Renderer* renderer, const Scene* scene, RenderBuffers* scratch, int begin, int end)
 {
-	// TODO: Rename this.
-
-	
-	// TODO: Look into this: https://zeux.io/2009/01/31/view-frustum-culling-optimization-introduction/
+	// TODO: For optimising this, some sort of broad phase could be implemented.
+	//		 Potentially when we 
+	const int* front_faces_counts = renderer->buffers.front_faces_counts;
+	const int* passed_broad_phase_flags = scene->models.mis_passed_broad_phase_flags;
+	const int* mis_faces_offsets = scene->models.mis_faces_offsets;
 
-	Models* models = &scene->models;
-	PointLights* point_lights = &scene->point_lights;
-	RenderBuffers* render_buffers = &renderer->buffers;
+	const int VERTEX_COMPONENTS = STRIDE_BASE_FRONT_VERTEX + scene->point_lights.count * STRIDE_V4;
 
-	// Frustum culling
-	const int* intersected_planes = models->mis_intersected_planes;
-	const int* passed_broad_phase_flags = models->mis_passed_broad_phase_flags;
+	for (int i = begin; i < end; ++i)
+	{
+		// Mesh isn't visible, so move to the next.
+		if (passed_broad_phase_flags[i])
+		{
+			const int face_offset = mis_faces_offsets[i];
 
-	float* clipped_faces = render_buffers->clipped_faces;
+			InstanceBuffers ib = { 0 };
+			ib.front_faces = renderer->buffers.front_faces + face_offset * VERTEX_COMPONENTS * STRIDE_FACE_VERTICES;
+			ib.front_faces_vertex_ids = renderer->buffers.front_faces_vertex_ids + face_offset * STRIDE_FACE_VERTICES;
+			ib.front_faces_count = front_faces_counts[i];
+			ib.scratch = scratch;
 
-	int face_offset = 0;
-	int positions_offset = 0;
+			light_instance_front_faces(renderer, scene, i, &ib);
+		}
+	}
+}
 
-	float* front_faces = render_buffers->front_faces; // TEMP: Not const whilst drawing normals.
-	const int* front_faces_counts = render_buffers->front_faces_counts;
+void light_front_faces(Renderer* renderer, Scene* scene)
+{
+	light_front_faces_range(renderer, scene, &renderer->buffers, 0, scene->models.mis_count);
+}
 
-	int intersected_planes_index = 0;
+int clip_outcode(const Plane* planes, const int* plane_indices, int planes_count, V3 v)
+{
+	// Bit i is set if the vertex is outside the i-th plane in the list.
+	int outcode = 0;
 
-	// Perform frustum culling per model instance.
-	for (int i = 0; i < models->mis_count; ++i)
+	for (int i = 0; i < planes_count; ++i)
 	{
-		// Mesh isn't visible, so move to the next.
-		if (!passed_broad_phase_flags[i])
+		if (signed_distance(&planes[plane_indices[i]], v) < 0)
 		{
-			// Move to the next mi.
-			face_offset += front_faces_counts[i];
-			continue;
+			outcode |= 1 << i;
 		}
-		
-		int num_planes_to_clip_against = intersected_planes[intersected_planes_index++];
+	}
+
+	return outcode;
+}
 
-		// TODO: TEMP: DISABLE CLIPPING. for testing shadows.
-		//num_planes_to_clip_against = 0;
+int clip_polygon_against_plane(const Plane* plane, const float* in, int in_count, float* out, int vertex_components)
+{
+	// Sutherland-Hodgman, walks the edges of the polygon keeping the inside 
+	// vertices and adding a new vertex wherever an edge crosses the plane.
+	int out_count = 0;
+
+	const float* a = in + (in_count - 1) * vertex_components;
+	float distance_a = signed_distance(plane, v3_read(a));
 
-		// Calculate the number of components per vertex.
-		// TODO: This will also be calculated for the front_faces and when drawing, 
-		//		 should we share?
+	for (int i = 0; i < in_count; ++i)
+	{
+		const float* b = in + i * vertex_components;
+		const float distance_b = signed_distance(plane, v3_read(b));
 
-		// TODO: Atm we don't really want the normal after this. 
-		// Total number of components per vertex.
-		// TODO: Get this number from somewhere else, perhaps render buffers.
-		const int VERTEX_COMPONENTS = STRIDE_BASE_FRONT_VERTEX + scene->point_lights.count * STRIDE_V4;
+		const int a_inside = distance_a >= 0;
+		const int b_inside = distance_b >= 0;
 
-		// Skip the mesh if it's not visible at all.
-		if (0 == num_planes_to_clip_against)
+		if (a_inside != b_inside)
 		{
-			// Entire mesh is visible so just copy the vertices over.
-			int index_face = face_offset * VERTEX_COMPONENTS * STRIDE_FACE_VERTICES;
-			int front_faces_count = render_buffers->front_faces_counts[i];
+			// Always interpolate from the inside vertex so the faces that share
+			// the edge get exactly the same vertex.
+			const float* inside = a_inside ? a : b;
+			const float* outside = a_inside ? b : a;
+			const float distance_inside = a_inside ? distance_a : distance_b;
+			const float distance_outside = a_inside ? distance_b : distance_a;
 
-			// TODO: How do we avoid copying the normals.
-			memcpy(clipped_faces, front_faces + index_face, (size_t)front_faces_count * VERTEX_COMPONENTS * STRIDE_FACE_VERTICES * sizeof(float));
-		
-			// Draw the clipped face
-			project_and_draw_clipped(renderer, scene, i, front_faces_count, resources);
+			const float t = distance_inside / (distance_inside - distance_outside);
+
+			float* intersection = out + out_count * vertex_components;
+			for (int k = 0; k < vertex_components; ++k)
+			{
+				intersection[k] = lerp(inside[k], outside[k], t);
+			}
+
+			++out_count;
 		}
-		else
+
+		if (b_inside)
 		{
-			// TODO: The last mesh added is getting clipped when nowhere near it.
-			// TODO: I think it's actually clipping is overwriting something.
+			memcpy(out + out_count * vertex_components, b, vertex_components * sizeof(float));
+			++out_count;
+		}
 
-			// Partially inside so must clip the vertices against the planes.
+		a = b;
+		distance_a = distance_b;
+	}
 
-			// Initially read from the front_faces buffer.
-			float* temp_clipped_faces_in = front_faces;
-			float* temp_clipped_faces_out = render_buffers->temp_clipped_faces_out;
+	return out_count;
+}
 
-			// Store the index to write out to, needs to be defined here so we can
-			// update the clipped_faces_index after writing to the clipped_faces buffer.
-			int index_out = 0;
+int clip_face(RenderBuffers* rbs, const float* face, const Plane* planes, const int* plane_indices, int planes_count, int vertex_components, float* out)
+{
+	const int FACE_COMPONENTS = vertex_components * STRIDE_FACE_VERTICES;
 
-			// After each plane, we will have a different number of faces to clip again.
-			// Initially set this to the number of front faces.
-			int num_faces_to_process = render_buffers->front_faces_counts[i];
+	const int outcode0 = clip_outcode(planes, plane_indices, planes_count, v3_read(face));
+	const int outcode1 = clip_outcode(planes, plane_indices, planes_count, v3_read(face + vertex_components));
+	const int outcode2 = clip_outcode(planes, plane_indices, planes_count, v3_read(face + vertex_components + vertex_components));
 
-			// This is needed as an offset into the front_faces buffer for the first plane.
-			int clipped_faces_offset = face_offset;
+	// Every vertex is outside the same plane, so none of the face is visible.
+	if (outcode0 & outcode1 & outcode2)
+	{
+		return 0;
+	}
 
-			// The logic for setting in/out buffers depends on how many planes we actually
-			// render against, not the plane index.
-			int num_planes_clipped_against = 0;
+	// Every vertex is inside all the planes, so copy the face.
+	const int straddled_planes = outcode0 | outcode1 | outcode2;
+	if (0 == straddled_planes)
+	{
+		memcpy(out, face, FACE_COMPONENTS * sizeof(float));
+		return 1;
+	}
 
-			for (int j = 0; j < num_planes_to_clip_against; ++j)
-			{
-				const Plane* plane = &renderer->settings.view_frustum.planes[intersected_planes[intersected_planes_index++]];
-				
-				// Reset the index to write out to.
-				index_out = 0;
+	// Clip the face as a polygon against only the planes it crosses.
+	float* polygon_in = rbs->clip_polygon_in;
+	float* polygon_out = rbs->clip_polygon_out;
 
-				// Store how many triangles were wrote to the out buffer.				
-				int temp_visible_faces_count = 0;
+	memcpy(polygon_in, face, FACE_COMPONENTS * sizeof(float));
+	int polygon_vertices_count = STRIDE_FACE_VERTICES;
 
-				// After the first plane we want to read from the in buffer.
-				if (num_planes_clipped_against == 1)
-				{
-					// Initially we used the in front faces buffer, after the first iteration 
-					// we have wrote to the out buffer, so that can now be our in buffer.
-					temp_clipped_faces_out = render_buffers->temp_clipped_faces_in;
+	for (int k = 0; k < planes_count && polygon_vertices_count >= 3; ++k)
+	{
+		if (straddled_planes & (1 << k))
+		{
+			const Plane* plane = &planes[plane_indices[k]];
+			polygon_vertices_count = clip_polygon_against_plane(plane, polygon_in, polygon_vertices_count, polygon_out, vertex_components);
 
-					// Now we want to read from the start of the in buffer, 
-					// not the offset into the front faces buffer.
-					clipped_faces_offset = 0;
-				}
+			float* temp = polygon_in;
+			polygon_in = polygon_out;
+			polygon_out = temp;
+		}
+	}
 
-				// If we're processing the last plane, write out to the clipped_faces buffer.
-				if (num_planes_clipped_against == num_planes_to_clip_against - 1)
-				{
-					// On the last plane, we want to write out to the clipped faces.
-					temp_clipped_faces_out = render_buffers->clipped_faces;
-				}
+	// Triangulate the clipped polygon as a fan around the first vertex,
+	// the polygon is convex and keeps the face's winding.
+	int faces_count = 0;
 
-				// For faces in mesh.
-				for (int j = clipped_faces_offset; j < clipped_faces_offset + num_faces_to_process; ++j)
-				{
-					int index_face = j * VERTEX_COMPONENTS * STRIDE_FACE_VERTICES;
+	for (int k = 1; k < polygon_vertices_count - 1; ++k)
+	{
+		memcpy(out, polygon_in, vertex_components * sizeof(float));
+		memcpy(out + vertex_components, polygon_in + k * vertex_components, (size_t)vertex_components * 2 * sizeof(float));
+		out += FACE_COMPONENTS;
+		++faces_count;
+	}
 
-					int num_inside_points = 0;
-					int num_outside_points = 0;
+	return faces_count;
+}
 
-					int inside_points_indices[3] = { 0 };
-					int outside_points_indices[3] = { 0 };
+void assemble_front_face(Renderer* renderer, const Scene* scene, int mi_index, int face_index, const InstanceBuffers* ib, float* out)
+{
+	// Writes the face's vertices in the same layout as cull_backfaces writes
+	// the front faces, with the lighting applied.
+	const Models* models = &scene->models;
+	RenderBuffers* rbs = &renderer->buffers;
 
-					const int index_v0 = index_face;
-					const int index_v1 = index_face + VERTEX_COMPONENTS;
-					const int index_v2 = index_face + VERTEX_COMPONENTS + VERTEX_COMPONENTS;
+	const int mb_index = models->mis_base_ids[mi_index];
+	const int lights_count = scene->point_lights.count;
 
-					const V3 v0 = v3_read(temp_clipped_faces_in + index_v0);
-					const V3 v1 = v3_read(temp_clipped_faces_in + index_v1);
-					const V3 v2 = v3_read(temp_clipped_faces_in + index_v2);
+	const float* light_space_positions = rbs->light_space_positions;
 
-					float d0 = signed_distance(plane, v0);
-					float d1 = signed_distance(plane, v1);
-					float d2 = signed_distance(plane, v2);
+	for (int v = 0; v < STRIDE_FACE_VERTICES; ++v)
+	{
+		const int face_vertex_index = (models->mbs_faces_offsets[mb_index] + face_index) * STRIDE_FACE_VERTICES + v;
 
-					// Determine what points are inside and outside the plane.
-					if (d0 >= 0)
-					{
-						inside_points_indices[num_inside_points++] = index_v0;
-					}
-					else
-					{
-						outside_points_indices[num_outside_points++] = index_v0;
-					}
-					if (d1 >= 0)
-					{
-						inside_points_indices[num_inside_points++] = index_v1;
-					}
-					else
-					{
-						outside_points_indices[num_outside_points++] = index_v1;
-					}
-					if (d2 >= 0)
-					{
-						inside_points_indices[num_inside_points++] = index_v2;
-					}
-					else
-					{
-						outside_points_indices[num_outside_points++] = index_v2;
-					}
+		const int index_position = models->mbs_face_position_indices[face_vertex_index];
+		const int index_normal = models->mbs_face_normal_indices[face_vertex_index];
+		const int index_uv = models->mbs_face_uvs_indices[face_vertex_index] + models->mbs_uvs_offsets[mb_index];
 
-					if (num_inside_points == 3)
-					{
-						// The whole triangle is inside the plane, so copy the face.
-						int index_face = j * VERTEX_COMPONENTS * STRIDE_FACE_VERTICES;
+		const V3 position = v3_read(ib->view_space_positions + index_position * STRIDE_POSITION);
+		const V3 normal = v3_read(ib->view_space_normals + index_normal * STRIDE_NORMAL);
 
-						// TODO: How do we avoid copying the normal.
-						memcpy(temp_clipped_faces_out + index_out, temp_clipped_faces_in + index_face, VERTEX_COMPONENTS * STRIDE_FACE_VERTICES * sizeof(float));
+		// Vertex colours are defined aligned with the faces.
+		const V3 albedo = v3_read(models->mis_vertex_colours + face_vertex_index * STRIDE_COLOUR);
 
-						index_out += VERTEX_COMPONENTS * STRIDE_FACE_VERTICES;
-						++temp_visible_faces_count;
-					}
-					else if (num_inside_points == 1 && num_outside_points == 2)
-					{
-						// Form a new triangle with the plane edge.
-						// Unpack the points.
-						const int index_ip0 = inside_points_indices[0];
-						const int index_op0 = outside_points_indices[0];
-						const int index_op1 = outside_points_indices[1];
-
-						const V3 ip0 = v3_read(temp_clipped_faces_in + index_ip0);
-						const V3 op0 = v3_read(temp_clipped_faces_in + index_op0);
-						const V3 op1 = v3_read(temp_clipped_faces_in + index_op1);
-
-						// There are 14 attributes total... 
-						// without light positions.
-
-						// Copy the inside vertex.
-						// TODO: Memcpy might not be faster here should profile.
-						memcpy(
-							temp_clipped_faces_out + index_out, 
-							temp_clipped_faces_in + index_ip0, 
-							VERTEX_COMPONENTS * sizeof(float)
-						);
-						index_out += VERTEX_COMPONENTS;
-
-						// Lerp for the first new vertex.
-						V3 p0;
-						float t = line_intersect_plane(ip0, op0, plane, &p0);
-
-						temp_clipped_faces_out[index_out++] = p0.x;
-						temp_clipped_faces_out[index_out++] = p0.y;
-						temp_clipped_faces_out[index_out++] = p0.z;
-
-						// Lerp the vertex components straight into the out buffer.
-						const int COMPS_TO_LERP = 11 + scene->point_lights.count * STRIDE_V4;
-						for (int k = 0; k < COMPS_TO_LERP; ++k)
-						{
-							temp_clipped_faces_out[index_out++] = lerp(temp_clipped_faces_in[index_ip0 + STRIDE_POSITION + k], temp_clipped_faces_in[index_op0 + STRIDE_POSITION + k], t);
-						}
+		// Light the vertex if no other face has used it yet.
+		const int vertex_id = models->mbs_face_vertex_ids[face_vertex_index];
+		float* vertex_diffuse = rbs->vertex_lighting + vertex_id * STRIDE_COLOUR;
 
-						// Lerp for the second vertex.
-						V3 p1;
-						t = line_intersect_plane(ip0, op1, plane, &p1);
+		if (!rbs->vertex_lit_flags[vertex_id])
+		{
+			v3_write(vertex_diffuse, calculate_vertex_diffuse(&scene->point_lights, position, normal));
+			rbs->vertex_lit_flags[vertex_id] = 1;
+		}
 
-						temp_clipped_faces_out[index_out++] = p1.x;
-						temp_clipped_faces_out[index_out++] = p1.y;
-						temp_clipped_faces_out[index_out++] = p1.z;
+		const V3 light = calculate_vertex_light(albedo, v3_read(vertex_diffuse), scene->ambient_light);
 
-						for (int k = 0; k < COMPS_TO_LERP; ++k)
-						{
-							temp_clipped_faces_out[index_out++] = lerp(temp_clipped_faces_in[index_ip0 + STRIDE_POSITION + k], temp_clipped_faces_in[index_op1 + STRIDE_POSITION + k], t);
-						}
-						
-						++temp_visible_faces_count;
-					}
-					else if (num_inside_points == 2 && num_outside_points == 1)
-					{
-						// Form two new triangles with the plane edge.
-						// Unpack the points.
-						const int index_ip0 = inside_points_indices[0];
-						const int index_ip1 = inside_points_indices[1];
-						const int index_op0 = outside_points_indices[0];
-
-						const V3 ip0 = v3_read(temp_clipped_faces_in + index_ip0);
-						const V3 ip1 = v3_read(temp_clipped_faces_in + index_ip1);
-						const V3 op0 = v3_read(temp_clipped_faces_in + index_op0);
-
-						// Copy the first inside vertex.
-						memcpy(
-							temp_clipped_faces_out + index_out,
-							temp_clipped_faces_in + index_ip0,
-							VERTEX_COMPONENTS * sizeof(float)
-						);
-						index_out += VERTEX_COMPONENTS;
-
-						// Copy the second inside vertex.
-						memcpy(
-							temp_clipped_faces_out + index_out,
-							temp_clipped_faces_in + index_ip1,
-							VERTEX_COMPONENTS * sizeof(float)
-						);
-						index_out += VERTEX_COMPONENTS;
-
-						// Lerp for the first new vertex.
-						V3 p0;
-						float t = line_intersect_plane(ip0, op0, plane, &p0);
-
-						// Copy the index for where we write the lerped components to, so
-						// we can copy them for the second triangle.
-						int new_v0_index = index_out;
-
-						temp_clipped_faces_out[index_out++] = p0.x;
-						temp_clipped_faces_out[index_out++] = p0.y;
-						temp_clipped_faces_out[index_out++] = p0.z;
-
-						const int COMPS_TO_LERP = 11 + scene->point_lights.count * STRIDE_V4;
-						for (int k = 0; k < COMPS_TO_LERP; ++k)
-						{
-							temp_clipped_faces_out[index_out++] = lerp(temp_clipped_faces_in[index_ip0 + STRIDE_POSITION + k], temp_clipped_faces_in[index_op0 + STRIDE_POSITION + k], t);
-						}
-						
-						++temp_visible_faces_count;
+		v3_write(out, position);
+		out[3] = models->mbs_uvs[index_uv * STRIDE_UV];
+		out[4] = models->mbs_uvs[index_uv * STRIDE_UV + 1];
+		v3_write(out + 5, normal);
+		v3_write(out + 8, albedo);
+		v3_write(out + 11, light);
+		out += STRIDE_BASE_FRONT_VERTEX;
 
-						// First triangle done.
-						
-						// Copy the first new vertex for the second triangle.
-						for (int k = new_v0_index; k < new_v0_index + VERTEX_COMPONENTS; ++k)
-						{
-							temp_clipped_faces_out[index_out++] = temp_clipped_faces_out[k];
-						}
+		for (int k = 0; k < lights_count; ++k)
+		{
+			const int lsp_index = (index_position + ib->light_space_positions_offset) * STRIDE_V4 + models->mis_total_faces * STRIDE_FACE_VERTICES * STRIDE_V4 * k;
+			memcpy(out, light_space_positions + lsp_index, STRIDE_V4 * sizeof(float));
+			out += STRIDE_V4;
+		}
+	}
+}
 
-						// Lerp for the second new point.
-						V3 p1;
-						t = line_intersect_plane(ip1, op0, plane, &p1);
-						
-						temp_clipped_faces_out[index_out++] = p1.x;
-						temp_clipped_faces_out[index_out++] = p1.y;
-						temp_clipped_faces_out[index_out++] = p1.z;
+void clip_instance_to_screen(Renderer* renderer, Scene* scene, int mi_index, const int* plane_indices, int planes_count, const InstanceBuffers* ib, const Resources* resources)
+{
+	RenderBuffers* render_buffers = &renderer->buffers;
 
-						for (int k = 0; k < COMPS_TO_LERP; ++k)
-						{
-							temp_clipped_faces_out[index_out++] = lerp(temp_clipped_faces_in[index_ip1 + STRIDE_POSITION + k], temp_clipped_faces_in[index_op0 + STRIDE_POSITION + k], t);
-						}
+	float* clipped_faces = render_buffers->clipped_faces;
 
-						// Copy over the inside vertex for this triangle.
-						memcpy(
-							temp_clipped_faces_out + index_out,
-							temp_clipped_faces_in + index_ip1,
-							VERTEX_COMPONENTS * sizeof(float)
-						);
-						index_out += VERTEX_COMPONENTS;
-						
-						++temp_visible_faces_count;
-					}
-				}
+	// TODO: Atm we don't really want the normal after this. 
+	// Total number of components per vertex.
+	// TODO: Get this number from somewhere else, perhaps render buffers.
+	const int VERTEX_COMPONENTS = STRIDE_BASE_FRONT_VERTEX + scene->point_lights.count * STRIDE_V4;
+	const int FACE_COMPONENTS = VERTEX_COMPONENTS * STRIDE_FACE_VERTICES;
 
-				// Update how many faces are visible after being clipped.
-				num_faces_to_process = temp_visible_faces_count;
+	// With the guard band, the side planes are only clipped against at the edge
+	// of the guard band.
+	const Plane* planes = renderer->settings.guard_band_clipping ? 
+		renderer->settings.guard_band_frustum.planes : 
+		renderer->settings.view_frustum.planes;
 
-				// Swap the in and out buffers.
-				float* temp = temp_clipped_faces_in;
-				temp_clipped_faces_in = temp_clipped_faces_out;
-				temp_clipped_faces_out = temp;
+	int clipped_faces_count = 0;
 
-				// Increment to show we actually clipped a plane.
-				++num_planes_clipped_against;
-			}
+	if (renderer->settings.indexed_front_faces)
+	{
+		// Assemble the vertices of each front face from the indices, only the
+		// faces that need clipping are stored, the others are drawn straight
+		// away.
+
+		// Only the vertices used by the front faces are lit.
+		memset(render_buffers->vertex_lit_flags, 0, sizeof(int) * scene->models.mbs_vertices_counts[scene->models.mis_base_ids[mi_index]]);
 
-			// Draw the clipped face
-			if (num_faces_to_process > 0)
+		float* face = render_buffers->assembled_face;
+
+		for (int j = 0; j < ib->front_faces_count; ++j)
+		{
+			assemble_front_face(renderer, scene, mi_index, ib->front_faces_indices[j], ib, face);
+
+			// The faces of the meshlets inside the planes are at the start.
+			if (j < ib->unclipped_front_faces_count)
 			{
-				project_and_draw_clipped(renderer, scene, i, num_faces_to_process, resources);
+				project_and_draw_clipped(renderer, scene, mi_index, face, 1, resources);
 			}
+			else
+			{
+				float* out = clipped_faces + clipped_faces_count * FACE_COMPONENTS;
+				clipped_faces_count += clip_face(render_buffers, face, planes, plane_indices, planes_count, VERTEX_COMPONENTS, out);
+			}
+		}
+	}
+	else
+	{
+		// The clipped and front faces have the same layout, so the faces of 
+		// the meshlets inside the planes, which are at the start, are drawn
+		// straight from the front faces.
+		const float* face = ib->front_faces;
+		const int unclipped_count = ib->unclipped_front_faces_count;
+
+		if (unclipped_count > 0)
+		{
+			project_and_draw_clipped(renderer, scene, mi_index, face, unclipped_count, resources);
+			face += unclipped_count * FACE_COMPONENTS;
 		}
 
-		// Move to the next model instance.
-		face_offset += front_faces_counts[i];
+		// Partially inside so must clip the faces against the planes the 
+		// instance intersects.
+		for (int j = unclipped_count; j < ib->front_faces_count; ++j, face += FACE_COMPONENTS)
+		{
+			float* out = clipped_faces + clipped_faces_count * FACE_COMPONENTS;
+			clipped_faces_count += clip_face(render_buffers, face, planes, plane_indices, planes_count, VERTEX_COMPONENTS, out);
+		}
+	}
+
+	// Draw the clipped faces.
+	if (clipped_faces_count > 0)
+	{
+		project_and_draw_clipped(renderer, scene, mi_index, clipped_faces, clipped_faces_count, resources);
+	}
+}
+
+void clip_to_screen(
+	Renderer* renderer,
+	const M4 view_matrix, 
+	Scene* scene,
+	const Resources* resources)
+{
+	// TODO: Rename this.
+
+	
+	// TODO: Look into this: https://zeux.io/2009/01/31/view-frustum-culling-optimization-introduction/
+
+	Models* models = &scene->models;
+	RenderBuffers* render_buffers = &renderer->buffers;
+
+	// Frustum culling
+	const int* intersected_planes = models->mis_intersected_planes;
+	const int* passed_broad_phase_flags = models->mis_passed_broad_phase_flags;
+
+	const int* front_faces_counts = render_buffers->front_faces_counts;
+	const int* unclipped_front_faces_counts = render_buffers->unclipped_front_faces_counts;
+
+	const int FACE_COMPONENTS = (STRIDE_BASE_FRONT_VERTEX + scene->point_lights.count * STRIDE_V4) * STRIDE_FACE_VERTICES;
+
+	// Perform frustum culling per model instance.
+	for (int i = 0; i < models->mis_count; ++i)
+	{
+		// Mesh isn't visible, so move to the next.
+		if (passed_broad_phase_flags[i])
+		{
+			const int planes_count = intersected_planes[i * STRIDE_INTERSECTED_PLANES];
+			const int* plane_indices = intersected_planes + i * STRIDE_INTERSECTED_PLANES + 1;
+
+			const int face_offset = models->mis_faces_offsets[i];
+
+			InstanceBuffers ib = { 0 };
+			ib.view_space_positions = models->view_space_positions + models->mis_positions_offsets[i] * STRIDE_POSITION;
+			ib.view_space_normals = models->view_space_normals + models->mis_normals_offsets[i] * STRIDE_NORMAL;
+			ib.light_space_positions_offset = models->mis_positions_offsets[i];
+			ib.front_faces = render_buffers->front_faces + face_offset * FACE_COMPONENTS;
+			ib.front_faces_indices = render_buffers->front_faces_indices + face_offset;
+			ib.front_faces_count = front_faces_counts[i];
+			ib.unclipped_front_faces_count = unclipped_front_faces_counts[i];
+			ib.scratch = render_buffers;
+
+			clip_instance_to_screen(renderer, scene, i, plane_indices, planes_count, &ib, resources);
+		}
+	}
+}
+
+void render_instances_fused(Renderer* renderer, Scene* scene, const Resources* resources)
+{
+	Models* models = &scene->models;
+	RenderBuffers* rbs = &renderer->buffers;
+
+	const int* passed_broad_phase_flags = models->mis_passed_broad_phase_flags;
+	const int* intersected_planes = models->mis_intersected_planes;
+
+	// Every instance uses the same scratch buffers, only the light space 
+	// positions are still read from the scene sized buffer.
+	InstanceBuffers ib = { 0 };
+	ib.view_space_positions = rbs->instance_view_space_positions;
+	ib.view_space_normals = rbs->instance_view_space_normals;
+	ib.front_faces = rbs->instance_front_faces;
+	ib.front_faces_vertex_ids = rbs->instance_front_faces_vertex_ids;
+	ib.front_faces_indices = rbs->instance_front_faces_indices;
+	ib.scratch = rbs;
+
+	for (int i = 0; i < models->mis_count; ++i)
+	{
+		if (passed_broad_phase_flags[i])
+		{
+			const int planes_count = intersected_planes[i * STRIDE_INTERSECTED_PLANES];
+			const int* plane_indices = intersected_planes + i * STRIDE_INTERSECTED_PLANES + 1;
+
+			ib.light_space_positions_offset = models->mis_positions_offsets[i];
+
+			// The occluders' positions were transformed into the scene sized 
+			// buffer, so they are transformed again into the scratch buffer.
+			cull_instance_backfaces(renderer, scene, i, plane_indices, planes_count, 0, &ib);
+
+			if (!renderer->settings.indexed_front_faces)
+			{
+				light_instance_front_faces(renderer, scene, i, &ib);
+			}
+
+			clip_instance_to_screen(renderer, scene, i, plane_indices, planes_count, &ib, resources);
+		}
 	}
 }
 
@@ -2206,6 +3340,7 @@ void project_and_draw_clipped(
 	Renderer* renderer,
 	Scene* scene,
 	int mi_index, 
+	const float* clipped_faces,
 	int clipped_face_count,
 	const Resources* resources)
 {
@@ -2216,17 +3351,11 @@ void project_and_draw_clipped(
 	//		 to be fixed.
 
 
-	// TODO: This should take in a vertex buffer pointer. This would mean
-	//		 if we don't do any clipping, we don't need to copy data and 
-	//		 can draw straight from the buffer
-
-
 	RenderTarget* rt = &renderer->target;
 	Models* models = &scene->models;
 	PointLights* point_lights = &scene->point_lights;
 
-	// TODO: Comments. This function renders out the triangles in the clipped face buffer. 
-	const float* clipped_faces = renderer->buffers.clipped_faces;
+	// TODO: Comments. This function renders out the triangles in the clipped faces. 
 
 	// TODO: Refactor, how do I get rid of this duplicated code.
 
@@ -2367,8 +3496,23 @@ void project_and_draw_clipped(
 				vc2[j] *= pv2.w;
 			}
 
-			// Render the triangle.
-			draw_triangle(rt, &renderer->buffers, vc0, vc1, vc2, vc3, STRIDE, point_lights->count, point_lights->depth_maps);
+			// Render the triangle, or save it to be rendered by the tiled rasteriser.
+			if (renderer->settings.tiled_rasterisation)
+			{
+				tiled_rasteriser_bin_triangle(&renderer->tiled_rasteriser, vc0, vc1, vc2);
+			}
+			else
+			{
+				const Rect screen = { 0, 0, rt->canvas.width, rt->canvas.height };
+				if (renderer->settings.half_space_rasterisation)
+				{
+					draw_triangle_half_space(rt, &renderer->buffers, vc0, vc1, vc2, STRIDE, point_lights->count, point_lights->depth_maps, &screen);
+				}
+				else
+				{
+					draw_triangle(rt, &renderer->buffers, vc0, vc1, vc2, vc3, STRIDE, point_lights->count, point_lights->depth_maps, &screen);
+				}
+			}
 		}
 	}
 	else
@@ -2416,62 +3560,397 @@ void project_and_draw_clipped(
 	}
 }
 
-void render(
-	Renderer* renderer, 
-	Scene* scene, 
-	const Resources* resources,
-	const M4 view_matrix)
+// The number of instances each job takes at a time. Culling and lighting cost
+// much more per instance, so they are split finer to spread the larger models
+// between the workers.
+#define TRANSFORM_JOB_GRAIN 64
+#define CULL_JOB_GRAIN 8
+
+// The resources the render stages declare to the frame graph. The shadow maps
+// of the lights that don't have their own stage share the last bit.
+#define MAX_SHADOW_STAGES 16
+
+#define RENDER_RESOURCE_MODELS		(1ull << 0)	// The instances and model bases.
+#define RENDER_RESOURCE_LIGHTS		(1ull << 1)	// The world space lights.
+#define RENDER_RESOURCE_VIEW_SPACE	(1ull << 2)	// The view space instances and lights.
+#define RENDER_RESOURCE_TARGET		(1ull << 3)	// The canvas and depth buffer.
+#define RENDER_RESOURCE_CAMERA_CACHES	(1ull << 4)	// The models' camera culling caches: the bvh, broad phase results, view space spheres and normal matrices.
+#define RENDER_RESOURCE_SHADOW_MAP(i) (1ull << (8 + min(i, MAX_SHADOW_STAGES - 1))) // The light's depth map and light space positions.
+#define RENDER_RESOURCE_SHADOW_MAPS (((1ull << MAX_SHADOW_STAGES) - 1) << 8)
+
+// The data shared by the stages and jobs of a frame.
+typedef struct
 {
-	// TODO: Renderer has camera, but view matrix is passed separate? Refactor.
+	Renderer* renderer;
+	Scene* scene;
+	const Resources* resources;
+	const float* view_matrix;
+	const ViewFrustum* guard_band_frustum;
 
+	int shadow_maps_count; // The number of lights in the point lights' schedule.
 
-	update_depth_maps(renderer, scene);
+} RenderFrame;
 
-	// Draw the depth map temporarily.
-	if (scene->point_lights.count > 0)
-		depth_buffer_draw(&scene->point_lights.depth_maps[0], &renderer->target.canvas, renderer->target.canvas.width - scene->point_lights.depth_maps[0].width, 0);
+static void model_to_view_space_job(void* data, int begin, int end, int worker_index)
+{
+	RenderFrame* frame = (RenderFrame*)data;
+	model_to_view_space_range(&frame->scene->models, frame->view_matrix, begin, end);
+}
+
+static void broad_phase_frustum_culling_job(void* data, int begin, int end, int worker_index)
+{
+	RenderFrame* frame = (RenderFrame*)data;
+	broad_phase_frustum_culling_range(&frame->scene->models, &frame->renderer->settings.view_frustum, frame->guard_band_frustum, begin, end);
+}
+
+static void cull_backfaces_job(void* data, int begin, int end, int worker_index)
+{
+	RenderFrame* frame = (RenderFrame*)data;
+	cull_backfaces_range(frame->renderer, frame->scene, &frame->renderer->job_buffers[worker_index], begin, end);
+}
+
+static void light_front_faces_job(void* data, int begin, int end, int worker_index)
+{
+	RenderFrame* frame = (RenderFrame*)data;
+	light_front_faces_range(frame->renderer, frame->scene, &frame->renderer->job_buffers[worker_index], begin, end);
+}
+
+static void resize_job_buffers(Renderer* renderer)
+{
+	// Make sure each worker's scratch buffers fit the largest model.
+	const RenderBuffers* rbs = &renderer->buffers;
+
+	for (int i = 0; i < renderer->job_system.workers_count; ++i)
+	{
+		RenderBuffers* job_rbs = &renderer->job_buffers[i];
+		if (job_rbs->mbs_max_vertices != rbs->mbs_max_vertices ||
+			job_rbs->mbs_max_positions != rbs->mbs_max_positions ||
+			job_rbs->mbs_max_normals != rbs->mbs_max_normals)
+		{
+			job_rbs->mbs_max_vertices = rbs->mbs_max_vertices;
+			job_rbs->mbs_max_positions = rbs->mbs_max_positions;
+			job_rbs->mbs_max_normals = rbs->mbs_max_normals;
+			render_buffers_resize_instance(job_rbs);
+		}
+	}
+}
+
+static void resize_scene_buffers(Renderer* renderer, Models* models)
+{
+	// The fused pipeline culls, lights and clips each instance in its own small
+	// buffers, so the scene sized ones are only made once they are needed.
+	if (renderer->settings.fused_instance_pipeline)
+	{
+		return;
+	}
+
+	RenderBuffers* rbs = &renderer->buffers;
+	if (rbs->front_faces_total_faces != rbs->total_faces || rbs->front_faces_lights_count != rbs->lights_count)
+	{
+		render_buffers_resize_front_faces(rbs);
+	}
+
+	if (models->view_space_normals_count != models->mis_total_normals)
+	{
+		resize_float_buffer(&models->view_space_normals, models->mis_total_normals * STRIDE_NORMAL);
+		models->view_space_normals_count = models->mis_total_normals;
+	}
+}
+
+static void gather_caster_motion(Models* models, const PointLights* pls)
+{
+	// Adds the motion of each instance that has moved since last frame to the
+	// lights it is in range of, at either its old or new position.
+	for (int i = 0; i < models->mis_count; ++i)
+	{
+		if (!models->mis_dirty_shadow_flags[i])
+		{
+			continue;
+		}
+
+		const float* sphere = models->mis_world_bounding_spheres + i * STRIDE_SPHERE;
+		const V3 centre = v3_read(sphere);
+		const float motion = models->mis_shadow_motion[i];
+		const float range = POINT_LIGHT_SHADOW_FAR_PLANE + sphere[3] + motion;
+
+		for (int j = 0; j < pls->count; ++j)
+		{
+			const V3 to_light = v3_sub_v3(v3_read(pls->world_space_positions + j * STRIDE_POSITION), centre);
+			if (dot(to_light, to_light) < range * range)
+			{
+				pls->depth_maps_dirty_flags[j] = 1;
+				pls->depth_maps_caster_motion[j] += motion;
+			}
+		}
+
+		models->mis_dirty_shadow_flags[i] = 0;
+		models->mis_shadow_motion[i] = 0;
+	}
+}
+
+static int schedule_depth_maps(Renderer* renderer, Scene* scene)
+{
+	// Picks the lights whose depth maps are redrawn this frame, writes them to
+	// the start of the schedule and returns how many there are. The rest of the
+	// lights follow them. Without a budget, every map is redrawn.
+	const PointLights* pls = &scene->point_lights;
+	const int budget = renderer->settings.shadow_map_update_budget;
+
+	gather_caster_motion(&scene->models, pls);
+
+	int* schedule = pls->depth_maps_schedule;
+	float* priorities = pls->depth_maps_priorities;
+
+	if (budget <= 0)
+	{
+		for (int i = 0; i < pls->count; ++i)
+		{
+			schedule[i] = i;
+		}
+
+		return pls->count;
+	}
+
+	// The maps that haven't been drawn since the light was given its region of
+	// the shadow atlas go first, they count towards the budget like the rest.
+	// Until they are drawn the atlas leaves them empty, so they cast no shadows.
+	int dirty_count = 0;
+
+	for (int i = 0; i < pls->count; ++i)
+	{
+		const int pos_i = i * STRIDE_POSITION;
+		const V3 position = v3_read(pls->world_space_positions + pos_i);
+
+		schedule[i] = i;
+
+		if (-1 == pls->depth_maps_frames[i])
+		{
+			priorities[i] = FLT_MAX;
+			++dirty_count;
+			continue;
+		}
+
+		// The map is still correct if nothing has moved since it was drawn, it
+		// goes after all the maps that need redrawing.
+		const float light_moved = size(v3_sub_v3(position, v3_read(pls->depth_maps_positions + pos_i)));
+		if (light_moved == 0 && !pls->depth_maps_dirty_flags[i])
+		{
+			priorities[i] = -1.f;
+			continue;
+		}
+
+		// The brighter and closer to the camera the light is, the more its 
+		// shadows are noticed. The longer the map has been out of date and the
+		// further the light and the casters in its range have moved, the more 
+		// wrong its shadows are.
+		const float strength = pls->attributes[i * STRIDE_POINT_LIGHT_ATTRIBUTES + 3];
+		const V3 to_camera = v3_sub_v3(renderer->camera.position, position);
+		const float importance = strength / (1.f + dot(to_camera, to_camera));
+
+		const int frames_stale = renderer->frame_index - pls->depth_maps_frames[i];
+		const float moved = light_moved + pls->depth_maps_caster_motion[i];
+
+		priorities[i] = importance * frames_stale * (1.f + moved);
+		++dirty_count;
+	}
+
+	// There are only a few lights, so an insertion sort puts the highest 
+	// priorities first, ties keep the light order.
+	for (int i = 1; i < pls->count; ++i)
+	{
+		const int light = schedule[i];
+		int j = i - 1;
+
+		while (j >= 0 && priorities[schedule[j]] < priorities[light])
+		{
+			schedule[j + 1] = schedule[j];
+			--j;
+		}
+
+		schedule[j + 1] = light;
+	}
+
+	return min(dirty_count, budget);
+}
+
+static void shadow_map_stage(void* data, int index, int worker_index)
+{
+	RenderFrame* frame = (RenderFrame*)data;
+
+	const int* schedule = frame->scene->point_lights.depth_maps_schedule;
+	RenderBuffers* scratch = &frame->renderer->job_buffers[worker_index];
+
+	// The last stage takes the lights that didn't get their own stage. The 
+	// lights after the scheduled ones only have their positions written.
+	const int end = (MAX_SHADOW_STAGES - 1 == index) ? frame->scene->point_lights.count : index + 1;
+
+	for (int i = index; i < end; ++i)
+	{
+		if (i < frame->shadow_maps_count)
+		{
+			update_depth_map(frame->renderer, frame->scene, schedule[i], scratch);
+		}
+		else
+		{
+			update_light_space_positions(frame->renderer, frame->scene, schedule[i], scratch);
+		}
+	}
+}
+
+static void depth_map_debug_stage(void* data, int index, int worker_index)
+{
+	RenderFrame* frame = (RenderFrame*)data;
+	Canvas* canvas = &frame->renderer->target.canvas;
+
+	// Draw the face of the first light's cube map that looks along -z temporarily.
+	// The first light isn't always drawn by the first shadow stage, so this
+	// waits for all of them.
+	const DepthBuffer depth_map = cube_map_face(&frame->scene->point_lights.depth_maps[0], CUBE_MAP_FACE_NEGATIVE_Z);
+	depth_buffer_draw(&depth_map, canvas, canvas->width - depth_map.width, 0);
+}
+
+static void camera_culling_stage(void* data, int index, int worker_index)
+{
+	RenderFrame* frame = (RenderFrame*)data;
+	Renderer* renderer = frame->renderer;
+	Scene* scene = frame->scene;
+
+	// The per instance stages can be split between the job system's workers.
+	const int parallel = renderer->settings.parallel_instance_stages;
+	const int mis_count = scene->models.mis_count;
 
-	
 	Timer t = timer_start();
+
+	// Cull the instances outside of the frustum before transforming them.
+	M4 view_projection_matrix;
+	m4_mul_m4(renderer->settings.projection_matrix, frame->view_matrix, view_projection_matrix);
+
+	ViewFrustum world_frustum;
+	view_frustum_from_m4(&world_frustum, view_projection_matrix);
+
+	world_space_frustum_culling(&scene->models, &world_frustum);
+	//printf("world_space_frustum_culling took: %d\n", timer_get_elapsed(&t));
+	timer_restart(&t);
 	
 	// Transform object space positions to view space.
-	model_to_view_space(&scene->models, view_matrix);
+	if (parallel)
+	{
+		parallel_for(&renderer->job_system, worker_index, mis_count, TRANSFORM_JOB_GRAIN, model_to_view_space_job, frame);
+	}
+	else
+	{
+		model_to_view_space(&scene->models, frame->view_matrix);
+	}
 	//printf("model_to_view_space took: %d\n", timer_get_elapsed(&t));
 	timer_restart(&t);
 
-	lights_world_to_view_space(&scene->point_lights, view_matrix);
+	lights_world_to_view_space(&scene->point_lights, frame->view_matrix);
 	//printf("lights_world_to_view_space took: %d\n", timer_get_elapsed(&t));
 	timer_restart(&t);
 
 	// Perform broad phase frustum culling to avoid unnecessary backface culling.
-	broad_phase_frustum_culling(&scene->models, &renderer->settings.view_frustum);
+	if (parallel)
+	{
+		parallel_for(&renderer->job_system, worker_index, mis_count, TRANSFORM_JOB_GRAIN, broad_phase_frustum_culling_job, frame);
+	}
+	else
+	{
+		broad_phase_frustum_culling(&scene->models, &renderer->settings.view_frustum, frame->guard_band_frustum);
+	}
 	//printf("broad_phase_frustum_culling took: %d\n", timer_get_elapsed(&t));
 	timer_restart(&t);
 
-	// Perform backface culling.
-	cull_backfaces(renderer, &scene->models);
-	//printf("cull_backfaces took: %d\n", timer_get_elapsed(&t));
-	timer_restart(&t);
+	// Cull the instances hidden behind the occluders.
+	if (renderer->settings.occlusion_culling)
+	{
+		occlusion_culling(renderer, &scene->models);
+		//printf("occlusion_culling took: %d\n", timer_get_elapsed(&t));
+		timer_restart(&t);
+	}
+}
 
-	// Apply lighting here so that the if a vertex is clipped closer
-	// to the light, the lighing doesn't change.
-	light_front_faces(renderer, scene);
-	//printf("light_front_faces took: %d\n", timer_get_elapsed(&t));
-	timer_restart(&t);
+static void camera_draw_stage(void* data, int index, int worker_index)
+{
+	RenderFrame* frame = (RenderFrame*)data;
+	Renderer* renderer = frame->renderer;
+	Scene* scene = frame->scene;
+	const Resources* resources = frame->resources;
 
-	// Draws the front faces by performing the narrow phase of frustum culling
-	// and then projecting and rasterising the faces.
-	clip_to_screen(renderer, view_matrix, scene, resources);
-	//printf("clip_to_screen took: %d\n", timer_get_elapsed(&t));
-	timer_restart(&t);
+	const int parallel = renderer->settings.parallel_instance_stages;
+	const int mis_count = scene->models.mis_count;
+
+	Timer t = timer_start();
+
+	// Clear the tiles so the projected triangles can be binned.
+	if (renderer->settings.tiled_rasterisation)
+	{
+		// pos, albedo, diffuse, light space pos * count
+		const int STRIDE = STRIDE_V4 + STRIDE_COLOUR + STRIDE_COLOUR + scene->point_lights.count * STRIDE_V4;
+		tiled_rasteriser_begin(&renderer->tiled_rasteriser, STRIDE);
+	}
+
+	if (renderer->settings.fused_instance_pipeline)
+	{
+		render_instances_fused(renderer, scene, resources);
+		//printf("render_instances_fused took: %d\n", timer_get_elapsed(&t));
+		timer_restart(&t);
+	}
+	else
+	{
+		// Perform backface culling.
+		if (parallel)
+		{
+			parallel_for(&renderer->job_system, worker_index, mis_count, CULL_JOB_GRAIN, cull_backfaces_job, frame);
+		}
+		else
+		{
+			cull_backfaces(renderer, scene);
+		}
+		//printf("cull_backfaces took: %d\n", timer_get_elapsed(&t));
+		timer_restart(&t);
+
+		// Apply lighting here so that the if a vertex is clipped closer
+		// to the light, the lighing doesn't change.
+		// In the indexed mode, the vertices are lit as the faces are assembled.
+		if (!renderer->settings.indexed_front_faces)
+		{
+			if (parallel)
+			{
+				parallel_for(&renderer->job_system, worker_index, mis_count, CULL_JOB_GRAIN, light_front_faces_job, frame);
+			}
+			else
+			{
+				light_front_faces(renderer, scene);
+			}
+			//printf("light_front_faces took: %d\n", timer_get_elapsed(&t));
+			timer_restart(&t);
+		}
 
+		// Draws the front faces by performing the narrow phase of frustum culling
+		// and then projecting and rasterising the faces.
+		clip_to_screen(renderer, frame->view_matrix, scene, resources);
+		//printf("clip_to_screen took: %d\n", timer_get_elapsed(&t));
+		timer_restart(&t);
+	}
+
+	// Rasterise the binned triangles.
+	if (renderer->settings.tiled_rasterisation)
+	{
+		tiled_rasteriser_flush(&renderer->tiled_rasteriser, &renderer->job_system, worker_index, &renderer->target, &renderer->settings, scene->point_lights.count, scene->point_lights.depth_maps);
+		//printf("tiled_rasteriser_flush took: %d\n", timer_get_elapsed(&t));
+		timer_restart(&t);
+	}
+}
 
+static void debug_draw_stage(void* data, int index, int worker_index)
+{
+	RenderFrame* frame = (RenderFrame*)data;
+	Renderer* renderer = frame->renderer;
+	Scene* scene = frame->scene;
 
 	// TEMP: Debugging
 
 	debug_draw_point_lights(&renderer->target.canvas, &renderer->settings, &scene->point_lights);
-	//printf("debug_draw_point_lights took: %d\n", timer_get_elapsed(&t));
-	timer_restart(&t);
 	
 	// Draw crosshair temporarily cause looks cool.
 	int r = 2;
@@ -2485,225 +3964,482 @@ void render(
 	}
 }
 
-void update_depth_maps(Renderer* renderer, const Scene* scene)
+void render(
+	Renderer* renderer, 
+	Scene* scene, 
+	const Resources* resources,
+	const M4 view_matrix)
 {
+	// TODO: Renderer has camera, but view matrix is passed separate? Refactor.
 
-	// TODO: To avoid recalculating shadows for each mesh. We should only do it for ones that have moved.
-	//		 This should save us a lot of computation I believe. But also means we need a static and dynamic
-	//		 depth buffer. Something like this anyways too tired to think of now. 
-	// 
-	//		 Need to look into this properly.
-	//		 But for example, for the main map, that's not moving, we might have a single directional (or other) light as the 
-	//		 sun, we could generate a depth map from all the static geometry, we would have to draw dynamic to a separate. But
-	//		 this would give us proper shadows and essentially just make it a texture lookup.
+	// Give the lights their part of the shadow atlas before deciding which of
+	// their maps to draw, as the lights given a new region must be redrawn.
+	if (STATUS_OK != shadow_atlas_update(&renderer->shadow_atlas, &scene->point_lights, renderer->camera.position, renderer->settings.cached_static_shadows))
+	{
+		log_error("Failed to update the shadow atlas.");
+		return;
+	}
 
-	// TODO: At some point we definitely want to be able to render a directional light for the sun/moon, 
-	//		 then the environment can have a static shadow map. Then the dynamic stuff can be renderered to a separate map.
-	
-	// TODO: Rename shadow maps?
+	// The instances that have stopped moving are cached with the static ones.
+	if (renderer->settings.cached_static_shadows)
+	{
+		mis_promote_static(&scene->models);
+	}
 
-	// TODO: Instead of 6 different textures for a point light, have one big/long cubemap?
+	RenderFrame frame = { 
+		renderer, scene, resources, view_matrix, 
+		renderer->settings.guard_band_clipping ? &renderer->settings.guard_band_frustum : NULL,
+		schedule_depth_maps(renderer, scene)
+	};
 
-	const Models* models = &scene->models;
-	const PointLights* pls = &scene->point_lights;
+	resize_job_buffers(renderer);
+	resize_scene_buffers(renderer, &scene->models);
 
-	for (int i = 0; i < pls->count; ++i)
+	// The shadow maps don't depend on the camera, so the lights are drawn at
+	// the same time as each other and the camera culling.
+	FrameGraph* fg = &renderer->frame_graph;
+	frame_graph_begin(fg);
+
+	const int lights_count = scene->point_lights.count;
+	const int shadow_stages_count = min(lights_count, MAX_SHADOW_STAGES);
+
+	for (int i = 0; i < shadow_stages_count; ++i)
 	{
-		DepthBuffer* depth_map = &pls->depth_maps[i];
-		depth_buffer_fill(depth_map, 1.f);
+		frame_graph_add_stage(fg, "ShadowMap", shadow_map_stage, &frame, i, 
+			RENDER_RESOURCE_MODELS | RENDER_RESOURCE_LIGHTS, RENDER_RESOURCE_SHADOW_MAP(i));
+	}
 
-		int pos_i = i * STRIDE_POSITION;
+	if (lights_count > 0)
+	{
+		frame_graph_add_stage(fg, "DepthMapDebug", depth_map_debug_stage, &frame, 0, 
+			RENDER_RESOURCE_SHADOW_MAPS, RENDER_RESOURCE_TARGET);
+	}
 
-		V3 pos = v3_read(pls->world_space_positions + pos_i);
-		
-		// TODO: TEMP, hardcoded.
-		V3 dir = { 0, 0, -1 };
-		
-		// Create MV matrix for light.
-		M4 view;
-		look_at(v3_mul_f(pos, -1.f), v3_mul_f(dir, -1.f), view);
+	// The camera culling only writes the view space data, and the caches in the
+	// models that the shadow maps don't read, so it runs alongside them.
+	frame_graph_add_stage(fg, "CameraCulling", camera_culling_stage, &frame, 0, 
+		RENDER_RESOURCE_MODELS | RENDER_RESOURCE_LIGHTS, RENDER_RESOURCE_VIEW_SPACE | RENDER_RESOURCE_CAMERA_CACHES);
 
-		// 90 degrees will give us a face of the cube map we want.
-		float fov = 90.f;
-		float aspect_ratio = depth_map->width / (float)depth_map->height;
+	frame_graph_add_stage(fg, "CameraDraw", camera_draw_stage, &frame, 0, 
+		RENDER_RESOURCE_MODELS | RENDER_RESOURCE_VIEW_SPACE | RENDER_RESOURCE_CAMERA_CACHES | RENDER_RESOURCE_SHADOW_MAPS, RENDER_RESOURCE_TARGET);
 
-		// TODO: TEMP: Hardcoded settings
+	frame_graph_add_stage(fg, "DebugDraw", debug_draw_stage, &frame, 0, 
+		RENDER_RESOURCE_MODELS | RENDER_RESOURCE_VIEW_SPACE | RENDER_RESOURCE_CAMERA_CACHES, RENDER_RESOURCE_TARGET);
 
-		float near_plane = 1.f;
-		float far_plane = 100.f; // TODO: Defined from strength of point light? with attenuation taken into account?
+	frame_graph_execute(fg, &renderer->job_system);
 
-		M4 proj;
-		m4_projection(fov, aspect_ratio, near_plane, far_plane, proj);
-		
-		const int mis_count = models->mis_count;
+	++renderer->frame_index;
+}
 
-		const float* mis_transforms = models->mis_transforms;
+// The light's cube map while it is drawn.
+typedef struct
+{
+	V3 position;
+	M4 projection; // The 90 degree projection of every face.
 
-		const int* mis_base_ids = models->mis_base_ids;
+	// In a face's view space, which is the same for every face. The depth map's
+	// rasteriser only draws the pixels inside the face, so like the camera's 
+	// guard band, the side planes only need clipping against if a face can leave
+	// the guard band.
+	ViewFrustum view_frustum;
+	ViewFrustum guard_band_frustum;
 
-		const int* mbs_positions_counts = models->mbs_positions_counts;
-		const int* mbs_positions_offsets = models->mbs_positions_offsets;
-		const float* object_space_positions = models->mbs_object_space_positions;
+	float* light_space_positions; // The light's part of the light space positions buffer.
 
-		
-		// TODO: Rename vars.
+} LightView;
 
-		int positions_offset = 0;
+// Converts a light clip space position to the depth map's screen space.
+static V4 light_clip_to_depth_map(const DepthBuffer* depth_map, V4 clip, float bias)
+{
+	// Perform perspective divide to convert Clip Space to NDC space (-1:1 for x,y,z).
+	const float inv_w = 1.0f / clip.w;
+
+	V4 ndc = {
+		clip.x * inv_w,
+		clip.y * inv_w,
+		clip.z * inv_w,
+		inv_w
+	};
+
+	// Convert NDC to screen space by first converting to 0-1 in all axis.
+	V4 ssp = {
+		(ndc.x + 1) * 0.5f * depth_map->width,
+		(-ndc.y + 1) * 0.5f * depth_map->height,
+		(ndc.z + 1) * 0.5f,
+		inv_w
+	};
 
-		int light_out_index = 0;
+	ssp.z += bias;
+
+	return ssp;
+}
+
+// Draws a face to one of the cube map's faces, the positions are in that face's
+// view space. The face is clipped against the planes it crosses first.
+static void draw_face_to_depth_map(DepthBuffer* depth_map, const LightView* light, const V3* positions, const int* plane_indices, int planes_count, float bias)
+{
+	const Plane* planes = light->view_frustum.planes;
 
-		for (int j = 0; j < mis_count; ++j)
+	// Only the faces of an instance crossing the frustum need checking.
+	int straddled_planes = 0;
+
+	if (planes_count > 0)
+	{
+		const int outcode0 = clip_outcode(planes, plane_indices, planes_count, positions[0]);
+		const int outcode1 = clip_outcode(planes, plane_indices, planes_count, positions[1]);
+		const int outcode2 = clip_outcode(planes, plane_indices, planes_count, positions[2]);
+
+		// Every vertex is outside the same plane, so the face isn't seen from here.
+		if (outcode0 & outcode1 & outcode2)
 		{
-			// Convert the model base object space positions to world space
-			// for the current model instance.
-			const int mb_index = mis_base_ids[j];
-			
-			// Calculate the new model matrix from the mi's transform.
-			int transform_index = j * STRIDE_MI_TRANSFORM;
-			
-			M4 model_matrix;
-			m4_model_matrix(
-				v3_read(mis_transforms + transform_index), 
-				v3_read(mis_transforms + transform_index + 3), 
-				v3_read(mis_transforms + transform_index + 6), 
-				model_matrix
-			);
+			return;
+		}
 
-			M4 model_view;
-			m4_mul_m4(view, model_matrix, model_view);
+		straddled_planes = outcode0 | outcode1 | outcode2;
+	}
 
-			for (int k = 0; k < models->mbs_faces_counts[mb_index]; ++k)
-			{
-				const int face_index = (models->mbs_faces_offsets[mb_index] + k) * STRIDE_FACE_VERTICES;
+	// Write the face as a polygon, so clipping only changes how many vertices 
+	// it has. Only the view space position is needed.
+	float polygon_a[MAX_CLIPPED_POLYGON_VERTICES * STRIDE_POSITION];
+	float polygon_b[MAX_CLIPPED_POLYGON_VERTICES * STRIDE_POSITION];
 
-				// Get the indices to the first component of each vertex position.
-				const int index_v0 = models->mbs_face_position_indices[face_index] + mbs_positions_offsets[mb_index];
-				const int index_v1 = models->mbs_face_position_indices[face_index + 1] + mbs_positions_offsets[mb_index];
-				const int index_v2 = models->mbs_face_position_indices[face_index + 2] + mbs_positions_offsets[mb_index];
+	float* polygon_in = polygon_a;
+	float* polygon_out = polygon_b;
 
-				const int index_parts_v0 = index_v0 * STRIDE_POSITION;
-				const int index_parts_v1 = index_v1 * STRIDE_POSITION;
-				const int index_parts_v2 = index_v2 * STRIDE_POSITION;
+	for (int v = 0; v < STRIDE_FACE_VERTICES; ++v)
+	{
+		v3_write(polygon_in + v * STRIDE_POSITION, positions[v]);
+	}
 
-				// Get the vertices from the face indices.
-				V4 osp0 = v3_read_to_v4(object_space_positions + index_parts_v0, 1.f);
-				V4 osp1 = v3_read_to_v4(object_space_positions + index_parts_v1, 1.f);
-				V4 osp2 = v3_read_to_v4(object_space_positions + index_parts_v2, 1.f);
+	int polygon_vertices_count = STRIDE_FACE_VERTICES;
+
+	for (int i = 0; i < planes_count && polygon_vertices_count >= 3; ++i)
+	{
+		if (straddled_planes & (1 << i))
+		{
+			polygon_vertices_count = clip_polygon_against_plane(&planes[plane_indices[i]], polygon_in, polygon_vertices_count, polygon_out, STRIDE_POSITION);
+
+			float* temp = polygon_in;
+			polygon_in = polygon_out;
+			polygon_out = temp;
+		}
+	}
+
+	if (polygon_vertices_count < 3)
+	{
+		return;
+	}
+
+	// The perspective projection transforms the coordinates into clip space, 
+	// then they are converted to the depth map's screen space.
+	V4 ssp[MAX_CLIPPED_POLYGON_VERTICES];
+
+	for (int v = 0; v < polygon_vertices_count; ++v)
+	{
+		V4 clip;
+		m4_mul_v4(light->projection, v3_read_to_v4(polygon_in + v * STRIDE_POSITION, 1.f), &clip);
 
-				// TODO: For this, refactor to do model view transformation first per vertex
-				//		 so we're not doing it multiple times with the indexed rendering. 
-				//		
-				// TODO: This should all work the same as the normal rendering really, frustum
-				//		 culling and clipping etc.
+		ssp[v] = light_clip_to_depth_map(depth_map, clip, bias);
+	}
 
-				V4 vsp0, vsp1, vsp2;
-				m4_mul_v4(model_view, osp0, &vsp0);
-				m4_mul_v4(model_view, osp1, &vsp1);
-				m4_mul_v4(model_view, osp2, &vsp2);
+	// Draw the polygon as a fan around the first vertex.
+	for (int v = 1; v < polygon_vertices_count - 1; ++v)
+	{
+		draw_depth_triangle(depth_map, ssp[0], ssp[v], ssp[v + 1]);
+	}
+}
 
-				V3 vsp0_v3 = v4_xyz(vsp0);
-				V3 vsp1_v3 = v4_xyz(vsp1);
-				V3 vsp2_v3 = v4_xyz(vsp2);
+// Draws the back faces of the instance to the faces of the cube map that can 
+// see it, and writes the light space positions of the instance. Works the same
+// as the camera's passes, the instance's bounding sphere is tested against each 
+// face's frustum and the faces are classified in object space.
+static void write_instance_light_space_positions(const Models* models, int mi_index, V3 light_position, float* light_space_positions, float* light_relative_positions, M4 model_light)
+{
+	// Transform the positions to world space relative to the light, which is
+	// the same for every face. Use the model matrix cached by mi_set_transform.
+	const int mb_index = models->mis_base_ids[mi_index];
+	const int positions_offset = models->mis_positions_offsets[mi_index];
+	const int positions_count = models->mbs_positions_counts[mb_index];
+
+	memcpy(model_light, models->mis_model_matrices + mi_index * STRIDE_M4, sizeof(M4));
+	model_light[12] -= light_position.x;
+	model_light[13] -= light_position.y;
+	model_light[14] -= light_position.z;
+
+	m4_mul_positions(model_light, models->mbs_object_space_positions + models->mbs_positions_offsets[mb_index] * STRIDE_POSITION, positions_count, light_relative_positions);
+
+	// These are also the light space positions, the camera picks the face of the
+	// cube map per pixel so it can see any of them.
+	for (int j = 0; j < positions_count; ++j)
+	{
+		v4_write(light_space_positions + (j + positions_offset) * STRIDE_V4, v3_read_to_v4(light_relative_positions + j * STRIDE_POSITION, 1.f));
+	}
+}
+
+static void draw_instance_to_cube_map(const Models* models, int mi_index, DepthBuffer* cube_map, const LightView* light, RenderBuffers* scratch)
+{
+	const int mb_index = models->mis_base_ids[mi_index];
+
+	float* light_relative_positions = scratch->light_view_space_positions;
 
-				V3 face_normal = normalised(cross(v3_sub_v3(vsp1_v3, vsp0_v3), v3_sub_v3(vsp2_v3, vsp0_v3)));
+	M4 model_light;
+	write_instance_light_space_positions(models, mi_index, light->position, light->light_space_positions, light_relative_positions, model_light);
 
-				// Only fill depth map from back faces, need the normal so doing this manually.
-				if (dot(vsp0_v3, face_normal) <= 0)
+	// Broad phase per face, the face views don't scale so the radius stays the same.
+	const float* sphere = models->mis_world_bounding_spheres + mi_index * STRIDE_SPHERE;
+	const V3 centre = v3_sub_v3(v3_read(sphere), light->position);
+	const float radius = sphere[3];
+
+	int plane_indices[CUBE_MAP_FACES][MAX_FRUSTUM_PLANES];
+	int planes_counts[CUBE_MAP_FACES];
+	int visible_faces = 0;
+
+	for (int f = 0; f < CUBE_MAP_FACES; ++f)
+	{
+		const V3 view_space_centre = cube_map_face_view_space(f, centre);
+
+		int visible = 1;
+		planes_counts[f] = 0;
+
+		for (int i = 0; i < light->view_frustum.planes_count; ++i)
+		{
+			const float dist = signed_distance(&light->view_frustum.planes[i], view_space_centre);
+			if (dist < -radius)
+			{
+				visible = 0;
+				break;
+			}
+			else if (dist < radius)
+			{
+				if (i >= FRUSTUM_PLANE_RIGHT && signed_distance(&light->guard_band_frustum.planes[i], view_space_centre) >= radius)
 				{
-					// TODO: What do we write out now???
 					continue;
 				}
 
-				// The perspective projection transforms the coordinates into clip space, before the perpsective divide.
-				// which just converts the homogeneous coordinates to cartesian ones. 
-				V4 clip0, clip1, clip2;
-				m4_mul_v4(proj, vsp0, &clip0);
-				m4_mul_v4(proj, vsp1, &clip1);
-				m4_mul_v4(proj, vsp2, &clip2);
-
-				// Save the light space positions for each vertex.
-				const int index_lsp_parts_v0 = (models->mbs_face_position_indices[face_index] + positions_offset) * 4;
-				const int index_lsp_parts_v1 = (models->mbs_face_position_indices[face_index + 1] + positions_offset) * 4;
-				const int index_lsp_parts_v2 = (models->mbs_face_position_indices[face_index + 2] + positions_offset) * 4;
-
-				// Perspective-correct intertpolation of values that have undergone perspective divide dont work?
-				// TODO: Comments and understand all this a bit more.
-				v4_write(renderer->buffers.light_space_positions + index_lsp_parts_v0, clip0);
-				v4_write(renderer->buffers.light_space_positions + index_lsp_parts_v1, clip1);
-				v4_write(renderer->buffers.light_space_positions + index_lsp_parts_v2, clip2);
-
-				// Perform perspective divide to convert Clip Space to NDC space (-1:1 for x,y,z).
-				const float inv_w0 = 1.0f / clip0.w;
-				const float inv_w1 = 1.0f / clip1.w;
-				const float inv_w2 = 1.0f / clip2.w;
-				
-				V4 ndc0 = {
-					clip0.x * inv_w0,
-					clip0.y * inv_w0,
-					clip0.z * inv_w0,
-					inv_w0
-				};
+				plane_indices[f][planes_counts[f]++] = i;
+			}
+		}
 
-				V4 ndc1 = {
-					clip1.x * inv_w1,
-					clip1.y * inv_w1,
-					clip1.z * inv_w1,
-					inv_w1
-				};
+		if (visible)
+		{
+			visible_faces |= 1 << f;
+		}
+	}
 
-				V4 ndc2 = {
-					clip2.x * inv_w2,
-					clip2.y * inv_w2,
-					clip2.z * inv_w2,
-					inv_w2
-				};
+	if (!visible_faces)
+	{
+		return;
+	}
 
-				// Convert NDC to screen space by first converting to 0-1 in all axis.
-				V4 ssp0 = {
-					(ndc0.x + 1) * 0.5f * depth_map->width,
-					(-ndc0.y + 1) * 0.5f * depth_map->height,
-					(ndc0.z + 1) * 0.5f,
-					inv_w0
-				};
+	DepthBuffer faces[CUBE_MAP_FACES];
+	for (int f = 0; f < CUBE_MAP_FACES; ++f)
+	{
+		faces[f] = cube_map_face(cube_map, f);
+	}
 
-				V4 ssp1 = {
-					(ndc1.x + 1) * 0.5f * depth_map->width,
-					(-ndc1.y + 1) * 0.5f * depth_map->height,
-					(ndc1.z + 1) * 0.5f,
-					inv_w1
-				};
+	// Put the light in the instance's object space, the same as the camera in
+	// cull_instance_backfaces. The light is at the origin of model_light's space.
+	const V3 translation = v3_read(model_light + 12);
 
-				V4 ssp2 = {
-					(ndc2.x + 1) * 0.5f * depth_map->width,
-					(-ndc2.y + 1) * 0.5f * depth_map->height,
-					(ndc2.z + 1) * 0.5f,
-					inv_w2
-				};
-				
-				// Apply slope scaled depth bias to fix shadow acne and peter panning.
-				
-				// Don't allow the cos angle to be negative, the bias should push the shadow away from the light.
-				float cos_theta = fabsf(dot(face_normal, v3_mul_f(dir, -1.f)));
-
-				// TODO: This will have to be changed for each scene i think.
-				const float constant_bias = 0.00001f;
-
-				// Clamp the cos_theta to a value near 0 so we don't divide by 0.
-				cos_theta = max(cos_theta, 0.00001f);
-				
-				// We want a large bias when the light dir and surface dir are perpendicular
-				// because shadow acne is most common there.
-				float slope_bias = constant_bias * sqrtf(1.f - cos_theta * cos_theta) / cos_theta;
-				ssp0.z += slope_bias;
-				ssp1.z += slope_bias;
-				ssp2.z += slope_bias;
-
-
-				// Draw to the depth buffer.
-				draw_depth_triangle(depth_map, ssp0, ssp1, ssp2);
+	const V3 axis_x = v3_read(model_light);
+	const V3 axis_y = v3_read(model_light + 4);
+	const V3 axis_z = v3_read(model_light + 8);
+
+	const V3 light_position = {
+		-dot(axis_x, translation) / size_squared(axis_x),
+		-dot(axis_y, translation) / size_squared(axis_y),
+		-dot(axis_z, translation) / size_squared(axis_z)
+	};
+
+	// Mirroring the instance flips the winding of its faces.
+	const V3 scale = v3_read(models->mis_transforms + mi_index * STRIDE_MI_TRANSFORM + 6);
+	const float winding = (scale.x * scale.y * scale.z < 0) ? -1.f : 1.f;
+
+	const int mb_faces_offset = models->mbs_faces_offsets[mb_index];
+	const float* face_planes = models->mbs_object_space_face_planes;
+
+	for (int k = 0; k < models->mbs_faces_counts[mb_index]; ++k)
+	{
+		// Only fill depth map from back faces, so the light is behind the face's plane.
+		const float* plane = face_planes + (mb_faces_offset + k) * STRIDE_PLANE;
+		if ((dot(v3_read(plane), light_position) + plane[3]) * winding >= 0)
+		{
+			continue;
+		}
+
+		const int face_index = (mb_faces_offset + k) * STRIDE_FACE_VERTICES;
+
+		V3 positions[STRIDE_FACE_VERTICES];
+		for (int v = 0; v < STRIDE_FACE_VERTICES; ++v)
+		{
+			positions[v] = v3_read(light_relative_positions + models->mbs_face_position_indices[face_index + v] * STRIDE_POSITION);
+		}
+
+		V3 face_normal = normalised(cross(v3_sub_v3(positions[1], positions[0]), v3_sub_v3(positions[2], positions[0])));
+
+		for (int f = 0; f < CUBE_MAP_FACES; ++f)
+		{
+			if (!(visible_faces & (1 << f)))
+			{
+				continue;
 			}
-		
-			positions_offset += models->mbs_positions_counts[mb_index];
+
+			// Apply slope scaled depth bias to fix shadow acne and peter panning.
+
+			// Don't allow the cos angle to be negative, the bias should push the shadow away from the light.
+			float cos_theta = fabsf(dot(face_normal, CUBE_MAP_FACE_AXES[f].forward));
+
+			// TODO: This will have to be changed for each scene i think.
+			const float constant_bias = 0.00001f;
+
+			// Clamp the cos_theta to a value near 0 so we don't divide by 0.
+			cos_theta = max(cos_theta, 0.00001f);
+
+			// We want a large bias when the light dir and surface dir are perpendicular
+			// because shadow acne is most common there.
+			const float slope_bias = constant_bias * sqrtf(1.f - cos_theta * cos_theta) / cos_theta;
+
+			V3 view_space_positions[STRIDE_FACE_VERTICES];
+			for (int v = 0; v < STRIDE_FACE_VERTICES; ++v)
+			{
+				view_space_positions[v] = cube_map_face_view_space(f, positions[v]);
+			}
+
+			draw_face_to_depth_map(&faces[f], light, view_space_positions, plane_indices[f], planes_counts[f], slope_bias);
+		}
+	}
+}
+
+void update_depth_map(Renderer* renderer, const Scene* scene, int light_index, RenderBuffers* scratch)
+{
+	// TODO: At some point we definitely want to be able to render a directional light for the sun/moon, 
+	//		 then the environment can have a static shadow map. Then the dynamic stuff can be renderered to a separate map.
+	
+	// TODO: Rename shadow maps?
+
+	const Models* models = &scene->models;
+	const PointLights* pls = &scene->point_lights;
+
+	DepthBuffer* depth_map = &pls->depth_maps[light_index];
+
+	int pos_i = light_index * STRIDE_POSITION;
+
+	V3 pos = v3_read(pls->world_space_positions + pos_i);
+
+	LightView light;
+	light.position = pos;
+
+	// 90 degrees will give us a face of the cube map.
+	const float fov = 90.f;
+	const float aspect_ratio = 1.f;
+
+	m4_projection(fov, aspect_ratio, POINT_LIGHT_SHADOW_NEAR_PLANE, POINT_LIGHT_SHADOW_FAR_PLANE, light.projection);
+
+	view_frustum_init(&light.view_frustum, POINT_LIGHT_SHADOW_NEAR_PLANE, POINT_LIGHT_SHADOW_FAR_PLANE, fov, aspect_ratio);
+	guard_band_frustum_init(&light.guard_band_frustum, POINT_LIGHT_SHADOW_NEAR_PLANE, POINT_LIGHT_SHADOW_FAR_PLANE, fov, aspect_ratio);
+	
+	const int mis_count = models->mis_count;
+
+	// Each light writes its light space positions to its own part of the 
+	// buffer, the same part that cull_backfaces reads them from.
+	light.light_space_positions = renderer->buffers.light_space_positions + models->mis_total_faces * STRIDE_FACE_VERTICES * STRIDE_V4 * light_index;
+
+	// Save what the map is drawn with for the scheduler.
+	pls->depth_maps_frames[light_index] = renderer->frame_index;
+	pls->depth_maps_dirty_flags[light_index] = 0;
+	pls->depth_maps_caster_motion[light_index] = 0;
+	v3_write(pls->depth_maps_positions + pos_i, pos);
+
+	// Drawing the map writes every instance's light space positions, the static
+	// ones are kept with the static map if it is cached.
+	pls->light_space_positions_versions[light_index] = models->static_version;
+
+	DepthBuffer* static_depth_map = &pls->static_depth_maps[light_index];
+
+	// Without the cache, every instance is drawn each frame. The static map is
+	// only given a region of the atlas once the cache is on.
+	if (!renderer->settings.cached_static_shadows || !static_depth_map->data)
+	{
+		depth_buffer_fill(depth_map, 1.f);
+
+		for (int i = 0; i < mis_count; ++i)
+		{
+			draw_instance_to_cube_map(models, i, depth_map, &light, scratch);
 		}
+
+		return;
+	}
+
+	// The static instances are drawn to the light's static map, which is only
+	// redrawn if the light has moved or a static instance has changed since. 
+	// Their light space positions are kept in the buffer between frames too. 
+	// The atlas marks the map as not drawn when the light is resized.
+	float* static_position = pls->static_depth_maps_positions + pos_i;
+
+	const int static_valid = 
+		pls->static_depth_maps_versions[light_index] == models->static_version &&
+		v3_read(static_position).x == pos.x && v3_read(static_position).y == pos.y && v3_read(static_position).z == pos.z;
+
+	if (!static_valid)
+	{
+		depth_buffer_fill(static_depth_map, 1.f);
+
+		for (int i = 0; i < mis_count; ++i)
+		{
+			if (models->mis_static_flags[i])
+			{
+				draw_instance_to_cube_map(models, i, static_depth_map, &light, scratch);
+			}
+		}
+
+		pls->static_depth_maps_versions[light_index] = models->static_version;
+		v3_write(static_position, pos);
+	}
+
+	// The depth test keeps the nearest depth whatever order the faces are drawn
+	// in, so drawing the dynamic instances over the static map gives the same 
+	// map as drawing them all.
+	depth_buffer_copy(depth_map, static_depth_map);
+
+	for (int i = 0; i < mis_count; ++i)
+	{
+		if (!models->mis_static_flags[i])
+		{
+			draw_instance_to_cube_map(models, i, depth_map, &light, scratch);
+		}
+	}
+}
+
+void update_light_space_positions(Renderer* renderer, const Scene* scene, int light_index, RenderBuffers* scratch)
+{
+	const Models* models = &scene->models;
+	const PointLights* pls = &scene->point_lights;
+
+	// The map isn't redrawn, but the moving instances still need their 
+	// positions relative to the light for the camera's shadow lookups. The 
+	// static instances only need writing if one has changed, or the buffer has
+	// been resized, since the light's positions were last written.
+	const V3 light_position = v3_read(pls->depth_maps_positions + light_index * STRIDE_POSITION);
+	float* light_space_positions = renderer->buffers.light_space_positions + models->mis_total_faces * STRIDE_FACE_VERTICES * STRIDE_V4 * light_index;
+
+	const int write_static = pls->light_space_positions_versions[light_index] != models->static_version;
+
+	for (int i = 0; i < models->mis_count; ++i)
+	{
+		if (write_static || !models->mis_static_flags[i])
+		{
+			M4 model_light;
+			write_instance_light_space_positions(models, i, light_position, light_space_positions, scratch->light_view_space_positions, model_light);
+		}
+	}
+
+	pls->light_space_positions_versions[light_index] = models->static_version;
+}
+
+void update_depth_maps(Renderer* renderer, const Scene* scene)
+{
+	for (int i = 0; i < scene->point_lights.count; ++i)
+	{
+		update_depth_map(renderer, scene, i, &renderer->buffers);
 	}
 }
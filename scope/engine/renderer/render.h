@@ -17,10 +17,13 @@
 
 #include "frustum_culling.h"
 
+#include "common/rect.h"
+
 #include "maths/vector2.h"
 #include "maths/vector3.h"
 #include "maths/vector4.h"
 #include "maths/matrix4.h"
+#include "maths/simd.h"
 
 // TODO: Organise this all.
 
@@ -40,7 +43,33 @@ void debug_draw_mi_normals(Canvas* canvas, const RenderSettings* settings, const
 // TODO: Not sure where to put this?
 float calculate_diffuse_factor(V3 v, V3 n, V3 light_pos, float a, float b);
 
+// Returns the diffuse light the view space vertex receives from all the lights.
+V3 calculate_vertex_diffuse(const PointLights* point_lights, V3 position, V3 normal);
+
+// Returns the colour of a vertex lit by the diffuse and ambient light, clamped to 1.
+V3 calculate_vertex_light(V3 albedo, V3 diffuse, V3 ambient_light);
+
 // SECTION: Triangle rasterisation.
+
+// Returns 1 if the light space position is in shadow, 0 if it is lit, or -1 if 
+// it is outside of the depth map.
+int shadow_map_test(V4 projected, const DepthBuffer* db);
+
+// SECTION: Hierarchical depth.
+
+// Recalculates the furthest depth of the depth tiles that the span [x0, x1) on
+// row y overlaps, must be called after writing depths in the span.
+void depth_tiles_update(RenderTarget* rt, int x0, int x1, int y);
+
+// Returns 1 if min_z is behind the furthest depth of every tile that the rect
+// [x0, x1) x [y0, y1) overlaps, so nothing at that depth could be drawn there.
+int depth_tiles_occluded(const RenderTarget* rt, int x0, int y0, int x1, int y1, float min_z);
+
+// Returns 1 if the screen space triangle can't draw any pixels inside the clip rect.
+int triangle_occluded(const RenderTarget* rt, const float* vc0, const float* vc1, const float* vc2, const Rect* clip);
+
+// Only pixels inside the clip rect are written, this lets the tiled rasteriser
+// draw the part of a triangle that overlaps a single tile.
 void draw_scanline(RenderTarget* rt, 
 	RenderBuffers* rbs,
 	int x0, int x1, 
@@ -49,11 +78,53 @@ void draw_scanline(RenderTarget* rt,
 	float w0, float w1, 
 	V3 ac0, V3 ac1, // Albedo
 	V3 lc0, V3 lc1, // Light colour/contribution
-	float* lsps, int lights_count, DepthBuffer* depth_maps);
+	float* lsps, int lights_count, DepthBuffer* depth_maps,
+	const Rect* clip);
+
+// The scalar draw_scanline is kept as the reference implementation, the flat
+// triangle functions use the SIMD version when SSE2 or AVX2 is available unless
+// SCALAR_SCANLINES is defined.
+#if defined(SIMD_LANES) && !defined(SCALAR_SCANLINES)
+#define SIMD_SCANLINES
+#endif
 
-void draw_flat_bottom_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0, float* vc1, float* vc2, int vertex_stride, int lights_count, DepthBuffer* depth_maps);
-void draw_flat_top_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0, float* vc1, float* vc2, int vertex_stride, int lights_count, DepthBuffer* depth_maps);
-void draw_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0, float* vc1, float* vc2, float* vc3, int vertex_stride, int lights_count, DepthBuffer* depth_maps);
+#ifdef SIMD_LANES
+void draw_scanline_simd(RenderTarget* rt,
+	RenderBuffers* rbs,
+	int x0, int x1,
+	int y,
+	float z0, float z1,
+	float w0, float w1,
+	V3 ac0, V3 ac1,
+	V3 lc0, V3 lc1,
+	float* lsps, int lights_count, DepthBuffer* depth_maps,
+	const Rect* clip);
+#endif
+
+// Draws the span with the SIMD or scalar scanline, skipping the tiles at either
+// end that it is behind, then updates the depth tiles it drew to.
+void draw_visible_scanline(RenderTarget* rt,
+	RenderBuffers* rbs,
+	int x0, int x1,
+	int y,
+	float z0, float z1,
+	float w0, float w1,
+	V3 ac0, V3 ac1,
+	V3 lc0, V3 lc1,
+	float* lsps, int lights_count, DepthBuffer* depth_maps,
+	const Rect* clip);
+
+void draw_flat_bottom_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0, float* vc1, float* vc2, int vertex_stride, int lights_count, DepthBuffer* depth_maps, const Rect* clip);
+void draw_flat_top_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0, float* vc1, float* vc2, int vertex_stride, int lights_count, DepthBuffer* depth_maps, const Rect* clip);
+void draw_triangle(RenderTarget* rt, RenderBuffers* rbs, float* vc0, float* vc1, float* vc2, float* vc3, int vertex_stride, int lights_count, DepthBuffer* depth_maps, const Rect* clip);
+
+// Draws the triangle by testing the pixels against the triangle's edge functions 
+// instead of splitting it into flat triangles. The bounding box is walked in 
+// blocks so that whole blocks outside or inside the triangle can be rejected or
+// accepted without testing each pixel. Takes the same vertex format as draw_triangle.
+#define HALF_SPACE_BLOCK_SIZE 8
+
+void draw_triangle_half_space(RenderTarget* rt, RenderBuffers* rbs, const float* vc0, const float* vc1, const float* vc2, int vertex_stride, int lights_count, DepthBuffer* depth_maps, const Rect* clip);
 
 // TODO: Rename?
 void draw_textured_scanline(RenderTarget* rt, int x0, int x1, int y, float z0, float z1, float w0, float w1, V3 c0, V3 c1, const V2 uv0, const V2 uv1, const Canvas* texture);
@@ -62,6 +133,7 @@ void draw_textured_flat_top_triangle(RenderTarget* rt, V4 v0, V4 v1, V4 v2, V3 c
 void draw_textured_triangle(RenderTarget* rt, V4 v0, V4 v1, V4 v2, V3 c0, V3 c1, V3 c2, V2 uv0, V2 uv1, V2 uv2, const Canvas* texture);
 
 // TODO: Comments etc.
+// Only the pixels inside the depth buffer are written.
 void draw_depth_scanline(DepthBuffer* db, int x0, int x1, int y, float z0, float z1);
 void draw_depth_flat_bottom_triangle(DepthBuffer* db, V4 v0, V4 v1, V4 v2);
 void draw_depth_flat_top_triangle(DepthBuffer* db, V4 v0, V4 v1, V4 v2);
@@ -70,25 +142,129 @@ void draw_depth_triangle(DepthBuffer* db, V4 v0, V4 v1, V4 v2);
 // SECTION: Rendering Pipeline.
 void project(const Canvas* canvas, const M4 projection_matrix, V4 v, V4* out);
 
+// Flags the instances whose bounding spheres are outside of the world space 
+// frustum as failing the broad phase, so the next stages can skip them.
+void world_space_frustum_culling(Models* models, const ViewFrustum* world_frustum);
+
+// The per instance stages also have versions that only go over the instances 
+// in [begin, end), so the job system's workers can each run a range. Each 
+// instance only reads its own data and writes to its own part of the buffers,
+// found from the prefix sums in the models, so the ranges can run in any order.
+// The stages that need per instance flags and caches take the scratch buffers
+// of the worker running them.
+
+void model_to_view_space_range(Models* models, const M4 view_matrix, int begin, int end);
+
 void model_to_view_space(Models* models, const M4 view_matrix);
 
 void lights_world_to_view_space(PointLights* point_lights, const M4 view_matrix);
 
-void broad_phase_frustum_culling(Models* models, const ViewFrustum* view_frustum);
+// If the guard band frustum isn't null, the side planes are only written out
+// for clipping if the instance crosses the guard band.
+void broad_phase_frustum_culling_range(Models* models, const ViewFrustum* view_frustum, const ViewFrustum* guard_band_frustum, int begin, int end);
+
+void broad_phase_frustum_culling(Models* models, const ViewFrustum* view_frustum, const ViewFrustum* guard_band_frustum);
+
+// Draws the occluders into the occlusion buffer and flags the instances hidden
+// behind them as failing the broad phase.
+void occlusion_culling(Renderer* renderer, Models* models);
+
+// How the faces of a meshlet need handling after testing its bounds.
+typedef enum
+{
+	MESHLET_CULLED,		// None of the faces can be visible.
+	MESHLET_INSIDE,		// The faces don't need clipping.
+	MESHLET_CLIPPED		// The faces might cross one of the clipping planes.
+
+} MeshletVisibility;
+
+// Tests the object space meshlet's cone against the object space camera, then
+// its sphere against the planes the instance intersects. The sphere is culled 
+// against the view planes and classified against the clip planes, which are
+// the guard band planes if guard band clipping is on.
+MeshletVisibility classify_meshlet(const float* sphere, const float* cone, V3 camera_position, float winding, const float* model_view_matrix, float max_scale, const Plane* view_planes, const Plane* clip_planes, const int* plane_indices, int planes_count);
+
+// Where a single instance's results are read from and written to by the 
+// pipeline stages. For the whole scene stages these point into the scene sized
+// buffers at the instance's offsets, the fused pipeline points them at scratch
+// buffers that only hold one instance.
+typedef struct
+{
+	float* view_space_positions;		// The instance's first view space position.
+	float* view_space_normals;			// The instance's first view space normal.
+	int light_space_positions_offset;	// The instance's first position in the light space positions.
+
+	float* front_faces;
+	int* front_faces_vertex_ids;
+	int* front_faces_indices;			// Written instead of the front faces in the indexed mode.
+	int front_faces_count;
+	int unclipped_front_faces_count;	// The number of front faces, at the start, that don't need clipping.
+
+	RenderBuffers* scratch;				// The transform flags and lighting cache, each worker has its own.
+
+} InstanceBuffers;
+
+// Writes out the front faces of the instance, meshlet by meshlet. The faces of
+// the meshlets that don't need clipping are written first. If the positions 
+// have been transformed already, only the normals are transformed.
+void cull_instance_backfaces(Renderer* renderer, const Scene* scene, int mi_index, const int* plane_indices, int planes_count, int positions_transformed, InstanceBuffers* ib);
+
+void cull_backfaces_range(Renderer* renderer, const Scene* scene, RenderBuffers* scratch, int begin, int end);
 
 void cull_backfaces(Renderer* renderer, const Scene* scene);
 
+void light_instance_front_faces(Renderer* renderer, const Scene* scene, int mi_index, const InstanceBuffers* ib);
+
+void light_front_faces_range(Renderer* renderer, const Scene* scene, RenderBuffers* scratch, int begin, int end);
+
 void light_front_faces(Renderer* renderer, Scene* scene);
 
+// Returns a bit mask of the planes in the list that the view space vertex is 
+// outside of.
+int clip_outcode(const Plane* planes, const int* plane_indices, int planes_count, V3 v);
+
+// Clips the convex polygon against the plane, writing the part inside to out 
+// and returning its vertex count. Every component of the vertices is 
+// interpolated, the position must be the first three. A polygon clipped by one
+// plane gains at most one vertex.
+int clip_polygon_against_plane(const Plane* plane, const float* in, int in_count, float* out, int vertex_components);
+
+// Clips the face against the planes and writes out the visible part as 
+// triangles, returns the number of triangles written.
+int clip_face(RenderBuffers* rbs, const float* face, const Plane* planes, const int* plane_indices, int planes_count, int vertex_components, float* out);
+
+// Writes out the vertices of the model base's face for the instance in the same
+// layout as the front faces, lighting them with the vertex lighting cache.
+void assemble_front_face(Renderer* renderer, const Scene* scene, int mi_index, int face_index, const InstanceBuffers* ib, float* out);
+
+// Clips the instance's front faces against the planes it intersects and draws them.
+void clip_instance_to_screen(Renderer* renderer, Scene* scene, int mi_index, const int* plane_indices, int planes_count, const InstanceBuffers* ib, const Resources* resources);
+
 void clip_to_screen(Renderer* renderer, const M4 view_matrix, Scene* scene, const Resources* resources);
 
-void project_and_draw_clipped(Renderer* renderer, Scene* scene, int mi_index, int clipped_face_count, const Resources* resources);
+// Runs backface culling, lighting, clipping and drawing for one instance at a
+// time, instead of cull_backfaces, light_front_faces and clip_to_screen.
+void render_instances_fused(Renderer* renderer, Scene* scene, const Resources* resources);
+
+// Draws the faces of the instance, the faces can be read straight from the 
+// front faces buffer if the instance didn't need clipping.
+void project_and_draw_clipped(Renderer* renderer, Scene* scene, int mi_index, const float* clipped_faces, int clipped_face_count, const Resources* resources);
 
 void render(Renderer* renderer, Scene* scene, const Resources* resources, const M4 view_matrix);
 
 // TEMP
 
 
+// Draws the instances to the light's depth map and writes their light space 
+// positions to the light's part of the buffer. The lights only share the 
+// models, so they can be drawn at the same time with their own scratch buffers.
+void update_depth_map(Renderer* renderer, const Scene* scene, int light_index, RenderBuffers* scratch);
+
+// Writes the light space positions of the instances that may have moved since
+// the light's depth map was drawn, for the lights that aren't redrawn this frame.
+// The depth map is left as it is.
+void update_light_space_positions(Renderer* renderer, const Scene* scene, int light_index, RenderBuffers* scratch);
+
 void update_depth_maps(Renderer* renderer, const Scene* scene);
 
 
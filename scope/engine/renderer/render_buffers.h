@@ -7,9 +7,15 @@
 
 #include "common/status.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 
+// A triangle clipped against the 6 frustum planes gains at most one vertex per
+// plane, and its fan triangulation has two less triangles than vertices.
+#define MAX_CLIPPED_POLYGON_VERTICES 9
+#define MAX_CLIPPED_FACE_TRIANGLES (MAX_CLIPPED_POLYGON_VERTICES - 2)
+
 typedef struct
 {
 	// TODO: Eventually move intermediate buffers out of models to here.
@@ -17,20 +23,46 @@ typedef struct
 
 	// Counts for helping with resizing.
 	int mbs_max_faces;
+	int mbs_max_vertices;
+	int mbs_max_positions;
+	int mbs_max_normals;
 	int lights_count; // TODO: Shadow casting lights only?
 	int total_faces; // TODO: mi prefix or do we abstract that.
 	int instances_count; // TODO: Same here ^^
+	int front_faces_total_faces;	// The counts the scene sized front faces buffers were last resized for. They are
+	int front_faces_lights_count;	// only made when the fused pipeline isn't used, as it has its own per instance buffers.
 
 	// This approach also means we don't need separate buffers per scene for 
 	// clipping etc.
 
 	// Backface culling buffers. // TODO: Redo comments.
 	int* front_faces_counts;		// Number of faces that are visible to the camera.
+	int* unclipped_front_faces_counts;	// Number of the instance's front faces, at the start of its front faces, that don't need clipping.
 	float* front_faces;				// An interleaved buffer of {x, y, z, u, v, x, y, z, r, g, b, r, g, b } for each vertex of each front face after backface culling.
+	int* front_faces_vertex_ids;	// The model base's unique vertex id for each vertex of each front face.
+	int* front_faces_indices;		// The model base face index of each front face, written instead of the front faces in the indexed mode.
+	float* assembled_face;			// The vertices of the front face being drawn in the indexed mode.
+
+	// Lighting buffers.
+	float* vertex_lighting;			// The diffuse light for each unique vertex of the instance being lit.
+	int* vertex_lit_flags;			// Whether the unique vertex has been lit yet for the current instance.
+
+	// Transform buffers.
+	int* position_transformed_flags;	// Whether the position has been transformed to view space yet for the current instance.
+	int* normal_transformed_flags;		// Whether the normal has been transformed to view space yet for the current instance.
+	float* light_view_space_positions;	// The positions of the instance being drawn to a depth map, in the light's view space.
+
+	// Fused pipeline buffers, these only hold a single instance so they stay in
+	// the cache between the stages.
+	float* instance_view_space_positions;
+	float* instance_view_space_normals;
+	float* instance_front_faces;
+	int* instance_front_faces_vertex_ids;
+	int* instance_front_faces_indices;
 
 	// Clipping buffers.
-	float* temp_clipped_faces_in;
-	float* temp_clipped_faces_out;
+	float* clip_polygon_in;		// Ping-pong buffers for clipping a single face as a polygon.
+	float* clip_polygon_out;
 	float* clipped_faces;
 
 	// Light space position buffers.
@@ -53,6 +85,10 @@ typedef struct
 	float* scanline_light_space_positions;
 	float* scanline_light_space_pos_deltas;
 	float* scanline_light_space_current_pos;
+
+	// Edge function rasteriser buffers.
+	float* light_space_pos_gradients;	// Interleaved buffer of { d/dx, d/dy } for each light space position component.
+	float* row_light_space_positions;	// Light space positions at the start of the current block row.
 	
 } RenderBuffers;
 
@@ -63,32 +99,10 @@ inline Status render_buffers_init(RenderBuffers* rbs)
 	return STATUS_OK;
 }
 
-inline Status render_buffers_resize(RenderBuffers* rbs)
+inline void render_buffers_resize_raster(RenderBuffers* rbs)
 {
-	// TODO: TEMP: Resizing render buffer for storing light stuff.
-
-	// Backface culling buffers.
-	const int STRIDE_FRONT_FACE = STRIDE_BASE_FRONT_FACE + rbs->lights_count * STRIDE_V4 * STRIDE_FACE_VERTICES;
-	resize_int_buffer(&rbs->front_faces_counts, rbs->instances_count);
-	resize_float_buffer(&rbs->front_faces, rbs->total_faces * STRIDE_FRONT_FACE);
-
-	// Clipping buffers.
-	// TODO: Should the render buffers define this stride?
-	// TODO: Surely this is gonna take too much memory. May have to 
-	//		 refactor some of the rendering code.
-	// Calculate the maximum number of triangles that one could turn into 
-	// after clipping against all enabled planes.
-	const int MAX_TRIS_FACTOR = (int)pow(2, 6);
-	const int STRIDE_CLIPPED = STRIDE_BASE_CLIPPED_FACE + rbs->lights_count * STRIDE_V4 * STRIDE_FACE_VERTICES;
-	const int max_clipped_tris = rbs->mbs_max_faces * MAX_TRIS_FACTOR * STRIDE_CLIPPED;
-
-	resize_float_buffer(&rbs->temp_clipped_faces_in, max_clipped_tris);
-	resize_float_buffer(&rbs->temp_clipped_faces_out, max_clipped_tris);
-	resize_float_buffer(&rbs->clipped_faces, max_clipped_tris);
-
-	// TODO: CALCULATE THE SIZE OF THE STRIDE PROPERLY?
-	Status status = resize_float_buffer(&rbs->light_space_positions, rbs->total_faces * STRIDE_FACE_VERTICES * rbs->lights_count * STRIDE_V4); 
-	resize_float_buffer(&rbs->front_face_light_space_positions, rbs->total_faces * STRIDE_FACE_VERTICES * rbs->lights_count * STRIDE_V4);
+	// Resizes only the temporary buffers used when drawing a triangle. These are
+	// separate so the tiled rasteriser's workers can each have their own.
 
 	// Pos (V4), UV (V2), albedo (V3), light (V3)
 
@@ -105,10 +119,126 @@ inline Status render_buffers_resize(RenderBuffers* rbs)
 	resize_float_buffer(&rbs->light_space_pos_deltas, rbs->lights_count * STRIDE_V4 * 2); // interleaved buffer of dlsp0_dy_v0, dlsp0_dy_v1, ... 
 	resize_float_buffer(&rbs->scanline_light_space_pos_deltas, rbs->lights_count * STRIDE_V4); 
 	resize_float_buffer(&rbs->scanline_light_space_current_pos, rbs->lights_count * STRIDE_V4);
+
+	// Plane equations for the light space positions for the edge function rasteriser.
+	resize_float_buffer(&rbs->light_space_pos_gradients, rbs->lights_count * STRIDE_V4 * 2);
+	resize_float_buffer(&rbs->row_light_space_positions, rbs->lights_count * STRIDE_V4);
+}
+
+inline void render_buffers_resize_instance(RenderBuffers* rbs)
+{
+	// Resizes only the flags and caches used while transforming, culling and
+	// lighting a single instance. These are separate so the job system's workers
+	// can each have their own.
+
+	// Lighting buffers.
+	resize_float_buffer(&rbs->vertex_lighting, rbs->mbs_max_vertices * STRIDE_COLOUR);
+	resize_int_buffer(&rbs->vertex_lit_flags, rbs->mbs_max_vertices);
+
+	// Transform buffers.
+	resize_int_buffer(&rbs->position_transformed_flags, rbs->mbs_max_positions);
+	resize_int_buffer(&rbs->normal_transformed_flags, rbs->mbs_max_normals);
+	resize_float_buffer(&rbs->light_view_space_positions, rbs->mbs_max_positions * STRIDE_POSITION);
+}
+
+inline void render_buffers_resize_front_faces(RenderBuffers* rbs)
+{
+	// Resizes the scene sized front faces buffers, which are only used when 
+	// each stage goes over the whole scene.
+	const int STRIDE_FRONT_FACE = STRIDE_BASE_FRONT_FACE + rbs->lights_count * STRIDE_V4 * STRIDE_FACE_VERTICES;
+	resize_float_buffer(&rbs->front_faces, rbs->total_faces * STRIDE_FRONT_FACE);
+	resize_int_buffer(&rbs->front_faces_vertex_ids, rbs->total_faces * STRIDE_FACE_VERTICES);
+	resize_int_buffer(&rbs->front_faces_indices, rbs->total_faces);
+
+	rbs->front_faces_total_faces = rbs->total_faces;
+	rbs->front_faces_lights_count = rbs->lights_count;
+}
+
+inline Status render_buffers_resize(RenderBuffers* rbs)
+{
+	// TODO: TEMP: Resizing render buffer for storing light stuff.
+
+	// Backface culling buffers.
+	const int STRIDE_FRONT_FACE = STRIDE_BASE_FRONT_FACE + rbs->lights_count * STRIDE_V4 * STRIDE_FACE_VERTICES;
+	resize_int_buffer(&rbs->front_faces_counts, rbs->instances_count);
+	resize_int_buffer(&rbs->unclipped_front_faces_counts, rbs->instances_count);
+	resize_float_buffer(&rbs->assembled_face, STRIDE_FRONT_FACE);
+
+	render_buffers_resize_instance(rbs);
+
+	// Fused pipeline buffers.
+	resize_float_buffer(&rbs->instance_view_space_positions, rbs->mbs_max_positions * STRIDE_POSITION);
+	resize_float_buffer(&rbs->instance_view_space_normals, rbs->mbs_max_normals * STRIDE_NORMAL);
+	resize_float_buffer(&rbs->instance_front_faces, rbs->mbs_max_faces * STRIDE_FRONT_FACE);
+	resize_int_buffer(&rbs->instance_front_faces_vertex_ids, rbs->mbs_max_faces * STRIDE_FACE_VERTICES);
+	resize_int_buffer(&rbs->instance_front_faces_indices, rbs->mbs_max_faces);
+
+	// Clipping buffers.
+	// Each face is clipped on its own as a polygon, so the polygon buffers only
+	// need to hold the largest polygon, and one instance's faces can turn into
+	// at most MAX_CLIPPED_FACE_TRIANGLES each.
+	const int STRIDE_CLIPPED_VERTEX = STRIDE_BASE_CLIPPED_VERTEX + rbs->lights_count * STRIDE_V4;
+	const int STRIDE_CLIPPED = STRIDE_CLIPPED_VERTEX * STRIDE_FACE_VERTICES;
+
+	resize_float_buffer(&rbs->clip_polygon_in, MAX_CLIPPED_POLYGON_VERTICES * STRIDE_CLIPPED_VERTEX);
+	resize_float_buffer(&rbs->clip_polygon_out, MAX_CLIPPED_POLYGON_VERTICES * STRIDE_CLIPPED_VERTEX);
+	resize_float_buffer(&rbs->clipped_faces, rbs->mbs_max_faces * MAX_CLIPPED_FACE_TRIANGLES * STRIDE_CLIPPED);
+
+	// TODO: CALCULATE THE SIZE OF THE STRIDE PROPERLY?
+	Status status = resize_float_buffer(&rbs->light_space_positions, rbs->total_faces * STRIDE_FACE_VERTICES * rbs->lights_count * STRIDE_V4); 
+	resize_float_buffer(&rbs->front_face_light_space_positions, rbs->total_faces * STRIDE_FACE_VERTICES * rbs->lights_count * STRIDE_V4);
+
+	render_buffers_resize_raster(rbs);
 	
 	return status;
 }
 
+inline void render_buffers_destroy(RenderBuffers* rbs)
+{
+	// Backface culling buffers.
+	free(rbs->front_faces_counts);
+	free(rbs->unclipped_front_faces_counts);
+	free(rbs->front_faces);
+	free(rbs->front_faces_vertex_ids);
+	free(rbs->front_faces_indices);
+	free(rbs->assembled_face);
+
+	// Lighting buffers.
+	free(rbs->vertex_lighting);
+	free(rbs->vertex_lit_flags);
+
+	// Transform buffers.
+	free(rbs->position_transformed_flags);
+	free(rbs->normal_transformed_flags);
+	free(rbs->light_view_space_positions);
+
+	// Fused pipeline buffers.
+	free(rbs->instance_view_space_positions);
+	free(rbs->instance_view_space_normals);
+	free(rbs->instance_front_faces);
+	free(rbs->instance_front_faces_vertex_ids);
+	free(rbs->instance_front_faces_indices);
+
+	// Clipping buffers.
+	free(rbs->clip_polygon_in);
+	free(rbs->clip_polygon_out);
+	free(rbs->clipped_faces);
+
+	// Light space position buffers.
+	free(rbs->light_space_positions);
+	free(rbs->front_face_light_space_positions);
+
+	// Raster buffers.
+	free(rbs->triangle_vertices);
+	free(rbs->light_space_pos_deltas);
+	free(rbs->scanline_light_space_positions);
+	free(rbs->scanline_light_space_pos_deltas);
+	free(rbs->scanline_light_space_current_pos);
+	free(rbs->light_space_pos_gradients);
+	free(rbs->row_light_space_positions);
+
+	memset(rbs, 0, sizeof(RenderBuffers));
+}
 
 // TODO: Cleanup
 
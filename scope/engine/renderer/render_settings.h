@@ -23,9 +23,31 @@ typedef struct
 
 	float far_plane;
 
+	// Rasterisation settings.
+	int tiled_rasterisation; // Bin the triangles into screen tiles and rasterise the tiles on worker threads.
+	int half_space_rasterisation; // Draw triangles with edge functions rather than scanlines.
+
+	// Culling settings.
+	int occlusion_culling; // Skip the instances hidden behind the occluder instances.
+
+	// Geometry settings.
+	int indexed_front_faces; // Backface culling only writes out the indices of the front faces, their vertices are assembled as they are drawn.
+	int fused_instance_pipeline; // Cull, light, clip and draw one instance at a time with small scratch buffers, rather than each stage going over the whole scene.
+
+	// Clipping settings.
+	int guard_band_clipping; // Only clip against the side planes outside the guard band, the rasteriser scissors the rest.
+
+	// Threading settings.
+	int parallel_instance_stages; // Split transforming, broad phase culling, backface culling and lighting between the job system's workers.
+
+	// Shadow settings.
+	int cached_static_shadows; // Keep the static instances' shadow map between frames, only the moving instances are drawn each frame.
+	int shadow_map_update_budget; // The most shadow maps redrawn each frame, the rest keep last frame's. 0 redraws them all.
+
 	// TODO: Should these go to the Renderer?
 	M4 projection_matrix;
 	ViewFrustum view_frustum; // TODO: Definitely should go in the renderer.
+	ViewFrustum guard_band_frustum;
 
 } RenderSettings;
 
@@ -4,18 +4,48 @@
 #include "canvas.h"
 
 #include "utils/logger.h"
+#include "utils/memory_utils.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+// The depth buffer is split into tiles that store the furthest depth in them,
+// so triangles and spans that are behind everything drawn in a tile can be
+// rejected without reading the depth buffer.
+#define DEPTH_TILE_SIZE 8
+
 // Contains the different buffers needed for rendering.
 typedef struct
 {
 	Canvas canvas;
 	float* depth_buffer;
 
+	// Hierarchical depth, updated as spans are drawn. Only ever further than
+	// the depth buffer, never closer.
+	int depth_tiles_cols;
+	int depth_tiles_rows;
+	float* depth_tiles_max;			// The furthest depth in each tile.
+	float* depth_tile_rows_max;		// The furthest depth in each row of each tile, so a tile can be updated by only reading the row that changed.
+
 } RenderTarget;
 
+inline Status render_target_resize_depth_tiles(RenderTarget* rt, int width, int height)
+{
+    rt->depth_tiles_cols = (width + DEPTH_TILE_SIZE - 1) / DEPTH_TILE_SIZE;
+    rt->depth_tiles_rows = (height + DEPTH_TILE_SIZE - 1) / DEPTH_TILE_SIZE;
+
+    const int tiles_count = rt->depth_tiles_cols * rt->depth_tiles_rows;
+
+    if (STATUS_OK != resize_float_buffer(&rt->depth_tiles_max, tiles_count) ||
+        STATUS_OK != resize_float_buffer(&rt->depth_tile_rows_max, tiles_count * DEPTH_TILE_SIZE))
+    {
+        log_error("Failed to allocate memory for the depth tiles.");
+        return STATUS_ALLOC_FAILURE;
+    }
+
+    return STATUS_OK;
+}
+
 
 // TODO: .c file?
 inline Status render_target_init(RenderTarget* rt, const int width, const int height)
@@ -37,7 +67,7 @@ inline Status render_target_init(RenderTarget* rt, const int width, const int he
         return STATUS_ALLOC_FAILURE;
     }
 
-    return STATUS_OK;
+    return render_target_resize_depth_tiles(rt, width, height);
 }
 
 inline Status render_target_resize(RenderTarget* rt, int width, int height)
@@ -63,7 +93,7 @@ inline Status render_target_resize(RenderTarget* rt, int width, int height)
     // Update the depth buffer.
     rt->depth_buffer = new_db;
 
-    return STATUS_OK;
+    return render_target_resize_depth_tiles(rt, width, height);
 }
 
 inline void render_target_destroy(RenderTarget* rt)
@@ -73,6 +103,11 @@ inline void render_target_destroy(RenderTarget* rt)
     free(rt->depth_buffer);
     rt->depth_buffer = 0;
 
+    free(rt->depth_tiles_max);
+    free(rt->depth_tile_rows_max);
+    rt->depth_tiles_max = 0;
+    rt->depth_tile_rows_max = 0;
+
     // TODO: Do i need to do rt = 0; here?? Not sure.
 }
 
@@ -96,6 +131,18 @@ inline void render_target_clear(RenderTarget* rt, const unsigned int bg_colour)
     {
         depth_buffer_ptr[i] = max_depth;
     }
+
+    const int tiles_count = rt->depth_tiles_cols * rt->depth_tiles_rows;
+
+    for (int i = 0; i < tiles_count; ++i)
+    {
+        rt->depth_tiles_max[i] = max_depth;
+    }
+
+    for (int i = 0; i < tiles_count * DEPTH_TILE_SIZE; ++i)
+    {
+        rt->depth_tile_rows_max[i] = max_depth;
+    }
 }
 
 #endif
\ No newline at end of file
@@ -37,9 +37,47 @@ Status renderer_init(Renderer* renderer, int width, int height)
 		return status;
 	}
 
-	// Create the view frustum.
+	// Create the view frustum and the guard band.
 	view_frustum_init(&renderer->settings.view_frustum, renderer->settings.near_plane, renderer->settings.far_plane, renderer->settings.fov,
 		renderer->target.canvas.width / (float)(renderer->target.canvas.height));
+	guard_band_frustum_init(&renderer->settings.guard_band_frustum, renderer->settings.near_plane, renderer->settings.far_plane, renderer->settings.fov,
+		renderer->target.canvas.width / (float)(renderer->target.canvas.height));
+
+	// Initialise the tiled rasteriser's bins.
+	status = tiled_rasteriser_init(&renderer->tiled_rasteriser, width, height);
+	if (STATUS_OK != status)
+	{
+		return status;
+	}
+
+	// Initialise the job system's worker threads.
+	status = job_system_init(&renderer->job_system);
+	if (STATUS_OK != status)
+	{
+		return status;
+	}
+
+	for (int i = 0; i < MAX_JOB_WORKERS; ++i)
+	{
+		render_buffers_init(&renderer->job_buffers[i]);
+	}
+
+	frame_graph_init(&renderer->frame_graph);
+	renderer->frame_index = 0;
+
+	// Initialise the low resolution depth buffer for the occluders.
+	status = occlusion_buffer_init(&renderer->occlusion_buffer, width, height);
+	if (STATUS_OK != status)
+	{
+		return status;
+	}
+
+	// Initialise the memory shared by the lights' shadow maps.
+	status = shadow_atlas_init(&renderer->shadow_atlas, SHADOW_ATLAS_DEFAULT_BLOCKS);
+	if (STATUS_OK != status)
+	{
+		return status;
+	}
 
 	return STATUS_OK;
 }
@@ -56,10 +94,41 @@ Status renderer_resize(Renderer* renderer, int width, int height)
 	// Update the projection matrix.
 	update_projection_m4(&renderer->settings, width / (float)height);
 
-	// Recreate the view frustum.
+	// Recreate the view frustum and the guard band.
 	view_frustum_init(&renderer->settings.view_frustum, renderer->settings.near_plane, renderer->settings.far_plane, renderer->settings.fov,
 		renderer->target.canvas.width / (float)(renderer->target.canvas.height));
+	guard_band_frustum_init(&renderer->settings.guard_band_frustum, renderer->settings.near_plane, renderer->settings.far_plane, renderer->settings.fov,
+		renderer->target.canvas.width / (float)(renderer->target.canvas.height));
 
+	// Recreate the tiles for the new size.
+	status = tiled_rasteriser_resize(&renderer->tiled_rasteriser, width, height);
+	if (STATUS_OK != status)
+	{
+		return status;
+	}
+
+	status = occlusion_buffer_resize(&renderer->occlusion_buffer, width, height);
+	if (STATUS_OK != status)
+	{
+		return status;
+	}
 
 	return STATUS_OK;
 }
+
+void renderer_destroy(Renderer* renderer)
+{
+	tiled_rasteriser_destroy(&renderer->tiled_rasteriser);
+	job_system_destroy(&renderer->job_system);
+
+	for (int i = 0; i < MAX_JOB_WORKERS; ++i)
+	{
+		render_buffers_destroy(&renderer->job_buffers[i]);
+	}
+
+	render_buffers_destroy(&renderer->buffers);
+
+	occlusion_buffer_destroy(&renderer->occlusion_buffer);
+	shadow_atlas_destroy(&renderer->shadow_atlas);
+	render_target_destroy(&renderer->target);
+}
@@ -5,6 +5,11 @@
 #include "render_settings.h"
 #include "render_buffers.h"
 #include "camera.h"
+#include "tiled_rasteriser.h"
+#include "job_system.h"
+#include "frame_graph.h"
+#include "occlusion_culling.h"
+#include "shadow_atlas.h"
 
 #include "common/status.h"
 
@@ -14,10 +19,24 @@ typedef struct
 	RenderSettings settings;
 	RenderBuffers buffers;
 	Camera camera;
+	TiledRasteriser tiled_rasteriser;
+	OcclusionBuffer occlusion_buffer;
+	ShadowAtlas shadow_atlas;
+
+	// The workers for the per instance stages and the tiles, each worker uses 
+	// its own buffers for the flags and caches that are reset per instance.
+	JobSystem job_system;
+	RenderBuffers job_buffers[MAX_JOB_WORKERS];
+
+	// The stages of the last frame, with how long each took.
+	FrameGraph frame_graph;
+
+	int frame_index; // The number of frames rendered.
 	
 } Renderer;
 
 Status renderer_init(Renderer* renderer, int width, int height);
 Status renderer_resize(Renderer* renderer, int width, int height);
+void renderer_destroy(Renderer* renderer);
 
 #endif
\ No newline at end of file
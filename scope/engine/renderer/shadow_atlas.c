@@ -0,0 +1,435 @@
+#include "shadow_atlas.h"
+
+#include "strides.h"
+
+#include "maths/utils.h"
+
+#include "utils/memory_utils.h"
+#include "utils/logger.h"
+
+#include <Windows.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// The number of floats in a block, the smallest cube map.
+#define SHADOW_ATLAS_BLOCK_SIZE (SHADOW_ATLAS_MIN_FACE_SIZE * SHADOW_ATLAS_MIN_FACE_SIZE * CUBE_MAP_FACES)
+
+static int map_blocks(int face_size)
+{
+	const int scale = face_size / SHADOW_ATLAS_MIN_FACE_SIZE;
+	return scale * scale;
+}
+
+static int region_blocks(const ShadowAtlas* atlas, int face_size)
+{
+	return map_blocks(face_size) * atlas->maps_per_light;
+}
+
+static int face_size_at_distance(float distance)
+{
+	int face_size = SHADOW_ATLAS_MAX_FACE_SIZE;
+	float halve_distance = SHADOW_ATLAS_FULL_SIZE_DISTANCE;
+
+	while (face_size > SHADOW_ATLAS_MIN_FACE_SIZE && distance > halve_distance)
+	{
+		face_size /= 2;
+		halve_distance *= 2;
+	}
+
+	return face_size;
+}
+
+Status shadow_atlas_init(ShadowAtlas* atlas, int blocks_count)
+{
+	memset(atlas, 0, sizeof(ShadowAtlas));
+
+	atlas->data = malloc((size_t)blocks_count * SHADOW_ATLAS_BLOCK_SIZE * sizeof(float));
+	if (!atlas->data)
+	{
+		log_error("Failed to allocate memory for the shadow atlas.");
+		return STATUS_ALLOC_FAILURE;
+	}
+
+	atlas->blocks_count = blocks_count;
+	atlas->maps_per_light = 1;
+
+	return STATUS_OK;
+}
+
+static Status shadow_atlas_resize_lights(ShadowAtlas* atlas, int lights_count)
+{
+	if (STATUS_OK != resize_int_buffer(&atlas->regions_offsets, lights_count) ||
+		STATUS_OK != resize_int_buffer(&atlas->regions_face_sizes, lights_count) ||
+		STATUS_OK != resize_int_buffer(&atlas->face_sizes, lights_count) ||
+		STATUS_OK != resize_float_buffer(&atlas->distances, lights_count) ||
+		STATUS_OK != resize_int_buffer(&atlas->new_offsets, lights_count) ||
+		STATUS_OK != resize_int_buffer(&atlas->new_face_sizes, lights_count))
+	{
+		log_error("Failed to resize the shadow atlas' light buffers.");
+		return STATUS_ALLOC_FAILURE;
+	}
+
+	// The new lights don't have a region yet.
+	for (int i = atlas->lights_count; i < lights_count; ++i)
+	{
+		atlas->regions_offsets[i] = 0;
+		atlas->regions_face_sizes[i] = 0;
+	}
+
+	atlas->lights_count = lights_count;
+
+	return STATUS_OK;
+}
+
+static Status shadow_atlas_grow(ShadowAtlas* atlas, int blocks_count)
+{
+	// The regions keep their offsets, and realloc keeps their maps.
+	float* new_data = realloc(atlas->data, (size_t)blocks_count * SHADOW_ATLAS_BLOCK_SIZE * sizeof(float));
+	if (!new_data)
+	{
+		log_error("Failed to reallocate memory for the shadow atlas.");
+		return STATUS_ALLOC_FAILURE;
+	}
+
+	atlas->data = new_data;
+	atlas->blocks_count = blocks_count;
+
+	return STATUS_OK;
+}
+
+static int regions_overlap(const ShadowAtlas* atlas, int offset, int blocks, int other_offset, int other_face_size)
+{
+	return 0 != other_face_size && offset < other_offset + region_blocks(atlas, other_face_size) && other_offset < offset + blocks;
+}
+
+static int shadow_atlas_find_region(const ShadowAtlas* atlas, int blocks, int avoid_current)
+{
+	// Returns the first offset, aligned to the region's length, that doesn't
+	// overlap another light's new region, or its current one if avoid_current
+	// is set. Returns -1 if there isn't one.
+	for (int offset = 0; offset + blocks <= atlas->blocks_count; offset += blocks)
+	{
+		int overlaps = 0;
+
+		for (int i = 0; i < atlas->lights_count && !overlaps; ++i)
+		{
+			overlaps = regions_overlap(atlas, offset, blocks, atlas->new_offsets[i], atlas->new_face_sizes[i]) ||
+				(avoid_current && regions_overlap(atlas, offset, blocks, atlas->regions_offsets[i], atlas->regions_face_sizes[i]));
+		}
+
+		if (!overlaps)
+		{
+			return offset;
+		}
+	}
+
+	return -1;
+}
+
+static int shadow_atlas_place_regions(ShadowAtlas* atlas, int avoid_current)
+{
+	// Gives the lights without a new region one, largest first, returns 0 if 
+	// they don't all fit.
+	while (1)
+	{
+		int largest = -1;
+
+		for (int i = 0; i < atlas->lights_count; ++i)
+		{
+			if (0 == atlas->new_face_sizes[i] && (-1 == largest || atlas->face_sizes[i] > atlas->face_sizes[largest]))
+			{
+				largest = i;
+			}
+		}
+
+		if (-1 == largest)
+		{
+			return 1;
+		}
+
+		const int offset = shadow_atlas_find_region(atlas, region_blocks(atlas, atlas->face_sizes[largest]), avoid_current);
+		if (-1 == offset)
+		{
+			return 0;
+		}
+
+		atlas->new_offsets[largest] = offset;
+		atlas->new_face_sizes[largest] = atlas->face_sizes[largest];
+	}
+}
+
+static void resample_map(float* dst, int dst_face_size, const float* src, int src_face_size)
+{
+	// The faces are stacked vertically and the sizes are powers of two, so the
+	// faces line up and each texel of the smaller map covers a square of the
+	// larger one's.
+	const int height = dst_face_size * CUBE_MAP_FACES;
+
+	if (dst_face_size > src_face_size)
+	{
+		// Growing, take the nearest texel.
+		const int scale = dst_face_size / src_face_size;
+
+		for (int y = 0; y < height; ++y)
+		{
+			const float* src_row = src + (y / scale) * src_face_size;
+
+			for (int x = 0; x < dst_face_size; ++x)
+			{
+				dst[y * dst_face_size + x] = src_row[x / scale];
+			}
+		}
+	}
+	else
+	{
+		// Shrinking, take the nearest depth of the square so thin casters keep
+		// their shadows.
+		const int scale = src_face_size / dst_face_size;
+
+		// The source rows are read in order.
+		for (int y = 0; y < height; ++y)
+		{
+			float* dst_row = dst + y * dst_face_size;
+
+			for (int x = 0; x < dst_face_size; ++x)
+			{
+				dst_row[x] = 1.f;
+			}
+
+			for (int j = 0; j < scale; ++j)
+			{
+				const float* src_row = src + (y * scale + j) * src_face_size;
+
+				for (int x = 0; x < dst_face_size; ++x)
+				{
+					float depth = dst_row[x];
+
+					for (int k = 0; k < scale; ++k)
+					{
+						const float v = src_row[x * scale + k];
+						depth = v < depth ? v : depth;
+					}
+
+					dst_row[x] = depth;
+				}
+			}
+		}
+	}
+}
+
+static void shadow_atlas_move_maps(ShadowAtlas* atlas, float* new_data, int old_maps_per_light, PointLights* point_lights)
+{
+	// Moves each light's maps to its new region in new_data, which is either 
+	// the atlas' data or a new allocation, and makes the new regions current.
+	for (int i = 0; i < atlas->lights_count; ++i)
+	{
+		const int old_face_size = atlas->regions_face_sizes[i];
+		const int new_face_size = atlas->new_face_sizes[i];
+
+		const float* src = atlas->data + (size_t)atlas->regions_offsets[i] * SHADOW_ATLAS_BLOCK_SIZE;
+		float* dst = new_data + (size_t)atlas->new_offsets[i] * SHADOW_ATLAS_BLOCK_SIZE;
+
+		// Only a static map that is copied as it is stays valid.
+		int static_kept = 0;
+
+		if (old_face_size == new_face_size)
+		{
+			const int maps = min(old_maps_per_light, atlas->maps_per_light);
+			if (src != dst)
+			{
+				memcpy(dst, src, (size_t)map_blocks(new_face_size) * maps * SHADOW_ATLAS_BLOCK_SIZE * sizeof(float));
+			}
+
+			static_kept = maps > 1;
+		}
+		else if (0 == old_face_size)
+		{
+			// A new light, it casts no shadows until its map is drawn.
+			const int length = new_face_size * new_face_size * CUBE_MAP_FACES;
+			for (int j = 0; j < length; ++j)
+			{
+				dst[j] = 1.f;
+			}
+
+			point_lights->depth_maps_frames[i] = -1;
+		}
+		else
+		{
+			// The light keeps its shadows at the old resolution until its map is
+			// redrawn, which the scheduler is told is needed.
+			resample_map(dst, new_face_size, src, old_face_size);
+			point_lights->depth_maps_dirty_flags[i] = 1;
+		}
+
+		if (!static_kept)
+		{
+			point_lights->static_depth_maps_versions[i] = -1;
+		}
+
+		atlas->regions_offsets[i] = atlas->new_offsets[i];
+		atlas->regions_face_sizes[i] = new_face_size;
+	}
+}
+
+Status shadow_atlas_update(ShadowAtlas* atlas, PointLights* point_lights, V3 camera_position, int static_maps)
+{
+	const int lights_count = point_lights->count;
+
+	Status status = STATUS_OK;
+
+	// Adding or removing the static maps changes the length of every region.
+	const int old_maps_per_light = atlas->maps_per_light;
+	atlas->maps_per_light = static_maps ? 2 : 1;
+
+	if (lights_count != atlas->lights_count)
+	{
+		status = shadow_atlas_resize_lights(atlas, lights_count);
+		if (STATUS_OK != status)
+		{
+			return status;
+		}
+	}
+
+	// Make sure every light fits at the smallest size.
+	const int min_blocks = lights_count * atlas->maps_per_light;
+	if (min_blocks > atlas->blocks_count)
+	{
+		int blocks_count = atlas->blocks_count;
+		while (blocks_count < min_blocks)
+		{
+			blocks_count *= 2;
+		}
+
+		status = shadow_atlas_grow(atlas, blocks_count);
+		if (STATUS_OK != status)
+		{
+			return status;
+		}
+	}
+
+	// Halve the face size each time the distance to the camera doubles.
+	int total_blocks = 0;
+
+	for (int i = 0; i < lights_count; ++i)
+	{
+		const V3 to_camera = v3_sub_v3(camera_position, v3_read(point_lights->world_space_positions + i * STRIDE_POSITION));
+		const float distance = size(to_camera);
+
+		int face_size = face_size_at_distance(distance);
+
+		// Only shrink the light's faces once it is well past the distance.
+		const int current_face_size = atlas->regions_face_sizes[i];
+		if (face_size < current_face_size)
+		{
+			face_size = min(face_size_at_distance(distance / SHADOW_ATLAS_SHRINK_HYSTERESIS), current_face_size);
+		}
+
+		atlas->face_sizes[i] = face_size;
+		atlas->distances[i] = distance;
+		total_blocks += region_blocks(atlas, face_size);
+	}
+
+	// Shrink the furthest lights until they all fit. There are always enough
+	// blocks for every light at the smallest size.
+	while (total_blocks > atlas->blocks_count)
+	{
+		int furthest = -1;
+
+		for (int i = 0; i < lights_count; ++i)
+		{
+			if (atlas->face_sizes[i] > SHADOW_ATLAS_MIN_FACE_SIZE && (-1 == furthest || atlas->distances[i] > atlas->distances[furthest]))
+			{
+				furthest = i;
+			}
+		}
+
+		total_blocks -= region_blocks(atlas, atlas->face_sizes[furthest]) - region_blocks(atlas, atlas->face_sizes[furthest] / 2);
+		atlas->face_sizes[furthest] /= 2;
+	}
+
+	// The lights that keep their size keep their regions.
+	int changed = 0;
+
+	for (int i = 0; i < lights_count; ++i)
+	{
+		if (atlas->regions_face_sizes[i] == atlas->face_sizes[i] && old_maps_per_light == atlas->maps_per_light)
+		{
+			atlas->new_offsets[i] = atlas->regions_offsets[i];
+			atlas->new_face_sizes[i] = atlas->face_sizes[i];
+		}
+		else
+		{
+			atlas->new_face_sizes[i] = 0;
+			changed = 1;
+		}
+	}
+
+	if (changed)
+	{
+		// The new regions are placed clear of the old ones, so the old maps can
+		// be resampled into them. If they don't fit, because the free space is
+		// too scattered, every region is laid out again in a new allocation. 
+		// Placed largest first in an empty atlas, the regions always fit.
+		if (old_maps_per_light == atlas->maps_per_light && shadow_atlas_place_regions(atlas, 1))
+		{
+			shadow_atlas_move_maps(atlas, atlas->data, old_maps_per_light, point_lights);
+		}
+		else
+		{
+			float* new_data = malloc((size_t)atlas->blocks_count * SHADOW_ATLAS_BLOCK_SIZE * sizeof(float));
+			if (!new_data)
+			{
+				log_error("Failed to allocate memory for defragmenting the shadow atlas.");
+				return STATUS_ALLOC_FAILURE;
+			}
+
+			for (int i = 0; i < lights_count; ++i)
+			{
+				atlas->new_face_sizes[i] = 0;
+			}
+
+			shadow_atlas_place_regions(atlas, 0);
+			shadow_atlas_move_maps(atlas, new_data, old_maps_per_light, point_lights);
+
+			free(atlas->data);
+			atlas->data = new_data;
+		}
+	}
+
+	// Point the depth maps at their regions, the faces are stacked vertically
+	// and the static map follows the light's map.
+	for (int i = 0; i < lights_count; ++i)
+	{
+		const int face_size = atlas->regions_face_sizes[i];
+
+		DepthBuffer* depth_map = &point_lights->depth_maps[i];
+		depth_map->width = face_size;
+		depth_map->height = face_size * CUBE_MAP_FACES;
+		depth_map->data = atlas->data + (size_t)atlas->regions_offsets[i] * SHADOW_ATLAS_BLOCK_SIZE;
+
+		DepthBuffer* static_depth_map = &point_lights->static_depth_maps[i];
+		if (static_maps)
+		{
+			*static_depth_map = *depth_map;
+			static_depth_map->data += (size_t)map_blocks(face_size) * SHADOW_ATLAS_BLOCK_SIZE;
+		}
+		else
+		{
+			memset(static_depth_map, 0, sizeof(DepthBuffer));
+		}
+	}
+
+	return STATUS_OK;
+}
+
+void shadow_atlas_destroy(ShadowAtlas* atlas)
+{
+	free(atlas->data);
+	free(atlas->regions_offsets);
+	free(atlas->regions_face_sizes);
+	free(atlas->face_sizes);
+	free(atlas->distances);
+	free(atlas->new_offsets);
+	free(atlas->new_face_sizes);
+}
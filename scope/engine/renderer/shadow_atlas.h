@@ -0,0 +1,88 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include "lights.h"
+
+#include "common/status.h"
+
+#include "maths/vector3.h"
+
+/*
+
+Shadow atlas
+
+All the lights' cube maps are stored in one allocation. The atlas is split into
+blocks the size of the smallest cube map, and a light's cube map takes a region
+of blocks. The face sizes are powers of two, so a region is always a power of
+two blocks long, and it is placed at an offset that is a multiple of its length.
+Like a buddy allocator, this means a region can always be found for a light as
+long as the regions fit, if they are placed largest first. When regions are 
+freed and placed over time they can be left too scattered to fit a new one. 
+Then every region is laid out again in a new allocation, and the maps are
+copied to their new regions so they don't need redrawing. The old allocation
+is freed, so the atlas only ever holds blocks_count blocks.
+
+Each frame the lights are given a face size from their distance to the camera,
+halving each time the distance doubles. If they don't all fit, the furthest
+lights are shrunk until they do, so the near lights take resolution from the
+far ones. A light only shrinks once it is a quarter further than the distance
+it would shrink at, so a camera moving around that distance doesn't make the
+light change size every frame. Only the lights whose size changes are given a
+new region, the rest keep theirs so their maps don't need redrawing. The old
+map is resampled into the new region, so the light keeps its shadows at the
+old resolution until its map is redrawn. A new light's region is cleared, so
+it casts no shadows until its map is first drawn.
+
+When the static shadows are cached, a light's region holds its static map
+after its cube map, so the atlas' budget covers both. The static map can't be
+resampled, as the moving instances are drawn over it, so it is redrawn when
+the light is resized. Turning the cache on or off lays every region out again.
+
+*/
+
+#define SHADOW_ATLAS_MIN_FACE_SIZE 32
+#define SHADOW_ATLAS_MAX_FACE_SIZE 512
+
+// Lights nearer the camera than this get the largest faces.
+#define SHADOW_ATLAS_FULL_SIZE_DISTANCE 8.f
+
+// How much further than the distance a light's faces halve at it must be 
+// before its faces are shrunk.
+#define SHADOW_ATLAS_SHRINK_HYSTERESIS 1.25f
+
+// The size of the atlas when it is created. 512 blocks fit two lights at the
+// largest size, or eight at 256.
+#define SHADOW_ATLAS_DEFAULT_BLOCKS 512
+
+typedef struct
+{
+	float* data;
+	int blocks_count; // Always a power of two, it is doubled if the lights can't fit at the smallest size.
+	int maps_per_light; // 2 when each light's region holds its static map too, otherwise 1.
+
+	// The region of each light, the offset is in blocks. A face size of 0 means
+	// the light doesn't have a region yet.
+	int lights_count;
+	int* regions_offsets;
+	int* regions_face_sizes;
+
+	// Per light scratch buffers for choosing the sizes and regions.
+	int* face_sizes;
+	float* distances;
+	int* new_offsets;
+	int* new_face_sizes; // 0 until the light has been given its new region.
+
+} ShadowAtlas;
+
+Status shadow_atlas_init(ShadowAtlas* atlas, int blocks_count);
+
+// Chooses the lights' face sizes and gives the lights whose size has changed a
+// new region. The lights' depth maps, and their static maps if static_maps is
+// set, are pointed at their regions. The resized maps are marked dirty, and the
+// new lights' maps are cleared and marked as not drawn. The static maps that 
+// couldn't be kept are marked as not drawn.
+Status shadow_atlas_update(ShadowAtlas* atlas, PointLights* point_lights, V3 camera_position, int static_maps);
+
+void shadow_atlas_destroy(ShadowAtlas* atlas);
+
+#endif
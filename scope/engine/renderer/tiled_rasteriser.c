@@ -0,0 +1,254 @@
+#include "tiled_rasteriser.h"
+
+#include "render.h"
+
+#include "common/rect.h"
+
+#include "utils/logger.h"
+#include "utils/memory_utils.h"
+
+#include <Windows.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+static void rasterise_tile(TiledRasteriser* tr, RenderBuffers* rbs, int tile_index)
+{
+	const int count = tr->bins_counts[tile_index];
+	if (0 == count)
+	{
+		return;
+	}
+
+	const int tile_x = tile_index % tr->tile_cols;
+	const int tile_y = tile_index / tr->tile_cols;
+
+	Rect clip = {
+		.x0 = tile_x * TILE_SIZE,
+		.y0 = tile_y * TILE_SIZE,
+		.x1 = min((tile_x + 1) * TILE_SIZE, tr->width),
+		.y1 = min((tile_y + 1) * TILE_SIZE, tr->height)
+	};
+
+	const int stride = tr->vertex_stride;
+	const int* bin = tr->bins[tile_index];
+
+	// The edge function rasteriser only reads the vertices, so it can draw
+	// straight from the binned triangles.
+	if (tr->settings->half_space_rasterisation)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			const float* vc0 = tr->triangles + (size_t)bin[i] * stride * 3;
+			draw_triangle_half_space(tr->rt, rbs, vc0, vc0 + stride, vc0 + stride * 2, stride, tr->lights_count, tr->depth_maps, &clip);
+		}
+
+		return;
+	}
+
+	// The draw functions write the vertex for splitting the triangle into the
+	// 4th vertex, so copy each triangle into this worker's own buffer first.
+	float* vc0 = rbs->triangle_vertices;
+	float* vc1 = vc0 + stride;
+	float* vc2 = vc1 + stride;
+	float* vc3 = vc2 + stride;
+
+	for (int i = 0; i < count; ++i)
+	{
+		memcpy(vc0, tr->triangles + (size_t)bin[i] * stride * 3, (size_t)stride * 3 * sizeof(float));
+
+		draw_triangle(tr->rt, rbs, vc0, vc1, vc2, vc3, stride, tr->lights_count, tr->depth_maps, &clip);
+	}
+}
+
+static void rasterise_tiles_job(void* data, int begin, int end, int worker_index)
+{
+	// Every tile is in exactly one job, so no other worker will touch its pixels.
+	TiledRasteriser* tr = (TiledRasteriser*)data;
+
+	for (int i = begin; i < end; ++i)
+	{
+		rasterise_tile(tr, &tr->workers_buffers[worker_index], i);
+	}
+}
+
+static Status tiled_rasteriser_resize_bins(TiledRasteriser* tr)
+{
+	// Free the old bins, the tiles count is still for the old size.
+	for (int i = 0; i < tr->tiles_count; ++i)
+	{
+		free(tr->bins[i]);
+	}
+
+	free(tr->bins);
+	free(tr->bins_counts);
+	free(tr->bins_capacities);
+
+	tr->tile_cols = (tr->width + TILE_SIZE - 1) / TILE_SIZE;
+	tr->tile_rows = (tr->height + TILE_SIZE - 1) / TILE_SIZE;
+	tr->tiles_count = tr->tile_cols * tr->tile_rows;
+
+	// The bins grow as triangles are added to them.
+	tr->bins = calloc(tr->tiles_count, sizeof(int*));
+	tr->bins_counts = calloc(tr->tiles_count, sizeof(int));
+	tr->bins_capacities = calloc(tr->tiles_count, sizeof(int));
+
+	if (!tr->bins || !tr->bins_counts || !tr->bins_capacities)
+	{
+		log_error("Failed to allocate memory for the tiled rasteriser bins.");
+		return STATUS_ALLOC_FAILURE;
+	}
+
+	return STATUS_OK;
+}
+
+Status tiled_rasteriser_init(TiledRasteriser* tr, int width, int height)
+{
+	memset(tr, 0, sizeof(TiledRasteriser));
+
+	tr->width = width;
+	tr->height = height;
+
+	for (int i = 0; i < MAX_JOB_WORKERS; ++i)
+	{
+		render_buffers_init(&tr->workers_buffers[i]);
+	}
+
+	return tiled_rasteriser_resize_bins(tr);
+}
+
+Status tiled_rasteriser_resize(TiledRasteriser* tr, int width, int height)
+{
+	if (tr->width == width && tr->height == height)
+	{
+		return STATUS_OK;
+	}
+
+	tr->width = width;
+	tr->height = height;
+
+	return tiled_rasteriser_resize_bins(tr);
+}
+
+void tiled_rasteriser_begin(TiledRasteriser* tr, int vertex_stride)
+{
+	// The capacity is in triangles, so if the number of lights has changed the
+	// triangles buffer must be reallocated.
+	if (tr->vertex_stride != vertex_stride)
+	{
+		tr->triangles_capacity = 0;
+	}
+
+	tr->vertex_stride = vertex_stride;
+	tr->triangles_count = 0;
+
+	memset(tr->bins_counts, 0, (size_t)tr->tiles_count * sizeof(int));
+}
+
+void tiled_rasteriser_bin_triangle(TiledRasteriser* tr, const float* vc0, const float* vc1, const float* vc2)
+{
+	const int stride = tr->vertex_stride;
+
+	// Make room for the triangle.
+	if (tr->triangles_count == tr->triangles_capacity)
+	{
+		const int new_capacity = max(tr->triangles_capacity * 2, 1024);
+		if (STATUS_OK != resize_float_buffer(&tr->triangles, new_capacity * stride * 3))
+		{
+			return;
+		}
+
+		tr->triangles_capacity = new_capacity;
+	}
+
+	const int triangle_index = tr->triangles_count;
+
+	float* out = tr->triangles + (size_t)triangle_index * stride * 3;
+	memcpy(out, vc0, stride * sizeof(float));
+	memcpy(out + stride, vc1, stride * sizeof(float));
+	memcpy(out + stride * 2, vc2, stride * sizeof(float));
+
+	++tr->triangles_count;
+
+	// Find the tiles that the triangle's bounding box overlaps. A pixel is drawn
+	// if its centre is inside the triangle, so truncating the bounds is enough.
+	const float min_x = min(min(vc0[0], vc1[0]), vc2[0]);
+	const float max_x = max(max(vc0[0], vc1[0]), vc2[0]);
+	const float min_y = min(min(vc0[1], vc1[1]), vc2[1]);
+	const float max_y = max(max(vc0[1], vc1[1]), vc2[1]);
+
+	const int tile_x0 = max((int)min_x, 0) / TILE_SIZE;
+	const int tile_y0 = max((int)min_y, 0) / TILE_SIZE;
+	const int tile_x1 = min((int)max_x, tr->width - 1) / TILE_SIZE;
+	const int tile_y1 = min((int)max_y, tr->height - 1) / TILE_SIZE;
+
+	for (int y = tile_y0; y <= tile_y1; ++y)
+	{
+		for (int x = tile_x0; x <= tile_x1; ++x)
+		{
+			const int tile_index = y * tr->tile_cols + x;
+
+			// Grow the bin if necessary.
+			if (tr->bins_counts[tile_index] == tr->bins_capacities[tile_index])
+			{
+				const int new_capacity = max(tr->bins_capacities[tile_index] * 2, 64);
+				if (STATUS_OK != resize_int_buffer(&tr->bins[tile_index], new_capacity))
+				{
+					continue;
+				}
+
+				tr->bins_capacities[tile_index] = new_capacity;
+			}
+
+			tr->bins[tile_index][tr->bins_counts[tile_index]++] = triangle_index;
+		}
+	}
+}
+
+void tiled_rasteriser_flush(TiledRasteriser* tr, JobSystem* js, int worker_index, RenderTarget* rt, const RenderSettings* settings, int lights_count, DepthBuffer* depth_maps)
+{
+	if (0 == tr->triangles_count)
+	{
+		return;
+	}
+
+	tr->rt = rt;
+	tr->settings = settings;
+	tr->lights_count = lights_count;
+	tr->depth_maps = depth_maps;
+
+	// Make sure each worker's buffers fit the current number of lights.
+	for (int i = 0; i < js->workers_count; ++i)
+	{
+		RenderBuffers* rbs = &tr->workers_buffers[i];
+		if (!rbs->triangle_vertices || rbs->lights_count != lights_count)
+		{
+			rbs->lights_count = lights_count;
+			render_buffers_resize_raster(rbs);
+		}
+	}
+
+	// The tiles cost very different amounts, so each job is a single tile and
+	// the workers steal the rest as they finish.
+	parallel_for(js, worker_index, tr->tiles_count, 1, rasterise_tiles_job, tr);
+}
+
+void tiled_rasteriser_destroy(TiledRasteriser* tr)
+{
+	for (int i = 0; i < MAX_JOB_WORKERS; ++i)
+	{
+		render_buffers_destroy(&tr->workers_buffers[i]);
+	}
+
+	for (int i = 0; i < tr->tiles_count; ++i)
+	{
+		free(tr->bins[i]);
+	}
+
+	free(tr->bins);
+	free(tr->bins_counts);
+	free(tr->bins_capacities);
+	free(tr->triangles);
+
+	memset(tr, 0, sizeof(TiledRasteriser));
+}
@@ -0,0 +1,77 @@
+#ifndef TILED_RASTERISER_H
+#define TILED_RASTERISER_H
+
+#include "render_target.h"
+#include "render_buffers.h"
+#include "depth_buffer.h"
+#include "render_settings.h"
+#include "job_system.h"
+
+#include "common/status.h"
+
+/*
+
+Tiled rasterisation
+
+Instead of drawing each triangle as soon as it is projected, the triangles are
+binned into the screen tiles that their bounding box overlaps. Once all the
+triangles for the frame are binned, the tiles are rasterised on the job
+system's workers. A tile is only ever drawn by one worker, so the workers can
+write to the canvas and depth buffer without any locks.
+
+Each bin stores the triangles in the order they were submitted, so the depth
+testing behaves exactly the same as drawing them immediately. A span that is
+cut by a tile's edge still steps its values from the start of the span, so the
+pixels are exactly the same too.
+
+*/
+
+#define TILE_SIZE 64
+
+typedef struct
+{
+	// Tile grid.
+	int width, height;
+	int tile_cols, tile_rows;
+	int tiles_count;
+
+	// Binned triangles, 3 interleaved vertices of vertex_stride floats each, in
+	// the same format that draw_triangle takes.
+	float* triangles;
+	int triangles_count;
+	int triangles_capacity;
+	int vertex_stride;
+
+	// For each tile, the indices of the triangles that overlap it.
+	int** bins;
+	int* bins_counts;
+	int* bins_capacities;
+
+	// Each job worker needs its own temporary buffers for drawing triangles.
+	RenderBuffers workers_buffers[MAX_JOB_WORKERS];
+
+	// Per flush data.
+	RenderTarget* rt;
+	const RenderSettings* settings;
+	int lights_count;
+	DepthBuffer* depth_maps;
+
+} TiledRasteriser;
+
+Status tiled_rasteriser_init(TiledRasteriser* tr, int width, int height);
+
+Status tiled_rasteriser_resize(TiledRasteriser* tr, int width, int height);
+
+// Clears the bins ready for a new frame.
+void tiled_rasteriser_begin(TiledRasteriser* tr, int vertex_stride);
+
+// Copies the triangle's vertex data and adds it to the bins it overlaps.
+void tiled_rasteriser_bin_triangle(TiledRasteriser* tr, const float* vc0, const float* vc1, const float* vc2);
+
+// Rasterises all the binned triangles on the job system's workers, returns once
+// every tile is drawn. worker_index is the worker that is calling it.
+void tiled_rasteriser_flush(TiledRasteriser* tr, JobSystem* js, int worker_index, RenderTarget* rt, const RenderSettings* settings, int lights_count, DepthBuffer* depth_maps);
+
+void tiled_rasteriser_destroy(TiledRasteriser* tr);
+
+#endif
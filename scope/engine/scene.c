@@ -20,7 +20,8 @@ Status scene_init(Scene* scene)
 
 Status scene_destroy(Scene* scene)
 {
-	// TODO: Cleanup
-	log_warn("Need to implement scene_destroy.");
+	free_models(&scene->models);
+	point_lights_destroy(&scene->point_lights);
+
 	return STATUS_OK;
 }
@@ -29,6 +29,10 @@ Here until I can think of a better place to put it.
 #define STRIDE_SPHERE	4				// Center (x,y,z), Radius	
 #define STRIDE_POINT_LIGHT_ATTRIBUTES 4 // r,g,b,strength
 #define STRIDE_MI_TRANSFORM 9			// Position, Eulers, Scale
+#define STRIDE_PLANE	4				// Normal (x,y,z), d
+#define STRIDE_CONE		4				// Axis (x,y,z), Cutoff
+#define STRIDE_M4		16
+#define STRIDE_INTERSECTED_PLANES 7		// Count, then up to 6 plane indices
 
 // TODO: Not sure on the ENTIRE naming conventions. Could make this better.
 
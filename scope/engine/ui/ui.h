@@ -8,7 +8,7 @@
 
 #include "common/status.h"
 
-#define MAX_TEXT 10
+#define MAX_TEXT 12
 
 typedef struct
 {
@@ -10,6 +10,12 @@ float* directions;
 
 // TODO: Switch to C compiler.
 
+static void toggle_setting(int* setting, const char* name)
+{
+    *setting = !*setting;
+    log_info("%s: %s", name, *setting ? "on" : "off");
+}
+
 void engine_on_init(Engine* engine)
 {    
     if (STATUS_OK != resources_load_texture(&engine->resources, "C:/Users/olive/source/repos/scope/scope/res/textures/rickreal.bmp"))
@@ -20,6 +26,22 @@ void engine_on_init(Engine* engine)
     g_draw_normals = 0;
     g_debug_shadows = 0;
 
+    // The render settings this scene uses, each can be toggled with the number
+    // keys, see engine_on_keyup. The ground hides what's below it, and only the
+    // moving instances are drawn to the shadow maps each frame, the rest are 
+    // kept from the frame the static ones last changed. The fused pipeline is 
+    // run on one thread, so the parallel stages are used instead.
+    RenderSettings* settings = &engine->renderer.settings;
+    settings->occlusion_culling = 1;
+    settings->tiled_rasterisation = 1;
+    settings->half_space_rasterisation = 1;
+    settings->indexed_front_faces = 1;
+    settings->fused_instance_pipeline = 0;
+    settings->guard_band_clipping = 1;
+    settings->parallel_instance_stages = 1;
+    settings->cached_static_shadows = 1;
+    settings->shadow_map_update_budget = 0;
+
     // Create a scene
     Scene* scene = &engine->scenes[0];
     Status status = scene_init(scene);
@@ -48,6 +70,11 @@ void engine_on_init(Engine* engine)
     V3 plane_pos = { 0, 0, -4 };
     V3 plane_scale = { 5.f, 0.1f, 10.f };
     mi_set_transform(&scene->models, 0, plane_pos, eulers, plane_scale);
+    
+    // The ground hides anything below it, and never moves so its shadows are
+    // cached.
+    mi_set_occluder(&scene->models, 0, 1);
+    mi_set_static(&scene->models, 0, 1);
 
     if (0)
     {
@@ -164,6 +191,54 @@ void engine_on_keyup(Engine* engine, WPARAM wParam)
         scene->point_lights.attributes[2] = 0.f;
         break;
     }
+    case '1':
+    {
+        toggle_setting(&engine->renderer.settings.occlusion_culling, "Occlusion culling");
+        break;
+    }
+    case '2':
+    {
+        toggle_setting(&engine->renderer.settings.tiled_rasterisation, "Tiled rasterisation");
+        break;
+    }
+    case '3':
+    {
+        toggle_setting(&engine->renderer.settings.half_space_rasterisation, "Half-space rasterisation");
+        break;
+    }
+    case '4':
+    {
+        toggle_setting(&engine->renderer.settings.indexed_front_faces, "Indexed front faces");
+        break;
+    }
+    case '5':
+    {
+        toggle_setting(&engine->renderer.settings.fused_instance_pipeline, "Fused instance pipeline");
+        break;
+    }
+    case '6':
+    {
+        toggle_setting(&engine->renderer.settings.guard_band_clipping, "Guard band clipping");
+        break;
+    }
+    case '7':
+    {
+        toggle_setting(&engine->renderer.settings.parallel_instance_stages, "Parallel instance stages");
+        break;
+    }
+    case '8':
+    {
+        toggle_setting(&engine->renderer.settings.cached_static_shadows, "Cached static shadows");
+        break;
+    }
+    case '9':
+    {
+        // Cycle the budget through none, 1, 2 and 4 shadow maps a frame.
+        int* budget = &engine->renderer.settings.shadow_map_update_budget;
+        *budget = (*budget >= 4) ? 0 : max(1, *budget * 2);
+        log_info("Shadow map update budget: %d", *budget);
+        break;
+    }
     }
 }
 